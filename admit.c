@@ -0,0 +1,154 @@
+/*
+ * admit.c - admission control: shed load with a fast 503 before the proxy falls over
+ *
+ * 거절 응답은 시작할 때 한 번 만들어 둔다. accept 스레드에서 보낼 때는 막히면 안 되므로
+ * non-blocking send 한 번만 하고 닫는다 (작은 응답이라 빈 소켓 버퍼에 항상 들어간다).
+ * 카운터는 모두 atomic이고 락은 없다.
+ */
+#include "admit.h"
+#include "cache.h"
+#include "config.h"
+#include "mem.h"
+
+static char shed_resp[256];
+static int shed_len;
+static int spare_fd = -1;   // fd가 바닥났을 때 연결 하나를 받아 503을 보낼 수 있게 비워 두는 fd
+
+static struct {
+  int inflight;                       // 받아서 아직 끝나지 않은 연결 (스레드가 아직 안 돈 것도 포함)
+  int queued;                         // 스레드를 만들었지만 아직 돌기 시작하지 않은 연결
+  long long delay_ewma_us;            // queueing delay의 지수 이동 평균
+  unsigned long long admitted;
+  unsigned long long shed_inflight;   // max_inflight에 걸려 accept에서 거절
+  unsigned long long shed_fd;         // fd나 스레드를 못 만들어서 거절
+  unsigned long long shed_queue;      // queueing delay에 걸려 거절
+  unsigned long long shed_memory;     // 메모리가 hard 한도에 닿아서 accept에서 거절 (mem.c)
+  unsigned long long hits_shedding;   // 거절하는 동안에도 보낸 캐시 hit
+} stats;
+
+#define STAT_ADD(field, n) __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+#define STAT_GET(field) __atomic_load_n(&stats.field, __ATOMIC_RELAXED)
+
+void admit_init(void) {
+  static const char body[] = "proxy overloaded, retry later\n";
+
+  shed_len = snprintf(shed_resp, sizeof(shed_resp), "HTTP/1.0 503 Service Unavailable\r\n"
+                      "Content-type: text/plain\r\nContent-length: %d\r\nRetry-After: %d\r\n"
+                      "Connection: close\r\n\r\n%s", (int)strlen(body), conf.shed_retry_after, body);
+  spare_fd = open("/dev/null", O_RDONLY);
+}
+
+/*
+ * admit_refuse - accept 스레드에서 resp를 보내고 닫는다. 이미 와 있는 요청은 읽어서 버린다
+ *   (안 읽고 닫으면 RST가 응답을 지울 수 있다)
+ */
+void admit_refuse(int fd, const char *resp, int len) {
+  char scratch[4096];
+  int i;
+
+  for (i = 0; i < 4 && recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT) > 0; i++)
+    ;
+  send(fd, resp, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  close(fd);
+}
+
+static void reject_now(int fd) {
+  admit_refuse(fd, shed_resp, shed_len);
+}
+
+/*
+ * admit_accept - 방금 받은 연결을 처리할지 정한다. 받으면 1 (끝날 때 admit_done),
+ *   max_inflight를 넘었거나 메모리가 hard 한도에 닿았으면 503을 보내고 닫은 뒤 0.
+ *   메모리가 soft 한도를 넘은 동안은 max_inflight를 낮춰서 본다
+ */
+int admit_accept(int connfd) {
+  int limit = conf.max_inflight, level = mem_level();
+
+  if (level == MEM_HARD) {
+    reject_now(connfd);
+    STAT_ADD(shed_memory, 1);
+    return 0;
+  }
+  if (level == MEM_SOFT && limit > 0)
+    limit = limit * MEM_SOFT_INFLIGHT_PCT / 100 > 0 ? limit * MEM_SOFT_INFLIGHT_PCT / 100 : 1;
+  if (limit > 0 && __atomic_load_n(&stats.inflight, __ATOMIC_RELAXED) >= limit) {
+    reject_now(connfd);
+    STAT_ADD(shed_inflight, 1);
+    return 0;
+  }
+  STAT_ADD(inflight, 1);
+  STAT_ADD(queued, 1);
+  return 1;
+}
+
+/*
+ * admit_overflow - accept가 EMFILE/ENFILE로 실패했을 때 부른다. 비워 둔 fd로 연결 하나를 받아서
+ *   503을 보내고 닫는다. 그러지 않으면 대기열의 연결들이 답을 못 받고 기다리기만 한다
+ */
+void admit_overflow(int listenfd) {
+  int fd;
+
+  if (spare_fd >= 0) {
+    close(spare_fd);
+    if ((fd = accept(listenfd, NULL, NULL)) >= 0) {
+      reject_now(fd);
+      STAT_ADD(shed_fd, 1);
+    }
+    spare_fd = open("/dev/null", O_RDONLY);
+  }
+  if (spare_fd < 0)
+    usleep(10000);  // 503도 못 보내면 연결이 끝나서 fd가 돌아올 때까지 잠깐 쉰다
+}
+
+/*
+ * admit_start - 연결 스레드가 돌기 시작할 때 부른다. 기다린 시간이 shed_queue_ms를 넘었으면 1 (거절할 차례)
+ */
+int admit_start(long long accepted_ms) {
+  long long delay_us = (now_ms() - accepted_ms) * 1000;
+  long long ewma = __atomic_load_n(&stats.delay_ewma_us, __ATOMIC_RELAXED);
+
+  STAT_ADD(queued, -1);
+  STAT_ADD(admitted, 1);
+  __atomic_store_n(&stats.delay_ewma_us, ewma + (delay_us - ewma) / 8, __ATOMIC_RELAXED);
+  if (conf.shed_queue_ms > 0 && delay_us > conf.shed_queue_ms * 1000LL) {
+    STAT_ADD(shed_queue, 1);
+    return 1;
+  }
+  return 0;
+}
+
+void admit_done(void) {
+  STAT_ADD(inflight, -1);
+}
+
+// 받아서 아직 끝나지 않은 연결 수. hot restart로 물러나는 프로세스가 다 끝나기를 기다릴 때 본다
+int admit_inflight(void) {
+  return STAT_GET(inflight);
+}
+
+/*
+ * admit_failed - admit_accept로 받았지만 스레드(나 그 인자, arena)를 만들지 못했을 때. 센 것을 되돌리고 503
+ */
+void admit_failed(int connfd) {
+  STAT_ADD(inflight, -1);
+  STAT_ADD(queued, -1);
+  STAT_ADD(shed_fd, 1);
+  reject_now(connfd);
+}
+
+// 연결 스레드에서 거절할 때 (idle deadline이 걸려 있으니 막혀도 끝난다)
+void admit_reject(int fd) {
+  rio_writen(fd, shed_resp, shed_len);
+}
+
+void admit_hit_served(void) {
+  STAT_ADD(hits_shedding, 1);
+}
+
+void admit_stats(FILE *fp) {
+  fprintf(fp, "admission inflight %d queued %d queue_delay_avg_ms %.2f admitted %llu "
+          "shed inflight %llu fd %llu queue %llu memory %llu hits_while_shedding %llu\n",
+          STAT_GET(inflight), STAT_GET(queued), STAT_GET(delay_ewma_us) / 1000.0, STAT_GET(admitted),
+          STAT_GET(shed_inflight), STAT_GET(shed_fd), STAT_GET(shed_queue), STAT_GET(shed_memory),
+          STAT_GET(hits_shedding));
+}
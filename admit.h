@@ -0,0 +1,28 @@
+/*
+ * admit.h - admission control: shed load with a fast 503 before the proxy falls over
+ *
+ * 연결마다 스레드를 만들기 때문에, 감당할 수 있는 것보다 많이 들어오면 스레드와 fd와 메모리가
+ * 끝없이 늘어나고 모든 요청이 같이 느려진다. 여기서는 두 곳에서 미리 거절한다.
+ *   - accept: 처리 중인 연결이 max_inflight를 넘으면 스레드를 만들지 않고 accept 스레드가
+ *     미리 만들어 둔 503을 바로 보내고 닫는다. fd가 바닥나도(EMFILE) 같은 503을 보낸다
+ *   - 스레드 시작: accept부터 스레드가 돌기 시작할 때까지 기다린 시간(queueing delay)이
+ *     shed_queue_ms를 넘으면 origin까지 가지 않고 503. shed_allow_hits면 캐시 hit은 보낸다
+ */
+#ifndef __ADMIT_H__
+#define __ADMIT_H__
+
+#include "csapp.h"
+
+void admit_init(void);
+int admit_accept(int connfd);
+void admit_overflow(int listenfd);
+void admit_failed(int connfd);
+int admit_start(long long accepted_ms);
+void admit_done(void);
+int admit_inflight(void);
+void admit_reject(int fd);
+void admit_refuse(int fd, const char *resp, int len);
+void admit_hit_served(void);
+void admit_stats(FILE *fp);
+
+#endif /* __ADMIT_H__ */
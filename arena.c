@@ -0,0 +1,195 @@
+/*
+ * arena.c - per-connection bump allocator
+ *
+ * 빈 arena는 먼저 스레드 자신의 freelist(pthread key)에 두고, 넘치거나 스레드가 끝나면
+ * 스레드들이 같이 쓰는 pool로 보낸다. 그래서 보통은 락 없이 arena를 얻고 돌려준다.
+ */
+#include "arena.h"
+
+static arena *pool;               // 스레드들이 같이 쓰는 빈 arena들
+static int pool_count;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t thread_key;  // 스레드의 빈 arena 리스트
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static size_t total_bytes;        // 할당해 둔 chunk 바이트 (쓰는 arena + 빈 arena). atomic
+
+// 메모리가 바닥났으면 NULL (죽지 않고 요청 하나만 실패시킨다)
+static arena_chunk *chunk_new(size_t size) {
+  arena_chunk *c = malloc(sizeof(arena_chunk) + size);
+
+  if (c == NULL)
+    return NULL;
+  __atomic_add_fetch(&total_bytes, sizeof(arena_chunk) + size, __ATOMIC_RELAXED);
+  c->next = NULL;
+  c->size = size;
+  c->used = 0;
+  return c;
+}
+
+static void chunk_free(arena_chunk *c) {
+  __atomic_sub_fetch(&total_bytes, sizeof(arena_chunk) + c->size, __ATOMIC_RELAXED);
+  free(c);
+}
+
+// 첫 chunk만 남기고 나머지(크게 자란 버퍼들)는 돌려준다
+static void arena_reset(arena *a) {
+  arena_chunk *c = a->head, *next;
+
+  while (c->next != NULL) {
+    next = c->next;
+    chunk_free(c);
+    c = next;
+  }
+  c->used = 0;
+  a->head = c;
+}
+
+static void arena_destroy(arena *a) {
+  arena_reset(a);
+  chunk_free(a->head);
+  free(a);
+}
+
+static void pool_put(arena *a) {
+  pthread_mutex_lock(&pool_mutex);
+  if (pool_count < ARENA_POOL_MAX) {
+    a->next = pool;
+    pool = a;
+    pool_count++;
+    a = NULL;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  if (a != NULL)
+    arena_destroy(a);
+}
+
+// 스레드가 끝날 때 그 스레드가 들고 있던 빈 arena들을 pool로 보낸다
+static void thread_exit(void *list) {
+  arena *a = list, *next;
+
+  for (; a != NULL; a = next) {
+    next = a->next;
+    pool_put(a);
+  }
+}
+
+static void key_init(void) {
+  pthread_key_create(&thread_key, thread_exit);
+}
+
+/*
+ * arena_get - 빈 arena 하나. 스레드의 freelist, pool 순으로 찾고 없으면 새로 만든다.
+ *   새로 만들 메모리가 없으면 NULL
+ */
+arena *arena_get(void) {
+  arena *a;
+
+  pthread_once(&key_once, key_init);
+  if ((a = pthread_getspecific(thread_key)) != NULL) {
+    pthread_setspecific(thread_key, a->next);
+    return a;
+  }
+  pthread_mutex_lock(&pool_mutex);
+  if ((a = pool) != NULL) {
+    pool = a->next;
+    pool_count--;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  if (a == NULL) {
+    if ((a = malloc(sizeof(arena))) == NULL)
+      return NULL;
+    if ((a->head = chunk_new(ARENA_CHUNK_SIZE)) == NULL) {
+      free(a);
+      return NULL;
+    }
+  }
+  a->next = NULL;
+  return a;
+}
+
+/*
+ * arena_put - a에서 할당한 것들을 모두 버리고 a를 freelist로 돌려준다
+ */
+void arena_put(arena *a) {
+  arena *list;
+  int n = 0;
+
+  arena_reset(a);
+  pthread_once(&key_once, key_init);
+  list = pthread_getspecific(thread_key);
+  for (arena *p = list; p != NULL; p = p->next)
+    n++;
+  if (n >= ARENA_THREAD_MAX) {
+    pool_put(a);
+    return;
+  }
+  a->next = list;
+  pthread_setspecific(thread_key, a);
+}
+
+/*
+ * arena_bytes - 모든 arena가 잡고 있는 chunk 바이트. 메모리 사용량을 셀 때 (mem.c)
+ */
+size_t arena_bytes(void) {
+  return __atomic_load_n(&total_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * arena_trim - pool에 있는 빈 arena들을 모두 돌려준다. 메모리가 모자랄 때 부른다.
+ *   스레드들이 들고 있는 빈 arena는 스레드가 끝날 때 pool로 오므로 다음 번에 돌려준다
+ */
+void arena_trim(void) {
+  arena *list, *next;
+
+  pthread_mutex_lock(&pool_mutex);
+  list = pool;
+  pool = NULL;
+  pool_count = 0;
+  pthread_mutex_unlock(&pool_mutex);
+  for (; list != NULL; list = next) {
+    next = list->next;
+    arena_destroy(list);
+  }
+}
+
+/*
+ * arena_alloc - ARENA_ALIGN으로 정렬된 size 바이트. 지금 chunk에 자리가 없으면 새 chunk를 붙인다.
+ *   따로 해제하지 않는다 (arena_put이 한 번에 버린다). 새 chunk를 만들 메모리가 없으면 NULL
+ */
+void *arena_alloc(arena *a, size_t size) {
+  arena_chunk *c = a->head;
+  size_t off = (c->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (off + size > c->size) {
+    if ((c = chunk_new(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE)) == NULL)
+      return NULL;
+    c->next = a->head;
+    a->head = c;
+    off = 0;
+  }
+  c->used = off + size;
+  return c->data + off;
+}
+
+/*
+ * arena_grow - p(크기 old_size)를 new_size로 늘린다. p가 마지막 할당이고 chunk에 자리가 있으면
+ *   제자리에서 늘리고, 아니면 새로 할당해서 내용을 옮긴다. p가 NULL이면 arena_alloc과 같다.
+ *   할당하지 못하면 NULL이고 p는 그대로 남는다
+ */
+void *arena_grow(arena *a, void *p, size_t old_size, size_t new_size) {
+  arena_chunk *c = a->head;
+  void *q;
+
+  if (p == NULL)
+    return arena_alloc(a, new_size);
+  if ((char *)p + old_size == c->data + c->used && (char *)p - c->data + new_size <= c->size) {
+    c->used = (char *)p - c->data + new_size;
+    return p;
+  }
+  if ((q = arena_alloc(a, new_size)) == NULL)
+    return NULL;
+  memcpy(q, p, old_size);
+  return q;
+}
@@ -0,0 +1,36 @@
+/*
+ * arena.h - per-connection bump allocator
+ *
+ * 요청 하나를 처리하는 동안 필요한 버퍼들은 arena에서 잘라 쓰고, 연결이 끝나면 한 번에 버린다.
+ * 다 쓴 arena는 첫 chunk만 남기고 freelist에 돌아가서 다음 연결이 다시 쓴다.
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "csapp.h"
+
+#define ARENA_CHUNK_SIZE (32 * 1024)  // 첫 chunk 크기. 캐시 hit 하나는 보통 이 안에서 끝난다
+#define ARENA_ALIGN 16
+#define ARENA_THREAD_MAX 4            // 스레드마다 들고 있는 빈 arena 수
+#define ARENA_POOL_MAX 64             // 스레드들이 같이 쓰는 freelist에 두는 빈 arena 수
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;      // data 크기
+  size_t used;
+  char data[];
+} arena_chunk;
+
+typedef struct arena {
+  arena_chunk *head;    // 지금 잘라 쓰는 chunk. 첫 chunk는 리스트 맨 끝에 있다
+  struct arena *next;   // freelist 링크
+} arena;
+
+arena *arena_get(void);
+void arena_put(arena *a);
+void *arena_alloc(arena *a, size_t size);
+void *arena_grow(arena *a, void *p, size_t old_size, size_t new_size);
+size_t arena_bytes(void);
+void arena_trim(void);
+
+#endif /* __ARENA_H__ */
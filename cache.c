@@ -0,0 +1,1104 @@
+/*
+ * cache.c - LRU web object cache with Vary-aware variants
+ *
+ * 하나의 url에 대해 origin이 Vary 헤더를 보내면, Vary에 나열된 요청 헤더 값들을
+ * 정규화한 문자열(variant)로 블럭을 구분해서 최대 CACHE_MAX_VARIANTS개까지 저장한다.
+ * 조회 시에는 url이 같은 블럭에 대해 variant 해시를 먼저 비교하므로 비용이 작다.
+ *
+ * 텍스트 응답은 gzip으로 압축해서 저장할 수 있다 (cache_compress). gzip을 받는 클라이언트에는
+ * 압축본을 그대로 보내고, 아닌 클라이언트가 처음 오면 풀어서 보낸 뒤 identity본을 블럭에 붙여 둔다.
+ * 용량은 블럭 수가 아니라 저장된 바이트(압축본 + identity본 + 키)로 MAX_CACHE_SIZE까지 쓴다.
+ *
+ * 인덱스와 객체는 모두 하나의 영역에 있다. cache_shm 옵션을 주면 이름 있는 POSIX 공유 메모리라서
+ * 같은 호스트의 프록시 프로세스들이 캐시 하나를 같이 쓴다. 락은 process-shared robust mutex
+ * 하나이고, 읽는 쪽은 락을 잡은 동안 응답을 호출한 쪽 버퍼로 복사만 한다.
+ * 옵션이 없어도 영역은 이름을 지운 공유 메모리라서, hot restart 때 fd를 새 프로세스에 넘기면
+ * 새 프로세스가 같은 캐시를 이어서 쓴다 (restart.c).
+ * 수정하는 동안에는 dirty를 세워 두므로, 락을 잡은 채로 죽은 프로세스가 수정 도중이었다면
+ * 다음에 락을 잡는 프로세스가 캐시를 비우고 다시 쓴다.
+ */
+#include "cache.h"
+#include "config.h"
+#include "compress.h"
+
+#define CACHE_MAGIC 0x63616332  // "cac2". 레이아웃을 바꾸면 올린다
+#define SLAB_ALIGN 8
+
+static Cache *cache;      // 영역의 시작. 영역 맨 앞에 Cache 헤더가 있다
+static int region_fd = -1;  // 프로세스 전용 영역의 fd (cache_region_fd)
+#define CPTR(off) ((char *)cache + (off))
+
+/* 연결에 실패한 origin들. 만료 전까지는 getaddrinfo/connect 없이 바로 502를 돌려준다 */
+typedef struct {
+  char host[MAXLINE];
+  int port;
+  long long expires;
+} neg_host;
+
+static neg_host neg_hosts[NEG_HOSTS_COUNT];
+static sem_t neg_mutex;
+
+static void build_variant(char *vary, http_request *req, char *variant, int maxlen);
+
+long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 비어있지 않고 만료되지 않은 블럭이면 1
+static int cache_live(int i, long long now) {
+  return cache->cacheobjs[i].isEmpty == 0
+      && (cache->cacheobjs[i].expires == 0 || now < cache->cacheobjs[i].expires);
+}
+
+/* FNV-1a */
+static unsigned int cache_hash(char *s) {
+  unsigned int h = 2166136261u;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * slab allocator. chunk 크기는 class가 정하므로 chunk에는 헤더가 없다.
+ * 오프셋으로 slab을 찾고, slab으로 class를 찾는다.
+ */
+#define SLAB_OF(off) (((off) - cache->slab_base) / SLAB_SIZE)
+#define SLAB_PTR(s) CPTR(cache->slab_base + (shm_off)(s) * SLAB_SIZE)
+#define NEXT_FREE(off) (*(shm_off *)CPTR(off))
+
+// class 크기표를 만든다. 영역을 만들 때 한 번
+static void slab_classes_init(void) {
+  double size = SLAB_MIN_CHUNK;
+  int n = 0;
+  unsigned int chunk;
+
+  while (n < SLAB_MAX_CLASSES - 1) {
+    chunk = ((unsigned int)size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    if (chunk > SLAB_SIZE / 2)
+      break;
+    cache->classes[n++].chunk_size = chunk;
+    size *= SLAB_GROWTH;
+  }
+  cache->classes[n++].chunk_size = SLAB_SIZE;   // 마지막 class는 slab 통째로
+  cache->nclasses = n;
+}
+
+// 모든 slab을 빈 상태로 되돌린다
+static void slab_init(void) {
+  int i;
+
+  for (i = 0; i < cache->nclasses; i++) {
+    slab_class *c = &cache->classes[i];
+    unsigned int chunk = c->chunk_size;
+    memset(c, 0, sizeof(*c));
+    c->chunk_size = chunk;
+    c->per_slab = SLAB_SIZE / chunk;
+  }
+  for (i = 0; i < SLAB_COUNT; i++) {
+    cache->slabs[i].cls = -1;
+    cache->slabs[i].used = 0;
+  }
+  cache->free_slabs = SLAB_COUNT;
+}
+
+// size 바이트가 들어가는 가장 작은 class. 너무 크면 -1
+static int slab_class_of(unsigned int size) {
+  int i;
+
+  for (i = 0; i < cache->nclasses; i++)
+    if (cache->classes[i].chunk_size >= size)
+      return i;
+  return -1;
+}
+
+// 빈 slab 하나를 class에 붙이고 chunk들로 쪼개서 free list에 넣는다. 빈 slab이 없으면 -1
+static int slab_assign(int cls) {
+  slab_class *c = &cache->classes[cls];
+  shm_off base, off;
+  int s;
+  unsigned int j;
+
+  for (s = 0; s < SLAB_COUNT && cache->slabs[s].cls >= 0; s++)
+    ;
+  if (s == SLAB_COUNT)
+    return -1;
+  cache->slabs[s].cls = cls;
+  cache->slabs[s].used = 0;
+  cache->free_slabs--;
+  c->nslabs++;
+  base = cache->slab_base + (shm_off)s * SLAB_SIZE;
+  for (j = c->per_slab; j > 0; j--) {   // 앞쪽 chunk가 먼저 나가도록 뒤에서부터 넣는다
+    off = base + (j - 1) * c->chunk_size;
+    NEXT_FREE(off) = c->free_list;
+    c->free_list = off;
+  }
+  c->free_chunks += c->per_slab;
+  return s;
+}
+
+// 다 비은 slab을 class에서 떼어 빈 slab으로 돌린다. 물리 메모리도 돌려준다
+static void slab_release(int s) {
+  int cls = cache->slabs[s].cls;
+  slab_class *c = &cache->classes[cls];
+  shm_off *prev = &c->free_list, off;
+
+  // free list에서 이 slab의 chunk들을 뺀다
+  while ((off = *prev) != 0) {
+    if (SLAB_OF(off) == (shm_off)s)
+      *prev = NEXT_FREE(off);
+    else
+      prev = &NEXT_FREE(off);
+  }
+  c->free_chunks -= c->per_slab;
+  c->nslabs--;
+  cache->slabs[s].cls = -1;
+  cache->free_slabs++;
+  // 공유 메모리의 페이지를 실제로 놓아서 RSS가 쓰는 만큼만 유지되게 한다 (안 되면 그냥 둔다)
+  madvise(SLAB_PTR(s), SLAB_SIZE, MADV_REMOVE);
+}
+
+// cls class의 chunk 하나. free chunk도 빈 slab도 없으면 0
+static shm_off slab_alloc(int cls, unsigned int size) {
+  slab_class *c = &cache->classes[cls];
+  shm_off off;
+
+  if (c->free_list == 0 && slab_assign(cls) < 0)
+    return 0;
+  off = c->free_list;
+  c->free_list = NEXT_FREE(off);
+  c->free_chunks--;
+  c->used_chunks++;
+  c->requested += size;
+  cache->slabs[SLAB_OF(off)].used++;
+  return off;
+}
+
+// size는 slab_alloc에 넘겼던 크기 (통계용)
+static void slab_free(shm_off off, unsigned int size) {
+  int s, cls;
+  slab_class *c;
+
+  if (off == 0)
+    return;
+  s = SLAB_OF(off);
+  cls = cache->slabs[s].cls;
+  c = &cache->classes[cls];
+  NEXT_FREE(off) = c->free_list;
+  c->free_list = off;
+  c->free_chunks++;
+  c->used_chunks--;
+  c->requested -= size;
+  if (--cache->slabs[s].used == 0)
+    slab_release(s);
+}
+
+// 인덱스와 slab들을 빈 상태로 되돌린다. 락을 잡고(또는 아무도 못 보는 상태에서) 불러야 한다
+static void cache_reset(void) {
+  int i;
+
+  cache->cache_num = 0; // 맨 처음이니까
+  cache->cache_bytes = 0;
+  for (i=0; i<CACHE_OBJS_COUNT; i++) {
+    memset(&cache->cacheobjs[i], 0, sizeof(cache_block));
+    cache->cacheobjs[i].isEmpty = 1; // 1이 비어있다는 뜻
+  }
+  slab_init();
+}
+
+static void cache_lock(void) {
+  int rc = pthread_mutex_lock(&cache->lock);
+
+  if (rc == EOWNERDEAD) {
+    // 락을 잡고 있던 프로세스가 죽었다. 수정 도중이었으면 인덱스/slab을 믿을 수 없으니 비운다
+    if (cache->dirty) {
+      cache_reset();
+      cache->dirty = 0;
+      cache->recoveries++;
+    }
+    pthread_mutex_consistent(&cache->lock);
+  } else if (rc != 0) {
+    posix_error(rc, "cache lock error");
+  }
+}
+
+static void cache_unlock(void) {
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// writer는 cache_lock 다음에 cache_begin, cache_unlock 전에 cache_end를 부른다
+static void cache_begin(void) {
+  cache->dirty = 1;
+  __sync_synchronize();
+}
+
+static void cache_end(void) {
+  __sync_synchronize();
+  cache->dirty = 0;
+}
+
+// 새로 만든 영역을 초기화한다
+static void cache_format(size_t region_size) {
+  pthread_mutexattr_t attr;
+
+  memset(cache, 0, sizeof(Cache));
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&cache->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  cache->region_size = region_size;
+  cache->slab_base = (sizeof(Cache) + 4095) & ~(size_t)4095;
+  slab_classes_init();
+  cache_reset();
+  cache->magic = CACHE_MAGIC;
+  __sync_synchronize();
+  cache->ready = 1;
+}
+
+// 다른 프로세스가 만든 영역 fd에 붙는다. 크기나 레이아웃이 다르면 붙지 않고 -1
+static int cache_attach(int fd, size_t region_size) {
+  struct stat st;
+  int tries;
+
+  Fstat(fd, &st);
+  if ((size_t)st.st_size != region_size)
+    return -1;
+  cache = Mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  // 만든 프로세스가 아직 초기화 중일 수 있다
+  for (tries = 0; !cache->ready && tries < 500; tries++)
+    usleep(10000);
+  if (!cache->ready || cache->magic != CACHE_MAGIC || cache->region_size != region_size) {
+    Munmap(cache, region_size);
+    cache = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * cache_map - 캐시 영역을 만들거나 이미 있는 공유 메모리에 붙는다.
+ *   이름이 없으면 이 프로세스만 쓰는 영역이다. 이름을 지운 공유 메모리로 만들고 fd를 들고 있어서
+ *   hot restart 때 새 프로세스에 넘길 수 있다 (handoff_fd가 그렇게 넘겨받은 fd)
+ */
+static void cache_map(char *name, size_t region_size, int handoff_fd) {
+  char tmpname[64];
+  int fd;
+
+  if (name[0] == '\0') {
+    if (handoff_fd >= 0) {
+      if (cache_attach(handoff_fd, region_size) == 0) {
+        region_fd = handoff_fd;
+        return;
+      }
+      // 캐시 레이아웃이 바뀐 바이너리로 바꿨다. 넘겨받은 캐시는 버리고 빈 캐시로 시작한다
+      fprintf(stderr, "handed-over cache is not compatible, starting with an empty cache\n");
+      Close(handoff_fd);
+    }
+    snprintf(tmpname, sizeof(tmpname), "/proxy_cache.%d", (int)getpid());
+    if ((fd = shm_open(tmpname, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+      unix_error("cache shm_open error");
+    shm_unlink(tmpname);
+    if (ftruncate(fd, region_size) < 0)
+      unix_error("cache shm ftruncate error");
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    cache = Mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    region_fd = fd;
+    cache_format(region_size);
+    return;
+  }
+
+  // 이름 있는 영역은 새 프로세스도 이름으로 붙으므로 fd를 넘겨받지 않는다
+  if (handoff_fd >= 0)
+    Close(handoff_fd);
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+    // 처음 만든 프로세스가 초기화한다
+    if (ftruncate(fd, region_size) < 0)
+      unix_error("cache shm ftruncate error");
+    cache = Mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Close(fd);
+    cache_format(region_size);
+    return;
+  }
+  if (errno != EEXIST || (fd = shm_open(name, O_RDWR, 0)) < 0)
+    unix_error("cache shm_open error");
+  if (cache_attach(fd, region_size) < 0)
+    app_error("cache shm is not a compatible proxy cache (built with other cache settings?)");
+  Close(fd);
+}
+
+/*
+ * cache_init - handoff_fd는 hot restart로 예전 프로세스에게서 넘겨받은 캐시 영역. 없으면 -1
+ */
+void cache_init(int handoff_fd) {
+  // 헤더 뒤에 페이지 정렬된 slab들. 객체가 차지할 수 있는 메모리는 SLAB_COUNT * SLAB_SIZE로 고정이다
+  size_t region_size = ((sizeof(Cache) + 4095) & ~(size_t)4095) + (size_t)SLAB_COUNT * SLAB_SIZE;
+
+  cache_map(conf.cache_shm, region_size, handoff_fd);
+  Sem_init(&neg_mutex, 0, 1);
+}
+
+/*
+ * cache_region_fd - 프로세스 전용 캐시 영역의 fd. hot restart 때 새 프로세스에 넘긴다.
+ *   cache_shm으로 이름 있는 영역을 쓰면 -1
+ */
+int cache_region_fd(void) {
+  return region_fd;
+}
+
+/*
+ * cache_stats - 캐시 사용량과 slab class별 단편화를 fp에 쓴다.
+ *   internal: 쓰고 있는 chunk 중 요청 크기를 넘는 부분의 비율
+ *   idle: class에 붙어 있지만 비어 있는 chunk 바이트
+ */
+void cache_stats(FILE *fp) {
+  int i;
+
+  cache_lock();
+  fprintf(fp, "cache objects %d bytes %d limit %d\n", cache->cache_num, cache->cache_bytes, MAX_CACHE_SIZE);
+  fprintf(fp, "cache slabs %d size %d free %d reassigns %u recoveries %u\n",
+          SLAB_COUNT, SLAB_SIZE, cache->free_slabs, cache->reassigns, cache->recoveries);
+  fprintf(fp, "slab class  chunk slabs   used   free  requested internal      idle evictions slabs_in\n");
+  for (i = 0; i < cache->nclasses; i++) {
+    slab_class *c = &cache->classes[i];
+    unsigned long long held = (unsigned long long)c->used_chunks * c->chunk_size;
+    if (c->nslabs == 0 && c->evictions == 0 && c->slabs_in == 0)
+      continue;
+    fprintf(fp, "slab %5d %6u %5u %6u %6u %10llu %7.1f%% %9llu %9u %8u\n",
+            i, c->chunk_size, c->nslabs, c->used_chunks, c->free_chunks, c->requested,
+            held ? 100.0 * (held - c->requested) / held : 0.0,
+            (unsigned long long)c->free_chunks * c->chunk_size, c->evictions, c->slabs_in);
+  }
+  cache_unlock();
+}
+
+// 블럭을 비운다. 락을 잡고 불러야 한다
+static void cache_free_block(int i) {
+  cache_block *b = &cache->cacheobjs[i];
+
+  if (b->isEmpty)
+    return;
+  cache->cache_bytes -= b->data_size + b->ident_size;
+  cache->cache_num--;
+  slab_free(b->data, b->data_size);
+  slab_free(b->ident, b->ident_size);
+  b->data = b->obj = b->ident = b->hdr = b->gz = b->cache_url = b->variant = 0;
+  b->data_size = b->obj_size = b->ident_size = b->hdr_size = b->gz_size = b->raw_size = 0;
+  b->isEmpty = 1;
+}
+
+/*
+ * cache_find - url과 요청 헤더에 맞는 블럭을 찾는다. 락을 잡고 불러야 한다.
+ *   찾으면 인덱스, 못 찾으면 -1
+ */
+static int cache_find(cache_key *key, http_request *req) {
+  char variant[MAXLINE], built_for[CACHE_VARY_MAX];
+  unsigned int hash = 0;
+  int built = 0;
+  int i;
+  long long now = now_ms();
+
+  for (i=0; i<CACHE_OBJS_COUNT; i++) {
+    cache_block *b = &cache->cacheobjs[i];
+    if (cache_live(i, now) && key->hash == b->url_hash && (strcmp(key->str, CPTR(b->cache_url)) == 0)) {
+      // 같은 url의 variant들은 보통 같은 Vary를 가지므로 한 번 만든 키를 재사용
+      if (!built || strcmp(built_for, b->vary)) {
+        build_variant(b->vary, req, variant, MAXLINE);
+        hash = cache_hash(variant);
+        strcpy(built_for, b->vary);
+        built = 1;
+      }
+      if (hash == b->variant_hash && !strcmp(variant, CPTR(b->variant)))
+        return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * compose - hdr 뒤에 Content-Length(와 Content-Encoding)를 붙이고 빈 줄로 헤더를 끝낸다.
+ *   바디를 쓸 위치(헤더 길이)를 리턴. 안 들어가면 -1
+ */
+static int compose(char *out, int maxlen, cache_block *b, char *encoding, int body_size) {
+  int len = b->hdr_size, n;
+
+  if (len >= maxlen)
+    return -1;
+  memcpy(out, CPTR(b->hdr), len);
+  if (encoding != NULL) {
+    // 압축은 프록시가 한 것이므로 하위 캐시들이 인코딩별로 나눠 저장하도록 알려준다
+    n = snprintf(out + len, maxlen - len, "Content-Encoding: %s\r\n%s", encoding,
+                 strstr(b->vary, "accept-encoding") ? "" : "Vary: Accept-Encoding\r\n");
+    len += n;
+  }
+  if (len < maxlen)
+    len += snprintf(out + len, maxlen - len, "Content-Length: %d\r\n\r\n", body_size);
+  if (len + body_size > maxlen)
+    return -1;
+  return len;
+}
+
+static int chunk_class(shm_off off) {
+  return off ? cache->slabs[SLAB_OF(off)].cls : -1;
+}
+
+// 블럭 i의 chunk가 slab s에 있으면 1
+static int block_in_slab(int i, int s) {
+  cache_block *b = &cache->cacheobjs[i];
+  return i >= 0 && !b->isEmpty
+      && ((b->data && (int)SLAB_OF(b->data) == s) || (b->ident && (int)SLAB_OF(b->ident) == s));
+}
+
+// cls class에 chunk를 가진 블럭 중 LRU가 가장 작은 것. cls가 -1이면 전체에서. 없으면 -1
+static int lru_block(int cls, int keep) {
+  int i, victim = -1;
+  cache_block *b;
+
+  for (i=0; i<CACHE_OBJS_COUNT; i++) {
+    b = &cache->cacheobjs[i];
+    if (i == keep || b->isEmpty)
+      continue;
+    if (cls >= 0 && chunk_class(b->data) != cls && chunk_class(b->ident) != cls)
+      continue;
+    if (victim < 0 || b->LRU < cache->cacheobjs[victim].LRU)
+      victim = i;
+  }
+  return victim;
+}
+
+/*
+ * coldest_slab - cls가 아닌 class의 slab 중 가장 차가운 것 (slab에 든 블럭들 중 가장 최근에 쓰인
+ *   것의 LRU가 가장 작은 slab). keep의 chunk가 든 slab은 뺀다. *newest에 그 LRU. 없으면 -1
+ */
+static int coldest_slab(int cls, int keep, unsigned int *newest) {
+  int s, i, best = -1;
+  unsigned int hot, best_hot = 0;
+
+  for (s = 0; s < SLAB_COUNT; s++) {
+    if (cache->slabs[s].cls < 0 || cache->slabs[s].cls == cls || block_in_slab(keep, s))
+      continue;
+    hot = 0;
+    for (i=0; i<CACHE_OBJS_COUNT; i++)
+      if (block_in_slab(i, s) && cache->cacheobjs[i].LRU > hot)
+        hot = cache->cacheobjs[i].LRU;
+    if (best < 0 || hot < best_hot) {
+      best = s;
+      best_hot = hot;
+    }
+  }
+  *newest = best_hot;
+  return best;
+}
+
+// slab s에 chunk가 든 블럭을 모두 비운다. 마지막 chunk가 나가면 slab_free가 slab을 빈 slab으로 돌린다
+static void slab_evict(int s) {
+  int i;
+
+  for (i=0; i<CACHE_OBJS_COUNT; i++)
+    if (block_in_slab(i, s))
+      cache_free_block(i);
+}
+
+/*
+ * cache_alloc - 락을 잡은 상태에서 size 바이트 chunk를 할당한다. keep 블럭은 건드리지 않는다.
+ *   바이트 예산(MAX_CACHE_SIZE)을 넘으면 전체 LRU부터 쫓아낸다.
+ *   예산은 남는데 class에 자리가 없으면(빈 slab도 없으면) 그 class의 LRU 블럭과 다른 class의 가장 차가운
+ *   slab을 비교해서, slab 쪽이 더 차가우면 slab을 통째로 비워 이 class로 옮기고(rebalance)
+ *   아니면 class 안에서 LRU 블럭을 쫓아낸다. 자리를 못 만들면 0
+ */
+static shm_off cache_alloc(unsigned int size, int keep) {
+  int cls = slab_class_of(size), victim, s;
+  unsigned int newest;
+  shm_off off;
+
+  if (cls < 0)
+    return 0;
+  for (;;) {
+    if (cache->cache_bytes + (int)size > MAX_CACHE_SIZE) {
+      victim = lru_block(-1, keep);
+    } else {
+      if ((off = slab_alloc(cls, size)) != 0)
+        return off;
+      victim = lru_block(cls, keep);
+      s = coldest_slab(cls, keep, &newest);
+      if (s >= 0 && (victim < 0 || newest < cache->cacheobjs[victim].LRU)) {
+        slab_evict(s);
+        cache->reassigns++;
+        cache->classes[cls].slabs_in++;
+        continue;
+      }
+    }
+    if (victim < 0)
+      return 0;
+    cache->classes[cls].evictions++;
+    cache_free_block(victim);
+  }
+}
+
+// 캐시가 잡고 있는 메모리. 락을 잡고 부른다
+static long long cache_held(void) {
+  return cache->slab_base + (long long)(SLAB_COUNT - cache->free_slabs) * SLAB_SIZE;
+}
+
+/*
+ * cache_memory - 캐시가 실제로 잡고 있는 메모리: 인덱스와 class에 붙은 slab들.
+ *   빈 slab의 페이지는 slab_release가 돌려줬으므로 세지 않는다
+ */
+long long cache_memory(void) {
+  long long bytes;
+
+  cache_lock();
+  bytes = cache_held();
+  cache_unlock();
+  return bytes;
+}
+
+/*
+ * cache_shrink - 메모리가 모자랄 때 부른다. 가장 차가운 slab부터 통째로 비워서 캐시가 잡은 메모리를
+ *   target 바이트 이하로 줄인다. 비운 slab의 페이지는 OS로 돌아간다. 줄인 바이트를 돌려준다
+ */
+long long cache_shrink(long long target) {
+  long long before;
+  unsigned int newest;
+  int s, free_slabs;
+
+  cache_lock();
+  cache_begin();
+  before = cache_held();
+  while (cache_held() > target && (s = coldest_slab(-1, -1, &newest)) >= 0) {
+    free_slabs = cache->free_slabs;
+    slab_evict(s);
+    if (cache->free_slabs == free_slabs)
+      break;
+  }
+  before -= cache_held();
+  cache_end();
+  cache_unlock();
+  return before;
+}
+
+/*
+ * cache_attach_identity - 압축본만 있던 블럭에 방금 풀어서 만든 identity 응답을 붙인다.
+ *   락을 놓은 사이 블럭이 바뀌었으면(gen이 다르면) 그냥 버린다
+ */
+static void cache_attach_identity(int i, unsigned int gen, char *buf, int len) {
+  cache_block *b = &cache->cacheobjs[i];
+  shm_off off;
+
+  cache_lock();
+  cache_begin();
+  if (!b->isEmpty && b->gen == gen && b->ident == 0 && (off = cache_alloc(len, i)) != 0) {
+    memcpy(CPTR(off), buf, len);
+    b->ident = off;
+    b->ident_size = len;
+    cache->cache_bytes += len;
+  }
+  cache_end();
+  cache_unlock();
+}
+
+// compose가 hdr 뒤에 붙이는 헤더들(Content-Encoding, Vary, Content-Length, 빈 줄)이 들어갈 자리
+#define COMPOSE_EXTRA 128
+
+/*
+ * cache_read - 키와 요청 헤더에 맞는 응답을 a에서 딱 맞는 크기로 할당해서 복사하고 *outp로 돌려준다.
+ *   찾으면 응답 길이, 못 찾았거나 a에서 할당하지 못하면 -1.
+ *   gzip을 받는 클라이언트에는 압축본을 그대로, 아니면 identity 응답을 준다
+ */
+int cache_read(cache_key *key, http_request *req, arena *a, char **outp) {
+  int i, off, n, len = -1, maxlen, gz_size = 0, raw_size = 0;
+  int gzip_ok = accepts_gzip(req);
+  unsigned int gen = 0;
+  cache_block *b;
+  char *out, *gz = NULL;
+
+  cache_lock();
+  if ((i = cache_find(key, req)) >= 0) {
+    b = &cache->cacheobjs[i];
+    b->LRU = ++cache->lru_clock;
+    if (b->gz != 0 && gzip_ok) {
+      maxlen = b->hdr_size + COMPOSE_EXTRA + b->gz_size;
+      if ((out = arena_alloc(a, maxlen)) != NULL && (off = compose(out, maxlen, b, "gzip", b->gz_size)) >= 0) {
+        memcpy(out + off, CPTR(b->gz), b->gz_size);
+        len = off + b->gz_size;
+      }
+    } else if (b->obj != 0 || b->ident != 0) {
+      shm_off src = b->obj ? b->obj : b->ident;
+      int size = b->obj ? b->obj_size : b->ident_size;
+      if ((out = arena_alloc(a, size)) != NULL) {
+        memcpy(out, CPTR(src), size);
+        len = size;
+      }
+    } else {
+      // 압축본만 있다. 락 안에서는 헤드를 만들고 압축본을 복사만 해 두고, 푸는 건 락을 놓고 한다.
+      // 락은 모든 프록시 프로세스가 같이 쓰므로 MAX_OBJECT_SIZE를 푸는 동안 잡고 있으면 다들 기다린다
+      maxlen = b->hdr_size + COMPOSE_EXTRA + b->raw_size;
+      if ((out = arena_alloc(a, maxlen)) != NULL && (off = compose(out, maxlen, b, NULL, b->raw_size)) >= 0 &&
+          (gz = arena_alloc(a, b->gz_size)) != NULL) {
+        gz_size = b->gz_size;
+        raw_size = b->raw_size;
+        gen = b->gen;
+        memcpy(gz, CPTR(b->gz), gz_size);
+      }
+    }
+  }
+  cache_unlock();
+
+  if (gz != NULL) {
+    n = gzip_inflate(gz, gz_size, out + off, maxlen - off);
+    if (n != raw_size)
+      return -1;
+    len = off + n;
+    cache_attach_identity(i, gen, out, len);  // 다음 identity 요청은 풀지 않고 바로 준다
+  }
+  if (len >= 0)
+    *outp = out;
+  return len;
+}
+
+/*
+ * cache_victim - 새 variant를 넣을 블럭을 고른다. 락을 잡고 불러야 한다.
+ *   같은 variant가 이미 있으면 그 자리를 덮어쓰고,
+ *   같은 url의 variant가 CACHE_MAX_VARIANTS개 꽉 찼으면 그 중 LRU가 가장 작은 것을,
+ *   아니면 비었거나 만료된 블럭을, 그것도 없으면 전체에서 LRU가 가장 작은 블럭을 고른다.
+ */
+static int cache_victim(cache_key *key, char *variant, unsigned int hash) {
+  int i, same = 0, same_min = -1, free_index = -1, lru_min = 0;
+  long long now = now_ms();
+  cache_block *b;
+
+  for (i=0; i<CACHE_OBJS_COUNT; i++) {
+    b = &cache->cacheobjs[i];
+    if (!cache_live(i, now)) {
+      if (free_index < 0)
+        free_index = i;
+      continue;
+    }
+    if (key->hash == b->url_hash && !strcmp(key->str, CPTR(b->cache_url))) {
+      if (hash == b->variant_hash && !strcmp(variant, CPTR(b->variant)))
+        return i;
+      same++;
+      if (same_min < 0 || b->LRU < cache->cacheobjs[same_min].LRU)
+        same_min = i;
+    }
+    if (b->LRU < cache->cacheobjs[lru_min].LRU)
+      lru_min = i;
+  }
+  if (same >= CACHE_MAX_VARIANTS)
+    return same_min;
+  if (free_index >= 0)
+    return free_index;
+  return lru_min;
+}
+
+// origin이 Vary를 바꿨다면 예전 Vary로 저장된 variant들은 더 이상 고를 수 없으므로 비운다
+static void cache_drop_stale_variants(cache_key *key, char *vary, int keep) {
+  int i;
+  for (i=0; i<CACHE_OBJS_COUNT; i++) {
+    cache_block *b = &cache->cacheobjs[i];
+    if (i == keep)
+      continue;
+    if (b->isEmpty == 0 && key->hash == b->url_hash
+        && !strcmp(key->str, CPTR(b->cache_url)) && strcmp(vary, b->vary))
+      cache_free_block(i);
+  }
+}
+
+/*
+ * cache_compressible - 압축해서 저장할 만한 응답인지: 200, 아직 인코딩 안 됨, 텍스트 계열.
+ *   본문을 읽으면 resp가 가리키는 버퍼가 바뀌므로 doit이 그 전에 부른다. 크기는 cache_uri가 본다
+ */
+int cache_compressible(http_response *resp) {
+  char type[MAXLINE];
+  http_hdr *h;
+
+  if (!conf.cache_compress || resp->status != 200)
+    return 0;
+  for (h = http_resp_find(resp, HDR_CONTENT_ENCODING); h != NULL; h = h->next < 0 ? NULL : &resp->hdrs[h->next])
+    if (!http_slice_eq(h->value, "identity"))
+      return 0;
+  // chunked는 풀어서 받으니 괜찮지만, 다른 transfer coding이 걸려 있으면 본문이 원래 내용이 아니다
+  for (h = http_resp_find(resp, HDR_TRANSFER_ENCODING); h != NULL; h = h->next < 0 ? NULL : &resp->hdrs[h->next])
+    if (!http_slice_eq(h->value, "chunked"))
+      return 0;
+  if ((h = http_resp_find(resp, HDR_CONTENT_TYPE)) == NULL)
+    return 0;
+  http_slice_cpy(type, sizeof(type), h->value);
+  return !strncasecmp(type, "text/", 5)
+      || !strncasecmp(type, "application/javascript", 22)
+      || !strncasecmp(type, "application/json", 16)
+      || !strncasecmp(type, "application/xml", 15)
+      || strstr(type, "+xml") || strstr(type, "+json");
+}
+
+// cache the uri and content in cache
+//   vary: vary_normalize로 정규화된 응답의 Vary, req: 이 응답을 받아온 요청
+//   buf: origin 응답 전체, hdr_size: 그 중 헤더(빈 줄 포함) 길이
+//   gz_hdr: 압축해서 저장할 때 쓸 헤드 (doit의 build_gzip_header). NULL이면 압축하지 않는다
+//   ttl_ms: 0이면 만료 없음, 아니면 그 시간 뒤에 miss로 취급 (negative caching)
+void cache_uri(cache_key *key, char *vary, http_request *req, char *buf, int size, int hdr_size,
+               char *gz_hdr, int gz_hdr_size, int ttl_ms) {
+  char variant[MAXLINE];
+  char *gz = NULL;
+  unsigned int hash;
+  int i, need, url_len, variant_len, gz_size = 0, body_size = size - hdr_size;
+  shm_off data;
+  cache_block *b;
+
+  if (size > MAX_OBJECT_SIZE || hdr_size <= 0 || hdr_size > size)
+    return;
+  build_variant(vary, req, variant, MAXLINE);
+  hash = cache_hash(variant);
+
+  // 압축은 CPU를 쓰므로 락 밖에서 미리 해 둔다
+  // 버퍼를 못 얻으면(메모리가 바닥났으면) 압축하지 않고 그대로 넣는다
+  if (gz_hdr != NULL && body_size >= conf.compress_min_size && (gz = malloc(body_size)) != NULL) {
+    gz_size = gzip_deflate(buf + hdr_size, body_size, gz, body_size);
+    if (gz_size <= 0 || gz_size >= body_size - body_size / 10) {  // 10% 이상 줄어들 때만
+      free(gz);
+      gz = NULL;
+    }
+  }
+  url_len = strlen(key->str) + 1;
+  variant_len = strlen(variant) + 1;
+  need = url_len + variant_len + (gz ? gz_hdr_size + gz_size : size);
+
+  cache_lock();
+  cache_begin();
+
+  i = cache_victim(key, variant, hash);
+  cache_free_block(i);
+  if ((data = cache_alloc(need, i)) == 0) {
+    cache_end();
+    cache_unlock();
+    free(gz);
+    return;
+  }
+
+  b = &cache->cacheobjs[i];
+  b->data = data;
+  b->data_size = need;
+  b->cache_url = data;
+  memcpy(CPTR(b->cache_url), key->str, url_len);
+  b->variant = data + url_len;
+  memcpy(CPTR(b->variant), variant, variant_len);
+  if (gz != NULL) {
+    b->hdr = b->variant + variant_len;
+    b->hdr_size = gz_hdr_size;
+    memcpy(CPTR(b->hdr), gz_hdr, gz_hdr_size);
+    b->gz = b->hdr + gz_hdr_size;
+    b->gz_size = gz_size;
+    memcpy(CPTR(b->gz), gz, gz_size);
+  } else {
+    b->obj = b->variant + variant_len;
+    b->obj_size = size;
+    memcpy(CPTR(b->obj), buf, size);
+  }
+  b->raw_size = body_size;
+  b->url_hash = key->hash;
+  strcpy(b->vary, vary);
+  b->variant_hash = hash;
+  b->expires = ttl_ms > 0 ? now_ms() + ttl_ms : 0;
+  b->LRU = ++cache->lru_clock;
+  b->gen++;
+  b->isEmpty = 0;
+  cache->cache_num++;
+  cache->cache_bytes += need;
+
+  cache_drop_stale_variants(key, vary, i);
+
+  cache_end();
+  cache_unlock();
+  free(gz);
+}
+
+/*
+ * neg_host_check - hostname:port가 최근에 연결 실패한 origin이면 1
+ */
+int neg_host_check(char *hostname, int port) {
+  int i, found = 0;
+  long long now = now_ms();
+
+  P(&neg_mutex);
+  for (i = 0; i < NEG_HOSTS_COUNT; i++) {
+    if (neg_hosts[i].expires > now && neg_hosts[i].port == port
+        && !strcasecmp(neg_hosts[i].host, hostname)) {
+      found = 1;
+      break;
+    }
+  }
+  V(&neg_mutex);
+  return found;
+}
+
+/*
+ * neg_host_add - 연결에 실패한 origin을 ttl_ms 동안 기억한다.
+ *   같은 origin이나 만료된 자리를 쓰고, 없으면 가장 먼저 만료될 자리를 덮어쓴다
+ */
+void neg_host_add(char *hostname, int port, int ttl_ms) {
+  int i, victim = 0;
+  long long now = now_ms();
+
+  if (ttl_ms <= 0 || strlen(hostname) >= MAXLINE)
+    return;
+  P(&neg_mutex);
+  for (i = 0; i < NEG_HOSTS_COUNT; i++) {
+    if (neg_hosts[i].port == port && !strcasecmp(neg_hosts[i].host, hostname)) {
+      victim = i;
+      break;
+    }
+    if (neg_hosts[i].expires < neg_hosts[victim].expires)
+      victim = i;
+  }
+  strcpy(neg_hosts[victim].host, hostname);
+  neg_hosts[victim].port = port;
+  neg_hosts[victim].expires = now + ttl_ms;
+  V(&neg_mutex);
+}
+
+static int token_cmp(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+/*
+ * normalize_list - ','로 구분된 목록을 소문자로 바꾸고, 공백을 없애고, 정렬해서 ','로 다시 잇는다.
+ *   "gzip, deflate" 와 "deflate,gzip" 이 같은 variant로 잡히게 하기 위함
+ */
+static void normalize_list(char *in, char *out, int maxlen) {
+  char tmp[MAXLINE], *tokens[64], *p, *save;
+  int ntok = 0, i, len = 0, n = 0;
+
+  for (p = in; *p && n + 1 < (int)sizeof(tmp); p++) {
+    if (!isspace((unsigned char)*p))
+      tmp[n++] = tolower((unsigned char)*p);
+  }
+  tmp[n] = '\0';
+
+  for (p = strtok_r(tmp, ",", &save); p != NULL && ntok < 64; p = strtok_r(NULL, ",", &save)) {
+    if (*p)
+      tokens[ntok++] = p;
+  }
+  qsort(tokens, ntok, sizeof(char *), token_cmp);
+
+  out[0] = '\0';
+  for (i = 0; i < ntok; i++) {
+    int tlen = strlen(tokens[i]);
+    if (len + tlen + 2 > maxlen)
+      break;
+    if (i > 0)
+      out[len++] = ',';
+    strcpy(out + len, tokens[i]);
+    len += tlen;
+  }
+}
+
+/*
+ * vary_normalize - 응답의 Vary 값을 정규화한다.
+ *   "Vary: *" 이면 어떤 요청과도 같다고 볼 수 없으므로 -1 (캐시하지 않음)
+ */
+int vary_normalize(char *field, char *vary, int maxlen) {
+  normalize_list(field, vary, maxlen);
+  if (!strcmp(vary, "*") || strstr(vary, ",*") || !strncmp(vary, "*,", 2))
+    return -1;
+  return 0;
+}
+
+/*
+ * accepts_gzip - 요청의 Accept-Encoding이 gzip을 받으면 1.
+ *   "gzip;q=0" 처럼 q가 0이면 받지 않는 것으로 본다. "*"도 gzip을 포함한다
+ */
+int accepts_gzip(http_request *req) {
+  char value[MAXLINE], *tok, *save, *semi, *q;
+  int star = 0;
+
+  if (!http_header_value(req, "Accept-Encoding", value, MAXLINE))
+    return 0;
+  for (tok = strtok_r(value, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    double qval = 1.0;
+    while (isspace((unsigned char)*tok))
+      tok++;
+    if ((semi = strchr(tok, ';')) != NULL) {
+      *semi = '\0';
+      if ((q = strstr(semi + 1, "q=")) != NULL)
+        qval = atof(q + 2);
+    }
+    tok[strcspn(tok, " \t")] = '\0';
+    if (!strcasecmp(tok, "gzip") || !strcasecmp(tok, "x-gzip"))
+      return qval > 0;
+    if (!strcmp(tok, "*"))
+      star = qval > 0;
+  }
+  return star;
+}
+
+// vary에 나열된 각 헤더에 대해 "name=정규화된값\n"을 이어붙인 variant 키를 만든다
+static void build_variant(char *vary, http_request *req, char *variant, int maxlen) {
+  char names[CACHE_VARY_MAX], value[MAXLINE], norm[MAXLINE], *name, *save;
+  int len = 0;
+
+  variant[0] = '\0';
+  if (vary[0] == '\0')
+    return;
+
+  strcpy(names, vary);
+  for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+    http_header_value(req, name, value, MAXLINE);
+    normalize_list(value, norm, MAXLINE);
+    len += snprintf(variant + len, maxlen - len, "%s=%s\n", name, norm);
+    if (len >= maxlen) {
+      variant[maxlen - 1] = '\0';
+      return;
+    }
+  }
+}
+
+static int is_unreserved(int c) {
+  return isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static int hexval(int c) {
+  return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
+
+/*
+ * append_pct - [s, end)를 out에 붙이면서 퍼센트 인코딩을 정규화한다.
+ *   %7E 처럼 unreserved 문자를 가리키면 디코딩하고, 나머지는 16진수를 대문자로 통일한다
+ */
+static int append_pct(char *out, int len, int maxlen, char *s, char *end) {
+  while (s < end && len + 4 < maxlen) {
+    if (*s == '%' && end - s >= 3 && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+      int c = hexval((unsigned char)s[1]) * 16 + hexval((unsigned char)s[2]);
+      if (is_unreserved(c)) {
+        out[len++] = c;
+      } else {
+        out[len++] = '%';
+        out[len++] = toupper((unsigned char)s[1]);
+        out[len++] = toupper((unsigned char)s[2]);
+      }
+      s += 3;
+    } else {
+      out[len++] = *s++;
+    }
+  }
+  out[len] = '\0';
+  return len;
+}
+
+// 파라미터 이름이 key_drop_params에 있으면 1. "utm_*"처럼 끝의 *는 접두사 매칭
+static int drop_param(char *param) {
+  char rules[MAXLINE], *rule, *save;
+  int namelen = strcspn(param, "=");
+
+  if (conf.key_drop_params[0] == '\0')
+    return 0;
+  strcpy(rules, conf.key_drop_params);
+  for (rule = strtok_r(rules, ",", &save); rule != NULL; rule = strtok_r(NULL, ",", &save)) {
+    int rlen = strlen(rule);
+    if (rlen > 0 && rule[rlen-1] == '*') {
+      if (namelen >= rlen - 1 && !strncmp(param, rule, rlen - 1))
+        return 1;
+    } else if (rlen == namelen && !strncmp(param, rule, namelen)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#define KEY_MAX_PARAMS 128
+
+// 쿼리를 '&'로 나눠서 정규화하고, 설정에 따라 빼거나 정렬한 뒤 다시 붙인다
+static int append_query(char *out, int len, int maxlen, char *q, char *end) {
+  char pbuf[MAXLINE], *params[KEY_MAX_PARAMS], *s, *amp;
+  int nparams = 0, plen = 0, i, start = len;
+
+  for (s = q; s < end; s = amp + 1) {
+    amp = memchr(s, '&', end - s);
+    if (amp == NULL)
+      amp = end;
+    if (amp > s) {
+      if (nparams == KEY_MAX_PARAMS || plen + (amp - s) + 5 > (int)sizeof(pbuf)) {
+        // 너무 많거나 길면 정렬/제거 없이 정규화만 한다
+        out[len++] = '?';
+        return append_pct(out, len, maxlen, q, end);
+      }
+      params[nparams] = pbuf + plen;
+      plen = append_pct(pbuf, plen, sizeof(pbuf), s, amp) + 1;
+      if (!drop_param(params[nparams]))
+        nparams++;
+      else
+        plen = params[nparams] - pbuf;
+    }
+    if (amp == end)
+      break;
+  }
+  if (conf.key_sort_query)
+    qsort(params, nparams, sizeof(char *), token_cmp);
+
+  for (i = 0; i < nparams; i++) {
+    int n = strlen(params[i]);
+    if (len + n + 2 >= maxlen)
+      break;
+    char sep = (len == start) ? '?' : '&';
+    out[len++] = sep;
+    memcpy(out + len, params[i], n);
+    len += n;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+/*
+ * cache_key_build - uri_parse로 파싱한 요청 uri로 정규화된 캐시 키와 해시를 만든다
+ *   http://Host:80/a, http://host/a 는 같은 키 "http://host/a" 가 된다. fragment는 버린다.
+ */
+void cache_key_build(uri_parts *u, cache_key *key) {
+  char *out = key->str, *s, *end;
+  int len = 0, maxlen = MAXLINE;
+
+  // scheme
+  for (s = u->scheme.p, end = s + u->scheme.len; s < end && len + 1 < maxlen; s++)
+    out[len++] = tolower((unsigned char)*s);
+  if (u->scheme.len > 0)
+    out[len++] = ':';
+
+  if (u->has_authority && len + 2 < maxlen) {
+    memcpy(out + len, "//", 2);
+    len += 2;
+
+    // userinfo는 그대로
+    if (u->userinfo.len > 0 && len + u->userinfo.len + 2 < maxlen) {
+      memcpy(out + len, u->userinfo.p, u->userinfo.len);
+      len += u->userinfo.len;
+      out[len++] = '@';
+    }
+    if (u->ipv6 && len + 1 < maxlen)
+      out[len++] = '[';
+    for (s = u->host.p, end = s + u->host.len; s < end && len + 1 < maxlen; s++)
+      out[len++] = tolower((unsigned char)*s);
+    if (u->ipv6 && len + 1 < maxlen)
+      out[len++] = ']';
+
+    // 기본 포트는 지운다
+    if (u->port.len > 0 && u->port_num != uri_default_port(u->scheme))
+      len += snprintf(out + len, maxlen - len, ":%d", u->port_num);
+    if (u->path.len == 0 && len + 1 < maxlen)  // 빈 path는 "/"
+      out[len++] = '/';
+  }
+
+  len = append_pct(out, len, maxlen, u->path.p, u->path.p + u->path.len);
+  if (u->query.p != NULL)
+    len = append_query(out, len, maxlen, u->query.p, u->query.p + u->query.len);
+  out[len] = '\0';
+  key->hash = cache_hash(out);
+}
@@ -0,0 +1,138 @@
+/*
+ * cache.h - web object cache shared by the proxy threads
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "csapp.h"
+#include "http.h"
+#include "uri.h"
+#include "arena.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+// Least Recently Used
+// LRU: 가장 오랫동안 참조되지 않은 페이지를 교체하는 기법
+
+#define CACHE_OBJS_COUNT 64   // 블럭(메타데이터) 수. 실제 용량은 MAX_CACHE_SIZE 바이트로 제한한다
+#define CACHE_MAX_VARIANTS 4  // 같은 url에 대해 Vary로 나뉘어 저장할 수 있는 최대 변형(variant) 수
+#define CACHE_VARY_MAX 256    // 정규화된 Vary 필드 이름 목록의 최대 길이
+
+/*
+ * 객체 저장용 slab allocator (memcached 방식).
+ * 영역 뒤쪽을 SLAB_SIZE짜리 slab들로 나누고, slab 하나는 한 size class에 속해서 같은 크기의
+ * chunk들로 쪼개진다. class는 SLAB_MIN_CHUNK부터 SLAB_GROWTH배씩 커지고 마지막 class는 slab 하나 크기다.
+ * 객체 크기 분포가 바뀌면 다른 class의 차가운 slab을 통째로 비워서 필요한 class로 옮긴다.
+ */
+#define SLAB_SIZE (128 * 1024)    // MAX_OBJECT_SIZE + 키 + variant가 들어가야 한다
+#define SLAB_COUNT ((MAX_CACHE_SIZE + SLAB_SIZE - 1) / SLAB_SIZE)
+#define SLAB_MIN_CHUNK 64
+#define SLAB_GROWTH 1.25
+#define SLAB_MAX_CLASSES 48
+
+typedef struct {
+  unsigned int chunk_size;
+  unsigned int per_slab;      // slab 하나에 든 chunk 수
+  unsigned int free_list;     // free chunk들 (shm_off, chunk 앞 4바이트로 연결)
+  unsigned int nslabs;        // 이 class에 속한 slab 수
+  unsigned int used_chunks;
+  unsigned int free_chunks;
+  unsigned long long requested;   // 쓰고 있는 chunk들에 실제로 요청된 바이트 (내부 단편화 계산용)
+  unsigned int evictions;     // 이 class에 자리를 만들려고 쫓아낸 블럭 수
+  unsigned int slabs_in;      // 다른 class에서 옮겨 받은 slab 수
+} slab_class;
+
+typedef struct {
+  int cls;                    // 속한 class. -1이면 아무 class에도 안 속한 빈 slab
+  unsigned int used;          // 쓰고 있는 chunk 수
+} slab_info;
+
+/*
+ * 캐시는 통째로 하나의 메모리 영역(region)에 들어있다. cache_shm을 지정하면 이름 있는
+ * 공유 메모리라서 여러 프록시 프로세스가 같은 캐시를 쓴다. 프로세스마다 매핑 주소가 다르므로
+ * 영역 안에서는 포인터 대신 영역 시작부터의 오프셋(shm_off)을 쓴다. 0은 NULL.
+ */
+typedef unsigned int shm_off;
+
+typedef struct
+{
+  shm_off data;     // 한 번에 할당한 영역: [키][variant][응답 또는 압축 헤더 + gzip 바디]
+  int data_size;
+  shm_off obj;      // 그대로 보낼 수 있는 응답 전체 (헤더 + 바디). 압축 저장이면 0
+  int obj_size;
+  shm_off ident;    // 압축 저장일 때 identity 응답이 필요해서 따로 만들어 붙인 것
+  int ident_size;
+  shm_off hdr;      // 압축 저장일 때: Content-Length/Content-Encoding을 뺀 응답 헤더 (끝의 빈 줄 제외)
+  int hdr_size;
+  shm_off gz;       // 압축 저장일 때: gzip으로 압축한 바디
+  int gz_size;
+  int raw_size;     // 압축 전 바디 크기
+  shm_off cache_url;  // 정규화된 캐시 키 (cache_key_build 참고)
+  unsigned int url_hash;      // cache_url의 해시
+  char vary[CACHE_VARY_MAX];  // origin 응답의 Vary 필드 이름들 (소문자, 정렬, ','로 연결). 없으면 ""
+  shm_off variant;            // vary에 나열된 요청 헤더 값들을 정규화해서 이어붙인 키
+  unsigned int variant_hash;  // variant의 해시. 문자열 비교 전에 먼저 비교한다
+  long long expires;  // 만료 시각(ms, CLOCK_MONOTONIC이라 프로세스 간에도 같다). 0이면 만료 없음
+  unsigned int LRU;   // 마지막으로 쓰인 시점의 lru_clock. 작을수록 먼저 쫓겨난다
+  unsigned int gen;   // 블럭을 새로 채울 때마다 증가. 락을 놓았다 다시 잡을 때 같은 객체인지 확인용
+  int isEmpty; // 이 블럭에 캐시 정보가 들었는지 empty인지 아닌지 체크
+}cache_block; // 캐쉬블럭 구조체로 선언
+
+typedef struct
+{
+  unsigned int magic;     // 다른 프로세스가 만든 영역이 같은 레이아웃인지 확인용
+  unsigned int region_size;
+  volatile int ready;     // 만든 프로세스가 초기화를 끝내면 1
+
+  pthread_mutex_t lock;   // process-shared, robust. 잡은 프로세스가 죽으면 다음에 잡는 쪽이 EOWNERDEAD를 받는다
+  int dirty;              // 수정 중이면 1. 수정 도중에 죽었으면 내용을 믿을 수 없으므로 캐시를 비운다
+
+  cache_block cacheobjs[CACHE_OBJS_COUNT];
+  int cache_num;      // 채워진 블럭 수
+  int cache_bytes;    // 블럭들이 차지한 바이트 (압축본, identity본, 키 모두 포함)
+  unsigned int lru_clock;
+  unsigned int recoveries;  // 죽은 프로세스 때문에 캐시를 비운 횟수
+
+  shm_off slab_base;  // 첫 slab의 오프셋 (페이지 정렬)
+  slab_class classes[SLAB_MAX_CLASSES];
+  int nclasses;
+  slab_info slabs[SLAB_COUNT];
+  int free_slabs;     // 아무 class에도 안 속한 slab 수
+  unsigned int reassigns;   // class 사이에서 옮긴 slab 수
+}Cache;
+
+/*
+ * 정규화된 캐시 키. 요청마다 doit에서 한 번 만들고 모든 캐시 연산에 그대로 넘긴다.
+ *   scheme/host 소문자, 기본 포트 제거, unreserved 문자의 퍼센트 인코딩 디코딩,
+ *   설정에 따라 쿼리 파라미터 정렬/제거
+ */
+typedef struct {
+  char str[MAXLINE];
+  unsigned int hash;
+} cache_key;
+
+void cache_init(int handoff_fd);
+int cache_region_fd(void);
+long long cache_memory(void);
+long long cache_shrink(long long target);
+void cache_stats(FILE *fp);
+void cache_key_build(uri_parts *u, cache_key *key);
+int cache_read(cache_key *key, http_request *req, arena *a, char **outp);
+int cache_compressible(http_response *resp);
+void cache_uri(cache_key *key, char *vary, http_request *req, char *buf, int size, int hdr_size,
+               char *gz_hdr, int gz_hdr_size, int ttl_ms);
+
+/* Negative cache of unreachable origins (connect_endServer 실패) */
+#define NEG_HOSTS_COUNT 64
+int neg_host_check(char *hostname, int port);
+void neg_host_add(char *hostname, int port, int ttl_ms);
+
+long long now_ms(void);
+long long now_us(void);
+
+/* Header helpers used to build variant keys */
+int vary_normalize(char *field, char *vary, int maxlen);
+int accepts_gzip(http_request *req);
+
+#endif /* __CACHE_H__ */
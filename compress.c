@@ -0,0 +1,50 @@
+/*
+ * compress.c - gzip helpers for compressed cache storage
+ *
+ * 둘 다 한 번에 끝까지 처리하고, 결과가 maxlen에 들어가지 않으면 -1을 리턴한다.
+ * windowBits에 16을 더하면 zlib이 gzip 헤더/트레일러를 붙이고 읽는다.
+ */
+#include <zlib.h>
+#include "compress.h"
+
+/* gzip_deflate - in을 gzip으로 압축해서 out에 쓴다. 압축된 크기 리턴 */
+int gzip_deflate(char *in, int len, char *out, int maxlen) {
+  z_stream zs;
+  int rc;
+
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  zs.next_in = (Bytef *)in;
+  zs.avail_in = len;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = maxlen;
+  rc = deflate(&zs, Z_FINISH);
+  deflateEnd(&zs);
+  if (rc != Z_STREAM_END)
+    return -1;
+  return maxlen - zs.avail_out;
+}
+
+/* gzip_inflate - gzip으로 압축된 in을 풀어서 out에 쓴다. 풀린 크기 리턴 */
+int gzip_inflate(char *in, int len, char *out, int maxlen) {
+  z_stream zs;
+  int rc;
+
+  zs.zalloc = Z_NULL;
+  zs.zfree = Z_NULL;
+  zs.opaque = Z_NULL;
+  zs.next_in = (Bytef *)in;
+  zs.avail_in = len;
+  if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    return -1;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = maxlen;
+  rc = inflate(&zs, Z_FINISH);
+  inflateEnd(&zs);
+  if (rc != Z_STREAM_END)
+    return -1;
+  return maxlen - zs.avail_out;
+}
@@ -0,0 +1,10 @@
+/*
+ * compress.h - gzip helpers for compressed cache storage (zlib)
+ */
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+int gzip_deflate(char *in, int len, char *out, int maxlen);
+int gzip_inflate(char *in, int len, char *out, int maxlen);
+
+#endif /* __COMPRESS_H__ */
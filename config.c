@@ -0,0 +1,139 @@
+/*
+ * config.c - proxy runtime options
+ *
+ * 옵션은 이름, 타입, conf 안의 위치로 된 표 하나로 관리한다.
+ * 새 옵션을 추가할 때는 proxy_config에 필드를 넣고 options[]에 한 줄 추가하면 된다.
+ */
+#include "config.h"
+
+proxy_config conf;
+
+typedef enum { OPT_INT, OPT_STR } opt_type;
+
+typedef struct {
+  char *name;
+  opt_type type;
+  void *ptr;
+  size_t size;    // OPT_STR 버퍼 크기
+  char *help;
+} option;
+
+#define INT_OPT(field, help) { #field, OPT_INT, &conf.field, sizeof(int), help }
+#define STR_OPT(field, help) { #field, OPT_STR, conf.field, sizeof(conf.field), help }
+
+static option options[] = {
+  INT_OPT(key_sort_query, "sort query parameters in cache keys (0/1)"),
+  STR_OPT(key_drop_params, "query parameters dropped from cache keys, e.g. utm_*,fbclid"),
+  INT_OPT(neg_error_ttl_ms, "ms to cache 404/5xx responses (0 = never)"),
+  INT_OPT(neg_connect_ttl_ms, "ms to fail fast for origins that refused to connect (0 = never)"),
+  INT_OPT(cache_compress, "store text responses gzip-compressed in the cache (0/1)"),
+  INT_OPT(compress_min_size, "smallest body in bytes worth compressing"),
+  STR_OPT(cache_shm, "POSIX shm name shared by proxy processes, e.g. /proxy_cache"),
+  INT_OPT(thread_stack_kb, "stack size of connection threads in KB"),
+  INT_OPT(upstream_keepalive, "idle keep-alive connections kept per origin (0 = close after each response)"),
+  INT_OPT(upstream_idle_ms, "ms an idle origin connection may be reused"),
+  INT_OPT(upstream_connect_ms, "ms to wait for one origin address to accept a connection (0 = no limit)"),
+  INT_OPT(upstream_connect_total_ms, "ms to wait for any origin address before answering 504 (0 = no limit)"),
+  STR_OPT(uds_map, "origins reached over Unix domain sockets, e.g. localhost:8000=/run/tiny.sock"),
+  INT_OPT(origin_limit_init, "initial per-origin concurrency limit (adapted from latency)"),
+  INT_OPT(origin_limit_max, "largest per-origin concurrency limit (0 = no limit)"),
+  INT_OPT(origin_queue_ms, "ms a request may wait for a busy origin before answering 503"),
+  INT_OPT(breaker_failures, "consecutive origin failures that open its circuit breaker (0 = ignore)"),
+  INT_OPT(breaker_error_pct, "origin error rate in percent that opens its circuit breaker (0 = ignore)"),
+  INT_OPT(breaker_window_ms, "ms over which breaker_error_pct is measured"),
+  INT_OPT(breaker_cooldown_ms, "ms an open breaker answers 503 before letting a probe request through"),
+  INT_OPT(client_header_ms, "ms a client may take to send its request head (0 = no limit)"),
+  INT_OPT(upstream_first_byte_ms, "ms to wait for the origin's response head before answering 504 (0 = no limit)"),
+  INT_OPT(relay_idle_ms, "ms a connection may sit with no data moving before it is cut (0 = no limit)"),
+  INT_OPT(max_inflight, "connections handled at once; more get an immediate 503 (0 = no limit)"),
+  INT_OPT(shed_queue_ms, "answer 503 when a connection waited longer than this for its thread (0 = never)"),
+  INT_OPT(shed_allow_hits, "still serve cache hits while shedding load (0/1)"),
+  INT_OPT(shed_retry_after, "Retry-After seconds sent with 503 when shedding load"),
+  INT_OPT(client_rps, "requests per second per client IP; more get 429 (0 = no limit)"),
+  INT_OPT(client_rps_burst, "requests a client IP may send at once (0 = client_rps)"),
+  INT_OPT(client_bps, "response bytes per second per client IP; more get 429 (0 = no limit)"),
+  INT_OPT(client_bps_burst, "response bytes a client IP may take at once (0 = client_bps)"),
+  INT_OPT(fair_workers, "cache misses handled at once; the rest wait their client's turn (0 = no limit)"),
+  INT_OPT(fair_queue_ms, "ms a request may wait for its turn before answering 503"),
+  STR_OPT(fair_tenant_header, "request header naming the tenant for fair queuing (\"\" = client IP)"),
+  STR_OPT(fair_weights, "fair queuing weights per client IP or tenant, e.g. 10.0.0.5=4,tenant-a=2"),
+  INT_OPT(restart_drain_ms, "ms an old process waits for its connections after a SIGUSR2 handoff"),
+  INT_OPT(mem_limit_mb, "memory limit in MB (0 = the cgroup memory limit, if any)"),
+  INT_OPT(mem_soft_pct, "percent of the memory limit at which the cache shrinks and admission tightens"),
+  INT_OPT(mem_hard_pct, "percent of the memory limit at which new connections get 503"),
+  INT_OPT(mem_check_ms, "ms between memory usage samples"),
+};
+
+#define NOPTIONS (sizeof(options) / sizeof(options[0]))
+
+void config_init(void) {
+  memset(&conf, 0, sizeof(conf));
+  conf.key_sort_query = 0;
+  conf.key_drop_params[0] = '\0';
+  conf.neg_error_ttl_ms = 5000;
+  conf.neg_connect_ttl_ms = 3000;
+  conf.cache_compress = 1;
+  conf.compress_min_size = 256;
+  conf.thread_stack_kb = 128;
+  conf.upstream_keepalive = 8;
+  conf.upstream_idle_ms = 30000;
+  conf.upstream_connect_ms = 3000;
+  conf.upstream_connect_total_ms = 10000;
+  conf.origin_limit_init = 20;
+  conf.origin_limit_max = 200;
+  conf.origin_queue_ms = 50;
+  conf.breaker_failures = 5;
+  conf.breaker_error_pct = 50;
+  conf.breaker_window_ms = 10000;
+  conf.breaker_cooldown_ms = 5000;
+  conf.client_header_ms = 10000;
+  conf.upstream_first_byte_ms = 30000;
+  conf.relay_idle_ms = 60000;
+  conf.max_inflight = 256;
+  conf.shed_queue_ms = 100;
+  conf.shed_allow_hits = 1;
+  conf.shed_retry_after = 1;
+  conf.fair_workers = 128;
+  conf.fair_queue_ms = 1000;
+  conf.restart_drain_ms = 30000;
+  conf.mem_limit_mb = 0;
+  conf.mem_soft_pct = 80;
+  conf.mem_hard_pct = 95;
+  conf.mem_check_ms = 100;
+}
+
+/*
+ * config_set - "name=value" 하나를 적용한다. 성공하면 0, 모르는 옵션이거나 값이 잘못되면 -1
+ */
+int config_set(char *opt) {
+  char *eq = strchr(opt, '=');
+  size_t i, namelen;
+
+  if (eq == NULL)
+    return -1;
+  namelen = eq - opt;
+  for (i = 0; i < NOPTIONS; i++) {
+    if (strlen(options[i].name) != namelen || strncmp(options[i].name, opt, namelen))
+      continue;
+    if (options[i].type == OPT_INT) {
+      char *end;
+      long v = strtol(eq + 1, &end, 10);
+      if (end == eq + 1 || *end != '\0')
+        return -1;
+      *(int *)options[i].ptr = (int)v;
+    } else {
+      if (strlen(eq + 1) >= options[i].size)
+        return -1;
+      strcpy((char *)options[i].ptr, eq + 1);
+    }
+    return 0;
+  }
+  return -1;
+}
+
+void config_usage(FILE *fp) {
+  size_t i;
+  fprintf(fp, "options (-o name=value):\n");
+  for (i = 0; i < NOPTIONS; i++)
+    fprintf(fp, "  %-24s %s\n", options[i].name, options[i].help);
+}
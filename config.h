@@ -0,0 +1,81 @@
+/*
+ * config.h - proxy runtime options, set with "-o name=value" on the command line
+ */
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include "csapp.h"
+
+typedef struct {
+  /* cache key normalization */
+  int key_sort_query;             // 1이면 쿼리 파라미터를 정렬해서 키를 만든다
+  char key_drop_params[MAXLINE];  // 키에서 뺄 쿼리 파라미터 이름들. ','로 구분, "utm_*"처럼 끝에 *를 붙이면 접두사
+
+  /* negative caching */
+  int neg_error_ttl_ms;           // 404/5xx 응답을 캐시해 두는 시간. 0이면 캐시하지 않음
+  int neg_connect_ttl_ms;         // 연결에 실패한 origin에 바로 502를 돌려주는 시간. 0이면 끔
+
+  /* compressed cache storage */
+  int cache_compress;             // 1이면 텍스트 응답을 gzip으로 압축해서 저장
+  int compress_min_size;          // 이보다 작은 바디는 압축하지 않는다
+
+  /* shared-memory cache */
+  char cache_shm[256];            // 공유 메모리 이름 (예: /proxy_cache). 같은 이름을 쓰는 프로세스끼리 캐시를 공유. ""이면 프로세스 전용
+
+  /* threads */
+  int thread_stack_kb;            // 연결 스레드의 스택 크기(KB). 큰 버퍼는 arena에 있어서 작아도 된다
+
+  /* upstream connections */
+  int upstream_keepalive;         // origin마다 다시 쓰려고 열어 두는 연결 수. 0이면 응답마다 닫는다
+  int upstream_idle_ms;           // 이 시간보다 오래 쉰 연결은 다시 쓰지 않고 닫는다
+  int upstream_connect_ms;        // origin 주소 하나에 연결을 기다리는 시간. 0이면 제한 없음
+  int upstream_connect_total_ms;  // 모든 주소를 합쳐 연결을 기다리는 시간. 넘기면 504. 0이면 제한 없음
+  char uds_map[MAXLINE];          // 같은 호스트의 origin을 Unix domain socket으로: "host:port=/path,..."
+  int origin_limit_init;          // origin마다 동시에 보내는 요청 수의 처음 한도. latency를 보고 조정한다
+  int origin_limit_max;           // 한도의 상한. 0이면 한도 없이 보낸다
+  int origin_queue_ms;            // 한도가 찬 origin으로 가는 요청이 자리를 기다리는 시간. 넘기면 503
+  int breaker_failures;           // origin이 연달아 이만큼 실패하면 circuit breaker를 연다. 0이면 세지 않는다
+  int breaker_error_pct;          // breaker_window_ms 동안 실패한 비율(%)이 이 이상이면 연다. 0이면 보지 않는다
+  int breaker_window_ms;          // 실패 비율을 세는 구간
+  int breaker_cooldown_ms;        // 연 뒤 이 시간 동안은 origin에 보내지 않고 바로 503. 지나면 시험 요청 하나를 보낸다
+
+  /* deadlines (deadline.c) */
+  int client_header_ms;           // 연결을 받고 요청 헤드를 다 받을 때까지. 넘기면 연결을 끊는다
+  int upstream_first_byte_ms;     // origin에 요청을 보내고 응답 헤드를 받을 때까지. 넘기면 504
+  int relay_idle_ms;              // 응답을 주고받는 중에 아무것도 오가지 않고 기다리는 시간. 넘기면 둘 다 끊는다
+
+  /* admission control (admit.c) */
+  int max_inflight;               // 동시에 처리하는 연결 수 상한. 넘으면 accept에서 바로 503. 0이면 끔
+  int shed_queue_ms;              // accept부터 스레드가 돌기까지 이보다 오래 기다렸으면 503. 0이면 끔
+  int shed_allow_hits;            // 1이면 거절하는 중에도 캐시 hit은 보낸다
+  int shed_retry_after;           // 503의 Retry-After (초)
+
+  /* per-client rate limits (ratelimit.c) */
+  int client_rps;                 // 클라이언트 IP마다 초당 요청 수. 넘으면 accept에서 429. 0이면 끔
+  int client_rps_burst;           // 한꺼번에 보낼 수 있는 요청 수. 0이면 client_rps
+  int client_bps;                 // 클라이언트 IP마다 초당 응답 바이트. 넘으면 빚을 갚을 때까지 429. 0이면 끔
+  int client_bps_burst;           // 한꺼번에 받을 수 있는 바이트. 0이면 client_bps
+
+  /* fair queuing (fairq.c) */
+  int fair_workers;               // 동시에 origin으로 보내는 miss 수. 넘치면 클라이언트별 차례로 기다린다. 0이면 끔
+  int fair_queue_ms;              // 차례를 기다리는 시간. 넘기면 503
+  char fair_tenant_header[64];    // 이 요청 헤더가 있으면 IP 대신 그 값으로 클라이언트를 나눈다. ""이면 IP로만
+  char fair_weights[MAXLINE];     // 클라이언트마다 몫: "10.0.0.5=4,tenant-a=2,...". 적지 않은 클라이언트는 1
+
+  /* hot restart (restart.c) */
+  int restart_drain_ms;           // 새 프로세스에 넘긴 뒤 처리 중인 연결이 끝나기를 기다리는 시간. 넘기면 끊고 끝낸다
+
+  /* memory limits (mem.c) */
+  int mem_limit_mb;               // 프록시가 쓸 메모리 한도(MB). 0이면 cgroup의 memory 한도, 그것도 없으면 세기만 한다
+  int mem_soft_pct;               // 한도의 이 %를 넘으면 캐시를 줄이고 새로 캐시하지 않고 max_inflight를 낮춘다
+  int mem_hard_pct;               // 한도의 이 %를 넘으면 새 연결을 accept에서 503으로 거절한다
+  int mem_check_ms;               // 사용량을 세는 주기
+} proxy_config;
+
+extern proxy_config conf;
+
+void config_init(void);
+int config_set(char *opt);
+void config_usage(FILE *fp);
+
+#endif /* __CONFIG_H__ */
@@ -0,0 +1,235 @@
+/*
+ * deadline.c - per-connection deadlines on a hierarchical timer wheel
+ *
+ * 휠은 네 단계다. 0단은 10ms tick 256칸(2.56초), 그 위로 64칸씩 세 단(163초, 2.9시간, 7.7일).
+ * 걸기, 옮기기, 떼기는 리스트 연결만 바꾸므로 연결 수와 상관없이 O(1)이다.
+ * 0단이 한 바퀴 돌 때마다 윗단의 한 칸을 풀어서 아랫단에 다시 넣는다(cascade).
+ *
+ * 본문을 주고받는 동안은 읽을 때마다 deadline을 미뤄야 하는데, 그때마다 락을 잡고 리스트를 옮기지
+ * 않도록 deadline_touch는 expires만 바꾼다. 타이머 스레드가 그 칸에 왔을 때 expires가 아직 남았으면
+ * 그 자리에 다시 넣는다.
+ *
+ * 타이머 스레드는 락을 잡은 채로 소켓을 shutdown한다. 연결 스레드는 fd를 닫기 전에 deadline_set이나
+ * deadline_clear로 (같은 락 안에서) fd를 휠에서 떼므로, 닫혀서 다른 연결이 다시 받은 fd를 끊는 일은 없다.
+ */
+#include "deadline.h"
+#include "cache.h"
+
+#define DL_TICK_MS 10
+#define DL_L0_BITS 8
+#define DL_LN_BITS 6
+#define DL_L0_SIZE (1 << DL_L0_BITS)
+#define DL_LN_SIZE (1 << DL_LN_BITS)
+#define DL_LEVELS 3       // 0단 위의 단 수
+#define DL_MAX_TICKS ((1ULL << (DL_L0_BITS + DL_LEVELS * DL_LN_BITS)) - 1)
+
+static struct {
+  dl_link l0[DL_L0_SIZE];
+  dl_link ln[DL_LEVELS][DL_LN_SIZE];
+  unsigned long long now;   // 다음에 처리할 tick. 연결 스레드는 락 없이 읽는다
+} wheel;
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+  unsigned long long expired[DL_NPHASES];
+  unsigned long long armed;     // 지금 휠에 걸린 deadline 수
+} stats;
+
+static const char *phase_names[DL_NPHASES] = { "header", "connect", "first_byte", "idle" };
+
+static inline void list_init(dl_link *head) {
+  head->next = head->prev = head;
+}
+
+static inline void list_add(dl_link *head, dl_link *l) {
+  l->next = head->next;
+  l->prev = head;
+  head->next->prev = l;
+  head->next = l;
+}
+
+static inline void list_del(dl_link *l) {
+  l->prev->next = l->next;
+  l->next->prev = l->prev;
+}
+
+// head의 리스트를 통째로 tmp로 옮긴다 (처리하는 동안 같은 칸에 다시 넣어도 섞이지 않게)
+static inline void list_take(dl_link *head, dl_link *tmp) {
+  if (head->next == head) {
+    list_init(tmp);
+    return;
+  }
+  tmp->next = head->next;
+  tmp->prev = head->prev;
+  tmp->next->prev = tmp;
+  tmp->prev->next = tmp;
+  list_init(head);
+}
+
+// 만료 tick에 맞는 칸에 넣는다. 락을 잡고 부른다
+static void wheel_add(deadline *d) {
+  unsigned long long exp = __atomic_load_n(&d->expires, __ATOMIC_RELAXED), delta;
+  dl_link *slot;
+  int level, shift;
+
+  if (exp < wheel.now)
+    exp = wheel.now;
+  delta = exp - wheel.now;
+  if (delta > DL_MAX_TICKS)
+    exp = wheel.now + DL_MAX_TICKS;
+  if (delta < DL_L0_SIZE) {
+    slot = &wheel.l0[exp & (DL_L0_SIZE - 1)];
+  } else {
+    for (level = 0; level < DL_LEVELS - 1; level++)
+      if (delta < 1ULL << (DL_L0_BITS + (level + 1) * DL_LN_BITS))
+        break;
+    shift = DL_L0_BITS + level * DL_LN_BITS;
+    slot = &wheel.ln[level][(exp >> shift) & (DL_LN_SIZE - 1)];
+  }
+  list_add(slot, &d->link);
+}
+
+// level단의 지금 칸을 풀어서 다시 넣는다. 그 칸 번호를 리턴한다 (0이면 윗단도 풀 차례)
+static int cascade(int level) {
+  int idx = (wheel.now >> (DL_L0_BITS + level * DL_LN_BITS)) & (DL_LN_SIZE - 1);
+  dl_link tmp, *l;
+
+  list_take(&wheel.ln[level][idx], &tmp);
+  while ((l = tmp.next) != &tmp) {
+    list_del(l);
+    wheel_add((deadline *)l);
+  }
+  return idx;
+}
+
+// 시간이 지난 연결의 소켓을 끊는다. 막혀 있던 read/write가 0이나 EPIPE로 돌아온다
+static void expire(deadline *d) {
+  d->linked = 0;
+  d->expired = d->phase;
+  stats.expired[d->phase]++;
+  stats.armed--;
+  if (d->phase != DL_FIRST_BYTE && d->clientfd >= 0)
+    shutdown(d->clientfd, SHUT_RDWR);
+  if (d->upfd >= 0)
+    shutdown(d->upfd, SHUT_RDWR);
+}
+
+// tick 하나를 처리한다. 락을 잡고 부른다
+static void run_tick(void) {
+  int idx = wheel.now & (DL_L0_SIZE - 1), level;
+  dl_link tmp, *l;
+  deadline *d;
+
+  if (idx == 0)
+    for (level = 0; level < DL_LEVELS && cascade(level) == 0; level++)
+      ;
+  list_take(&wheel.l0[idx], &tmp);
+  while ((l = tmp.next) != &tmp) {
+    list_del(l);
+    d = (deadline *)l;
+    if (__atomic_load_n(&d->expires, __ATOMIC_RELAXED) > wheel.now)
+      wheel_add(d);   // deadline_touch로 미뤄졌다
+    else
+      expire(d);
+  }
+  __atomic_store_n(&wheel.now, wheel.now + 1, __ATOMIC_RELAXED);
+}
+
+static void *wheel_thread(void *vargp) {
+  long long start = now_ms();
+  unsigned long long target;
+
+  for (;;) {
+    usleep(DL_TICK_MS * 1000);
+    target = (now_ms() - start) / DL_TICK_MS;
+    pthread_mutex_lock(&wheel_mutex);
+    while (wheel.now < target)
+      run_tick();
+    pthread_mutex_unlock(&wheel_mutex);
+  }
+  return NULL;
+}
+
+/*
+ * deadline_init - 휠을 비우고 타이머 스레드를 띄운다. main에서 한 번 부른다
+ */
+void deadline_init(void) {
+  pthread_t tid;
+  int i, j;
+
+  for (i = 0; i < DL_L0_SIZE; i++)
+    list_init(&wheel.l0[i]);
+  for (i = 0; i < DL_LEVELS; i++)
+    for (j = 0; j < DL_LN_SIZE; j++)
+      list_init(&wheel.ln[i][j]);
+  Pthread_create(&tid, NULL, wheel_thread, NULL);
+  Pthread_detach(tid);
+}
+
+void deadline_start(deadline *d, int clientfd) {
+  d->clientfd = clientfd;
+  d->upfd = -1;
+  d->linked = 0;
+  d->expired = -1;
+  d->phase = DL_HEADER;
+}
+
+/*
+ * deadline_set - 지금부터 ms 안에 phase가 끝나야 한다. upfd는 같이 끊을 origin 소켓(없으면 -1).
+ *   ms <= 0이면 deadline 없이 기다린다. 이전 단계가 시간이 지나서 끊겼으면 그 단계, 아니면 -1을 리턴한다.
+ *   fd를 닫기 전에는 그 fd를 뺀 deadline_set이나 deadline_clear를 먼저 불러야 한다
+ */
+int deadline_set(deadline *d, int phase, int ms, int upfd) {
+  int expired;
+
+  pthread_mutex_lock(&wheel_mutex);
+  expired = d->expired;
+  if (d->linked) {
+    list_del(&d->link);
+    stats.armed--;
+  }
+  d->phase = phase;
+  d->upfd = upfd;
+  d->expired = -1;
+  d->linked = ms > 0;
+  if (d->linked) {
+    d->ticks = (ms + DL_TICK_MS - 1) / DL_TICK_MS;
+    d->expires = wheel.now + d->ticks;
+    wheel_add(d);
+    stats.armed++;
+  }
+  pthread_mutex_unlock(&wheel_mutex);
+  return expired;
+}
+
+/*
+ * deadline_touch - 주고받는 게 진행됐다. 지금 단계의 deadline을 처음 건 길이만큼 다시 미룬다 (락 없음)
+ */
+void deadline_touch(deadline *d) {
+  __atomic_store_n(&d->expires, __atomic_load_n(&wheel.now, __ATOMIC_RELAXED) + d->ticks, __ATOMIC_RELAXED);
+}
+
+/*
+ * deadline_clear - 휠에서 뗀다. 시간이 지나서 끊긴 단계가 있었으면 그 단계, 아니면 -1
+ */
+int deadline_clear(deadline *d) {
+  return deadline_set(d, d->phase, 0, -1);
+}
+
+// 휠 밖에서 지킨 deadline(DL_CONNECT)이 지났을 때 센다
+void deadline_note(int phase) {
+  pthread_mutex_lock(&wheel_mutex);
+  stats.expired[phase]++;
+  pthread_mutex_unlock(&wheel_mutex);
+}
+
+void deadline_stats(FILE *fp) {
+  int i;
+
+  pthread_mutex_lock(&wheel_mutex);
+  fprintf(fp, "deadlines armed %llu expired", stats.armed);
+  for (i = 0; i < DL_NPHASES; i++)
+    fprintf(fp, " %s %llu", phase_names[i], stats.expired[i]);
+  fprintf(fp, "\n");
+  pthread_mutex_unlock(&wheel_mutex);
+}
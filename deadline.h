@@ -0,0 +1,46 @@
+/*
+ * deadline.h - per-connection deadlines on a hierarchical timer wheel
+ *
+ * 연결 스레드는 blocking I/O로 기다리므로, 응답하지 않는 상대(헤더를 안 보내는 클라이언트,
+ * 연결만 받고 응답하지 않는 origin)를 만나면 스레드와 fd가 영원히 묶인다.
+ * 연결마다 지금 단계의 deadline을 하나 걸어 두면 타이머 스레드가 시간이 지난 연결의 소켓을
+ * shutdown해서, 막혀 있던 read/write가 바로 돌아오고 스레드가 정리하고 끝난다.
+ */
+#ifndef __DEADLINE_H__
+#define __DEADLINE_H__
+
+#include "csapp.h"
+
+// 연결이 기다리는 단계. 시간이 지나면 어느 소켓을 끊을지가 단계마다 다르다
+enum {
+  DL_HEADER,        // 클라이언트 요청 헤드가 다 올 때까지. 클라이언트 소켓을 끊는다
+  DL_CONNECT,       // origin 연결. open_clientfd_timeout이 직접 지키고 여기서는 세기만 한다
+  DL_FIRST_BYTE,    // 요청을 보낸 뒤 origin 응답 헤드까지. origin 소켓만 끊어서 504를 보낼 수 있다
+  DL_IDLE,          // 주고받는 게 멈춘 시간. 클라이언트와 (있으면) origin 소켓을 끊는다
+  DL_NPHASES
+};
+
+typedef struct dl_link {
+  struct dl_link *next, *prev;
+} dl_link;
+
+typedef struct {
+  dl_link link;                 // 휠의 slot 리스트. 첫 필드여야 한다
+  unsigned long long expires;   // 만료 tick. deadline_touch가 락 없이 뒤로 미룬다
+  int ticks;                    // deadline_touch가 미룰 길이
+  int phase;
+  int clientfd;
+  int upfd;                     // origin 소켓. 없으면 -1
+  int linked;                   // 휠에 들어 있는지
+  int expired;                  // 시간이 지나서 끊은 단계. 아니면 -1
+} deadline;
+
+void deadline_init(void);
+void deadline_start(deadline *d, int clientfd);
+int deadline_set(deadline *d, int phase, int ms, int upfd);
+void deadline_touch(deadline *d);
+int deadline_clear(deadline *d);
+void deadline_note(int phase);
+void deadline_stats(FILE *fp);
+
+#endif /* __DEADLINE_H__ */
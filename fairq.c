@@ -0,0 +1,256 @@
+/*
+ * fairq.c - weighted fair queuing of requests across clients
+ *
+ * 기다리는 요청이 있는 클라이언트(flow)만 표에 있고, 그런 flow들은 active 리스트로 한 줄을 선다.
+ * 자리가 나면 줄 맨 앞 flow의 요청 하나에 자리를 넘긴다. flow는 한 차례에 weight개까지 보내고
+ * 줄 끝으로 간다 (요청마다 비용을 1로 보는 deficit round-robin). 줄이 빈 flow는 표에서 빠진다.
+ *
+ * 자리는 끝난 요청이 기다리던 요청에 바로 넘겨주므로, 기다리는 요청이 있는 동안 새로 온 요청이
+ * 빈 자리를 먼저 가로채는 일은 없다. 기다리는 요청은 자기 스택의 waiter에서 자기 cond로 잔다.
+ */
+#include "fairq.h"
+#include "config.h"
+
+typedef struct waiter {
+  struct waiter *next, *prev;
+  pthread_cond_t cond;
+  int granted;
+} waiter;
+
+typedef struct flow {
+  char key[FAIRQ_KEY_MAX];      // ""이면 빈 자리
+  unsigned int hash;
+  int weight;
+  int deficit;                  // 이번 차례에 더 보낼 수 있는 요청 수
+  int nwaiting;
+  waiter waiters;               // 기다리는 요청 (도착 순서)
+  struct flow *next, *prev;     // active 리스트
+} flow;
+
+static flow flows[FAIRQ_FLOWS];
+static flow active;             // 기다리는 요청이 있는 flow의 줄 (sentinel)
+static int busy;                // 자리를 받아 처리 중인 요청
+static pthread_condattr_t cond_attr;  // waiter의 cond는 CLOCK_MONOTONIC으로 기다린다
+static pthread_mutex_t fairq_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// fair_weights를 파싱한 것. 시작할 때 한 번 채우고 그 뒤로는 읽기만 한다
+static struct {
+  char key[FAIRQ_KEY_MAX];
+  int weight;
+} weights[FAIRQ_WEIGHTS_MAX];
+static int nweights;
+
+static struct {
+  unsigned long long direct;    // 기다리지 않고 자리를 받은 요청
+  unsigned long long queued;    // 줄을 섰다가 자리를 받은 요청
+  unsigned long long timeouts;  // fair_queue_ms 안에 자리를 못 받은 요청
+  unsigned long long shared;    // 표가 꽉 차서 다른 클라이언트와 줄을 같이 선 요청
+} stats;
+
+static unsigned int key_hash(char *key) {
+  unsigned int h = 2166136261u;
+
+  for (; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * fairq_init - fair_weights("key=weight,key=weight")을 읽는다. 다른 스레드가 시작하기 전에 main에서
+ *   한 번 부른다. 형식이 잘못됐으면 stderr에 알리고 -1
+ */
+int fairq_init(void) {
+  char list[MAXLINE], *item, *save, *eq, *end;
+  long w;
+
+  active.next = active.prev = &active;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  nweights = 0;
+  strcpy(list, conf.fair_weights);
+  for (item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    if ((eq = strrchr(item, '=')) == NULL || eq == item || eq - item >= FAIRQ_KEY_MAX) {
+      fprintf(stderr, "fair_weights: expected key=weight, got \"%s\"\n", item);
+      return -1;
+    }
+    w = strtol(eq + 1, &end, 10);
+    if (*end != '\0' || w < 1 || w > 1000) {
+      fprintf(stderr, "fair_weights: weight must be 1..1000 in \"%s\"\n", item);
+      return -1;
+    }
+    if (nweights == FAIRQ_WEIGHTS_MAX) {
+      fprintf(stderr, "fair_weights: more than %d entries\n", FAIRQ_WEIGHTS_MAX);
+      return -1;
+    }
+    memcpy(weights[nweights].key, item, eq - item);
+    weights[nweights].key[eq - item] = '\0';
+    weights[nweights].weight = w;
+    nweights++;
+  }
+  return 0;
+}
+
+static int key_weight(char *key) {
+  int i;
+
+  for (i = 0; i < nweights; i++)
+    if (!strcmp(weights[i].key, key))
+      return weights[i].weight;
+  return 1;
+}
+
+// key의 flow. 없으면 빈 자리에 만든다. 빈 자리가 없으면 줄 맨 끝 flow에 같이 세운다. 락을 잡고 부른다
+static flow *flow_get(char *key) {
+  unsigned int hash = key_hash(key);
+  flow *f, *empty = NULL;
+  int i;
+
+  for (i = 0; i < FAIRQ_FLOWS; i++) {
+    f = &flows[i];
+    if (f->key[0] == '\0') {
+      if (empty == NULL)
+        empty = f;
+    } else if (f->hash == hash && !strcmp(f->key, key)) {
+      return f;
+    }
+  }
+  if (empty == NULL) {
+    stats.shared++;
+    return active.prev;   // 표가 꽉 찼으면 active도 비어 있지 않다
+  }
+  f = empty;
+  strcpy(f->key, key);
+  f->hash = hash;
+  f->weight = key_weight(key);
+  f->deficit = 0;
+  f->nwaiting = 0;
+  f->waiters.next = f->waiters.prev = &f->waiters;
+  // 줄 끝에 선다
+  f->prev = active.prev;
+  f->next = &active;
+  active.prev->next = f;
+  active.prev = f;
+  return f;
+}
+
+static void flow_remove(flow *f) {
+  f->prev->next = f->next;
+  f->next->prev = f->prev;
+  f->key[0] = '\0';
+}
+
+// 줄 맨 앞 flow의 요청 하나를 꺼낸다. active가 비어 있지 않을 때 락을 잡고 부른다
+static waiter *pick(void) {
+  flow *f = active.next;
+  waiter *w = f->waiters.next;
+
+  if (f->deficit < 1)
+    f->deficit += f->weight;    // 이번 차례의 몫
+  f->deficit--;
+  w->prev->next = w->next;
+  w->next->prev = w->prev;
+  f->nwaiting--;
+  if (f->nwaiting == 0) {
+    flow_remove(f);
+  } else if (f->deficit < 1) {
+    // 몫을 다 썼으면 줄 끝으로
+    f->prev->next = f->next;
+    f->next->prev = f->prev;
+    f->prev = active.prev;
+    f->next = &active;
+    active.prev->next = f;
+    active.prev = f;
+  }
+  return w;
+}
+
+/*
+ * fairq_enter - key(클라이언트 이름)의 요청이 처리할 자리를 받는다. 자리가 있으면 바로, 없으면 클라이언트별
+ *   차례를 기다려서 받고 1. fair_queue_ms 안에 못 받았으면 0. fair_workers가 0이면 기다리지 않는다
+ */
+int fairq_enter(fair_ticket *t, char *key) {
+  struct timespec until;
+  waiter w;
+  flow *f;
+
+  t->entered = 0;
+  if (conf.fair_workers <= 0)
+    return 1;
+  pthread_mutex_lock(&fairq_mutex);
+  if (busy < conf.fair_workers && active.next == &active) {
+    busy++;
+    stats.direct++;
+    pthread_mutex_unlock(&fairq_mutex);
+    t->entered = 1;
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &until);
+  until.tv_sec += conf.fair_queue_ms / 1000;
+  until.tv_nsec += (conf.fair_queue_ms % 1000) * 1000000L;
+  if (until.tv_nsec >= 1000000000L) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
+  }
+  pthread_cond_init(&w.cond, &cond_attr);
+  w.granted = 0;
+  f = flow_get(key);
+  w.prev = f->waiters.prev;
+  w.next = &f->waiters;
+  f->waiters.prev->next = &w;
+  f->waiters.prev = &w;
+  f->nwaiting++;
+  while (!w.granted)
+    if (pthread_cond_timedwait(&w.cond, &fairq_mutex, &until) == ETIMEDOUT)
+      break;
+  if (w.granted) {
+    stats.queued++;
+  } else {
+    // 줄에서 빠진다
+    w.prev->next = w.next;
+    w.next->prev = w.prev;
+    if (--f->nwaiting == 0)
+      flow_remove(f);
+    stats.timeouts++;
+  }
+  pthread_mutex_unlock(&fairq_mutex);
+  pthread_cond_destroy(&w.cond);
+  t->entered = w.granted;
+  return w.granted;
+}
+
+/*
+ * fairq_exit - 요청이 끝났다. 받은 자리가 있으면 기다리는 요청에 넘겨주거나 비운다
+ */
+void fairq_exit(fair_ticket *t) {
+  waiter *w;
+
+  if (!t->entered)
+    return;
+  t->entered = 0;
+  pthread_mutex_lock(&fairq_mutex);
+  if (active.next != &active) {
+    w = pick();   // 자리는 그대로 넘긴다
+    w->granted = 1;
+    pthread_cond_signal(&w->cond);
+  } else {
+    busy--;
+  }
+  pthread_mutex_unlock(&fairq_mutex);
+}
+
+void fairq_stats(FILE *fp) {
+  int nflows = 0, waiting = 0;
+  flow *f;
+
+  pthread_mutex_lock(&fairq_mutex);
+  for (f = active.next; f != &active; f = f->next) {
+    nflows++;
+    waiting += f->nwaiting;
+  }
+  fprintf(fp, "fairq workers %d busy %d waiting %d clients_waiting %d direct %llu queued %llu timeouts %llu shared %llu\n",
+          conf.fair_workers, busy, waiting, nflows, stats.direct, stats.queued, stats.timeouts, stats.shared);
+  pthread_mutex_unlock(&fairq_mutex);
+}
@@ -0,0 +1,29 @@
+/*
+ * fairq.h - weighted fair queuing of requests across clients
+ *
+ * 연결마다 스레드가 있어도 요청을 동시에 처리하는 수(fair_workers)는 정해 둔다. 자리가 다 찼을 때
+ * 들어온 요청은 도착 순서가 아니라 클라이언트(IP나 fair_tenant_header 값)별 차례로 자리를 받는다
+ * (deficit round-robin). 한 클라이언트가 요청을 1000개 쏟아부어도 그 클라이언트의 줄만 길어지고,
+ * 다른 클라이언트의 요청은 한 바퀴 안에 자리를 받는다. fair_weights로 클라이언트마다 몫을 다르게 준다.
+ * 캐시 hit은 메모리에서 소켓으로 쓰기만 하므로 자리를 받지 않고 바로 보낸다. 자리는 miss만 받는다.
+ */
+#ifndef __FAIRQ_H__
+#define __FAIRQ_H__
+
+#include "csapp.h"
+
+#define FAIRQ_FLOWS 512         // 동시에 기다릴 수 있는 클라이언트 수. 넘치면 남는 클라이언트는 한 줄을 같이 쓴다
+#define FAIRQ_KEY_MAX 64        // 클라이언트 이름(IP나 tenant 헤더 값)의 최대 길이
+#define FAIRQ_WEIGHTS_MAX 32    // fair_weights에 적을 수 있는 클라이언트 수
+
+// 요청 하나가 받은 자리. thread()가 들고 있다가 요청이 끝나면 fairq_exit로 돌려준다
+typedef struct {
+  int entered;
+} fair_ticket;
+
+int fairq_init(void);
+int fairq_enter(fair_ticket *t, char *key);
+void fairq_exit(fair_ticket *t);
+void fairq_stats(FILE *fp);
+
+#endif /* __FAIRQ_H__ */
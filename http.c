@@ -0,0 +1,420 @@
+/*
+ * http.c - single-pass HTTP request/response parser
+ *
+ * 요청 헤드 전체를 한 번만 훑으면서 요청 줄을 method/target/version으로 나누고
+ * 헤더 줄마다 이름/값 slice를 만든다. 아는 헤더 이름은 perfect hash로 id를 붙여서
+ * 이후 단계(캐시 키, variant 선택, 헤더 재작성)가 문자열 비교 없이 바로 찾는다.
+ * origin 응답 헤드도 같은 방식으로 파싱하고, 본문이 어디서 끝나는지(framing)를 알려준다.
+ */
+#include "http.h"
+
+static const char *known_names[HDR_KNOWN_COUNT] = {
+  "host", "connection", "proxy-connection", "keep-alive", "user-agent",
+  "accept", "accept-encoding", "accept-language", "range", "if-range",
+  "if-none-match", "if-modified-since", "cache-control", "pragma", "cookie",
+  "authorization", "proxy-authorization", "content-length", "content-type",
+  "content-encoding", "transfer-encoding", "te", "trailer", "upgrade",
+  "vary", "expires", "etag", "last-modified", "date",
+};
+static int known_len[HDR_KNOWN_COUNT];
+
+/*
+ * Perfect hash: (길이 + 23 * 첫 글자 + 가운데 글자) & 63 이 위 이름들에 대해 모두 다르다.
+ * 이름을 추가해서 충돌이 생기면 http_init이 시작할 때 알려준다
+ */
+#define HDR_SLOTS 64
+static signed char hdr_slot[HDR_SLOTS];
+
+static inline int lower(int c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline unsigned int hdr_hash(const char *name, int len) {
+  return (len + 23 * lower((unsigned char)name[0]) + lower((unsigned char)name[len / 2])) & (HDR_SLOTS - 1);
+}
+
+// 다른 스레드가 시작하기 전에 main에서 한 번 부른다
+void http_init(void) {
+  int id;
+  unsigned int h;
+
+  memset(hdr_slot, -1, sizeof(hdr_slot));
+  for (id = 0; id < HDR_KNOWN_COUNT; id++) {
+    known_len[id] = strlen(known_names[id]);
+    h = hdr_hash(known_names[id], known_len[id]);
+    if (hdr_slot[h] >= 0) {
+      fprintf(stderr, "http_init: \"%s\" and \"%s\" hash to the same slot\n",
+              known_names[hdr_slot[h]], known_names[id]);
+      exit(1);
+    }
+    hdr_slot[h] = id;
+  }
+}
+
+/*
+ * http_hdr_lookup - 헤더 이름(대소문자 무시)의 id. 모르는 이름이면 HDR_OTHER
+ */
+int http_hdr_lookup(const char *name, int len) {
+  int id;
+
+  if (len <= 0)
+    return HDR_OTHER;
+  id = hdr_slot[hdr_hash(name, len)];
+  if (id >= 0 && known_len[id] == len && !strncasecmp(name, known_names[id], len))
+    return id;
+  return HDR_OTHER;
+}
+
+static inline int is_ws(int c) {
+  return c == ' ' || c == '\t';
+}
+
+/*
+ * parse_fields - p부터 빈 줄까지의 헤더 줄들을 hdrs에 채운다. 요청과 응답이 같이 쓴다.
+ *   성공하면 0, 형식이 잘못됐거나 헤더가 너무 많거나 빈 줄이 없으면 -1
+ */
+static int parse_fields(char *p, char *end, http_hdr *hdrs, int *nhdrs, int *known) {
+  char *eol, *lend, *colon, *v;
+  http_hdr *h;
+  int i, id, last[HDR_KNOWN_COUNT];
+
+  *nhdrs = 0;
+  for (i = 0; i < HDR_KNOWN_COUNT; i++)
+    known[i] = last[i] = -1;
+
+  while (p < end) {
+    if ((eol = memchr(p, '\n', end - p)) == NULL)
+      return -1;
+    lend = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+    if (lend == p)
+      return 0;   // empty line
+    if (is_ws(*p))
+      return -1;  // obs-fold는 받지 않는다 (RFC 7230 3.2.4)
+    if ((colon = memchr(p, ':', lend - p)) == NULL || colon == p || is_ws(colon[-1]))
+      return -1;
+    if (*nhdrs == HTTP_MAX_HEADERS)
+      return -1;
+
+    h = &hdrs[*nhdrs];
+    h->line.p = p;
+    h->line.len = eol + 1 - p;
+    h->name.p = p;
+    h->name.len = colon - p;
+    for (v = colon + 1; v < lend && is_ws(*v); v++)
+      ;
+    while (lend > v && is_ws(lend[-1]))
+      lend--;
+    h->value.p = v;
+    h->value.len = lend - v;
+    h->next = -1;
+    h->id = id = http_hdr_lookup(h->name.p, h->name.len);
+    if (id != HDR_OTHER) {
+      if (last[id] < 0)
+        known[id] = *nhdrs;
+      else
+        hdrs[last[id]].next = *nhdrs;
+      last[id] = *nhdrs;
+    }
+    (*nhdrs)++;
+    p = eol + 1;
+  }
+  return -1;  // 빈 줄이 없다
+}
+
+/*
+ * http_parse_request - buf[0..len)에 든 요청 헤드(요청 줄 + 헤더 + 빈 줄)를 파싱한다.
+ *   buf는 수정하지 않는다. 성공하면 0, 형식이 잘못됐거나 헤더가 너무 많으면 -1
+ */
+int http_parse_request(char *buf, int len, http_request *req) {
+  char *p = buf, *end = buf + len, *eol, *lend;
+  int i;
+
+  req->nhdrs = 0;
+  for (i = 0; i < HDR_KNOWN_COUNT; i++)
+    req->known[i] = -1;
+
+  // request line: method SP target SP version
+  if ((eol = memchr(p, '\n', end - p)) == NULL)
+    return -1;
+  lend = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+  http_slice *parts[3] = { &req->method, &req->target, &req->version };
+  for (i = 0; i < 3; i++) {
+    while (p < lend && is_ws(*p))
+      p++;
+    parts[i]->p = p;
+    while (p < lend && !is_ws(*p))
+      p++;
+    parts[i]->len = p - parts[i]->p;
+    if (parts[i]->len == 0)
+      return -1;
+  }
+  while (p < lend && is_ws(*p))
+    p++;
+  if (p != lend)
+    return -1;
+  p = eol + 1;
+
+  // header lines, up to the empty line
+  return parse_fields(p, end, req->hdrs, &req->nhdrs, req->known);
+}
+
+/*
+ * http_parse_response - buf[0..len)에 든 응답 헤드(상태 줄 + 헤더 + 빈 줄)를 파싱한다.
+ *   buf는 수정하지 않는다. 성공하면 0, 형식이 잘못됐으면 -1
+ */
+int http_parse_response(char *buf, int len, http_response *resp) {
+  char *p = buf, *end = buf + len, *eol, *lend;
+  int i;
+
+  resp->nhdrs = 0;
+  resp->status = 0;
+  for (i = 0; i < HDR_KNOWN_COUNT; i++)
+    resp->known[i] = -1;
+
+  // status line: HTTP-version SP 3DIGIT SP [reason-phrase]
+  if ((eol = memchr(p, '\n', end - p)) == NULL)
+    return -1;
+  lend = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+  resp->status_line.p = p;
+  resp->status_line.len = eol + 1 - p;
+  if (lend - p < 12 || strncmp(p, "HTTP/", 5))
+    return -1;
+  resp->version.p = p;
+  while (p < lend && !is_ws(*p))
+    p++;
+  resp->version.len = p - resp->version.p;
+  if (p == lend || *p != ' ' || lend - p < 4)
+    return -1;
+  for (i = 1; i <= 3; i++) {
+    if (p[i] < '0' || p[i] > '9')
+      return -1;
+    resp->status = resp->status * 10 + (p[i] - '0');
+  }
+  p += 4;
+  if (p < lend && *p != ' ')
+    return -1;
+  if (p < lend)
+    p++;
+  resp->reason.p = p;
+  resp->reason.len = lend - p;
+
+  return parse_fields(eol + 1, end, resp->hdrs, &resp->nhdrs, resp->known);
+}
+
+/*
+ * http_find - id 헤더 중 첫 번째. 없으면 NULL. 나머지는 next로 따라간다
+ */
+http_hdr *http_find(http_request *req, int id) {
+  if (id < 0 || id >= HDR_KNOWN_COUNT || req->known[id] < 0)
+    return NULL;
+  return &req->hdrs[req->known[id]];
+}
+
+// 응답에서 http_find와 같은 일을 한다
+http_hdr *http_resp_find(http_response *resp, int id) {
+  if (id < 0 || id >= HDR_KNOWN_COUNT || resp->known[id] < 0)
+    return NULL;
+  return &resp->hdrs[resp->known[id]];
+}
+
+static int append_value(char *value, int len, int maxlen, int found, http_slice s) {
+  if (found && len + 2 < maxlen) {
+    memcpy(value + len, ", ", 2);
+    len += 2;
+  }
+  if (s.len > maxlen - 1 - len)
+    s.len = maxlen - 1 - len;
+  if (s.len > 0) {
+    memcpy(value + len, s.p, s.len);
+    len += s.len;
+  }
+  return len;
+}
+
+/*
+ * http_header_value - name 헤더의 값을 value에 복사한다. 여러 번 나오면 ", "로 잇는다.
+ *   아는 헤더는 id로 바로 찾고, 모르는 이름은 헤더 목록을 훑는다. 있으면 1, 없으면 0
+ */
+static int header_value(http_hdr *hdrs, int nhdrs, int *known, char *name, char *value, int maxlen) {
+  int namelen = strlen(name), id = http_hdr_lookup(name, namelen);
+  int i, len = 0, found = 0;
+  http_hdr *h;
+
+  value[0] = '\0';
+  if (maxlen <= 0)
+    return 0;
+  if (id != HDR_OTHER) {
+    for (i = known[id]; i >= 0; i = h->next) {
+      h = &hdrs[i];
+      len = append_value(value, len, maxlen, found, h->value);
+      found = 1;
+    }
+  } else {
+    for (i = 0; i < nhdrs; i++) {
+      h = &hdrs[i];
+      if (h->id == HDR_OTHER && h->name.len == namelen && !strncasecmp(h->name.p, name, namelen)) {
+        len = append_value(value, len, maxlen, found, h->value);
+        found = 1;
+      }
+    }
+  }
+  value[len] = '\0';
+  return found;
+}
+
+int http_header_value(http_request *req, char *name, char *value, int maxlen) {
+  return header_value(req->hdrs, req->nhdrs, req->known, name, value, maxlen);
+}
+
+int http_resp_header_value(http_response *resp, char *name, char *value, int maxlen) {
+  return header_value(resp->hdrs, resp->nhdrs, resp->known, name, value, maxlen);
+}
+
+/*
+ * http_has_token - 쉼표로 나뉜 목록 s("close, Upgrade" 같은)에 token이 있으면 1 (대소문자 무시)
+ */
+int http_has_token(http_slice s, const char *token) {
+  char *p = s.p, *end = s.p + s.len, *q, *e;
+  int tlen = strlen(token);
+
+  while (p < end) {
+    for (q = p; q < end && *q != ','; q++)
+      ;
+    for (e = q; e > p && is_ws(e[-1]); e--)
+      ;
+    while (p < e && is_ws(*p))
+      p++;
+    if (e - p == tlen && !strncasecmp(p, token, tlen))
+      return 1;
+    p = q + 1;
+  }
+  return 0;
+}
+
+// 숫자로만 된 Content-Length 값. 잘못됐거나 18자리를 넘으면 -1
+static long long parse_length(char *p, char *end) {
+  long long n = 0;
+
+  if (p == end || end - p > 18)
+    return -1;
+  for (; p < end; p++) {
+    if (*p < '0' || *p > '9')
+      return -1;
+    n = n * 10 + (*p - '0');
+  }
+  return n;
+}
+
+/*
+ * http_body_framing - 응답 본문이 어디서 끝나는지 (RFC 7230 3.3.3). GET에 대한 응답만 다룬다.
+ *   HTTP_BODY_LENGTH이면 *length에 본문 길이. Content-Length가 잘못됐거나 서로 다르면 -1
+ */
+int http_body_framing(http_response *resp, long long *length) {
+  http_hdr *h, *last = NULL;
+  char *p, *q, *e, *end;
+  long long n, len = -1;
+
+  *length = 0;
+  if (resp->status / 100 == 1 || resp->status == 204 || resp->status == 304)
+    return HTTP_BODY_NONE;
+
+  // 마지막 transfer-coding이 chunked일 때만 본문 끝을 알 수 있다. 아니면 연결이 닫힐 때까지.
+  // Transfer-Encoding이 있으면 Content-Length는 무시한다
+  if ((h = http_resp_find(resp, HDR_TRANSFER_ENCODING)) != NULL) {
+    for (; h != NULL; h = h->next < 0 ? NULL : &resp->hdrs[h->next])
+      last = h;
+    end = last->value.p + last->value.len;
+    for (p = end; p > last->value.p && p[-1] != ','; p--)
+      ;
+    while (p < end && is_ws(*p))
+      p++;
+    return (end - p == 7 && !strncasecmp(p, "chunked", 7)) ? HTTP_BODY_CHUNKED : HTTP_BODY_EOF;
+  }
+
+  // Content-Length: 여러 번 오거나 "42, 42"처럼 와도 값이 모두 같으면 받는다
+  for (h = http_resp_find(resp, HDR_CONTENT_LENGTH); h != NULL; h = h->next < 0 ? NULL : &resp->hdrs[h->next]) {
+    p = h->value.p;
+    end = p + h->value.len;
+    while (p < end) {
+      for (q = p; q < end && *q != ','; q++)
+        ;
+      e = q;
+      while (p < e && is_ws(*p))
+        p++;
+      while (e > p && is_ws(e[-1]))
+        e--;
+      if ((n = parse_length(p, e)) < 0 || (len >= 0 && n != len))
+        return -1;
+      len = n;
+      p = q + 1;
+    }
+  }
+  if (len >= 0) {
+    *length = len;
+    return HTTP_BODY_LENGTH;
+  }
+  return HTTP_BODY_EOF;
+}
+
+/*
+ * http_keep_alive - 응답을 다 읽은 뒤 origin 연결을 다시 써도 되는지.
+ *   HTTP/1.1은 Connection: close가 없으면, HTTP/1.0은 Connection: keep-alive가 있을 때만
+ */
+int http_keep_alive(http_response *resp) {
+  http_hdr *h;
+  int close = 0, keep = 0;
+
+  for (h = http_resp_find(resp, HDR_CONNECTION); h != NULL; h = h->next < 0 ? NULL : &resp->hdrs[h->next]) {
+    close |= http_has_token(h->value, "close");
+    keep |= http_has_token(h->value, "keep-alive");
+  }
+  if (close)
+    return 0;
+  if (resp->version.len == 8 && !strncmp(resp->version.p, "HTTP/1.0", 8))
+    return keep;
+  return 1;
+}
+
+/*
+ * http_chunk_size - chunk-size 줄("1a3f;ext=v\r\n")의 크기. 형식이 잘못됐으면 -1
+ */
+long long http_chunk_size(char *line, int len) {
+  char *p = line, *end = line + len;
+  long long n = 0;
+  int digits = 0, d;
+
+  for (; p < end; p++, digits++) {
+    if (*p >= '0' && *p <= '9')
+      d = *p - '0';
+    else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+      d = (*p | 0x20) - 'a' + 10;
+    else
+      break;
+    if (digits == 15)
+      return -1;    // 너무 크다
+    n = n * 16 + d;
+  }
+  if (digits == 0)
+    return -1;
+  while (p < end && is_ws(*p))
+    p++;
+  if (p < end && *p != ';' && *p != '\r' && *p != '\n')
+    return -1;      // chunk-ext는 ';' 뒤에 오고 무시한다
+  if (len == 0 || line[len - 1] != '\n')
+    return -1;
+  return n;
+}
+
+// 대소문자를 무시하고 s가 str과 같으면 1
+int http_slice_eq(http_slice s, const char *str) {
+  return (int)strlen(str) == s.len && !strncasecmp(s.p, str, s.len);
+}
+
+// s를 NUL로 끝나는 문자열로 dst에 복사한다. 안 들어가면 잘라내고 -1
+int http_slice_cpy(char *dst, int size, http_slice s) {
+  int n = s.len < size ? s.len : size - 1;
+
+  memcpy(dst, s.p, n);
+  dst[n] = '\0';
+  return n == s.len ? n : -1;
+}
@@ -0,0 +1,104 @@
+/*
+ * http.h - single-pass HTTP request/response parser
+ *
+ * rio_readhdrs_view로 읽은 요청(응답) 헤드를 복사하지 않고 한 번에 파싱한다.
+ * 결과는 전부 원래 버퍼를 가리키는 slice라서 버퍼(클라이언트/origin rio)가 살아 있는 동안만 유효하다.
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "csapp.h"
+
+typedef struct {
+  char *p;
+  int len;
+} http_slice;
+
+/*
+ * 프록시가 직접 보는 헤더들. 이름은 perfect hash로 O(1)에 찾는다 (http.c 참고).
+ * 추가할 때는 여기와 http.c의 known_names[]에 같은 순서로 넣는다
+ */
+typedef enum {
+  HDR_OTHER = -1,
+  HDR_HOST,
+  HDR_CONNECTION,
+  HDR_PROXY_CONNECTION,
+  HDR_KEEP_ALIVE,
+  HDR_USER_AGENT,
+  HDR_ACCEPT,
+  HDR_ACCEPT_ENCODING,
+  HDR_ACCEPT_LANGUAGE,
+  HDR_RANGE,
+  HDR_IF_RANGE,
+  HDR_IF_NONE_MATCH,
+  HDR_IF_MODIFIED_SINCE,
+  HDR_CACHE_CONTROL,
+  HDR_PRAGMA,
+  HDR_COOKIE,
+  HDR_AUTHORIZATION,
+  HDR_PROXY_AUTHORIZATION,
+  HDR_CONTENT_LENGTH,
+  HDR_CONTENT_TYPE,
+  HDR_CONTENT_ENCODING,
+  HDR_TRANSFER_ENCODING,
+  HDR_TE,
+  HDR_TRAILER,
+  HDR_UPGRADE,
+  HDR_VARY,
+  HDR_EXPIRES,
+  HDR_ETAG,
+  HDR_LAST_MODIFIED,
+  HDR_DATE,
+  HDR_KNOWN_COUNT
+} http_hdr_id;
+
+#define HTTP_MAX_HEADERS 100
+
+typedef struct {
+  http_slice line;    // "Name: value\r\n" 줄 전체. 그대로 전달할 때 쓴다
+  http_slice name;
+  http_slice value;   // 앞뒤 공백을 뺀 값
+  int id;             // http_hdr_id
+  int next;           // 같은 id를 가진 다음 헤더의 인덱스. 없으면 -1 (HDR_OTHER는 항상 -1)
+} http_hdr;
+
+typedef struct {
+  http_slice method, target, version;
+  http_hdr hdrs[HTTP_MAX_HEADERS];  // 받은 순서 그대로
+  int nhdrs;
+  int known[HDR_KNOWN_COUNT];       // id별 첫 헤더의 인덱스. 없으면 -1
+} http_request;
+
+typedef struct {
+  http_slice status_line;           // "HTTP/1.1 200 OK\r\n" 줄 전체
+  http_slice version, reason;
+  int status;
+  http_hdr hdrs[HTTP_MAX_HEADERS];
+  int nhdrs;
+  int known[HDR_KNOWN_COUNT];
+} http_response;
+
+// 응답 본문의 끝을 아는 방법 (http_body_framing)
+enum {
+  HTTP_BODY_NONE,     // 본문 없음 (1xx, 204, 304)
+  HTTP_BODY_LENGTH,   // Content-Length 바이트
+  HTTP_BODY_CHUNKED,  // 길이가 0인 chunk와 trailer까지
+  HTTP_BODY_EOF,      // origin이 연결을 닫을 때까지
+};
+
+void http_init(void);
+int http_parse_request(char *buf, int len, http_request *req);
+int http_parse_response(char *buf, int len, http_response *resp);
+int http_hdr_lookup(const char *name, int len);
+http_hdr *http_find(http_request *req, int id);
+http_hdr *http_resp_find(http_response *resp, int id);
+int http_header_value(http_request *req, char *name, char *value, int maxlen);
+int http_resp_header_value(http_response *resp, char *name, char *value, int maxlen);
+int http_has_token(http_slice s, const char *token);
+int http_body_framing(http_response *resp, long long *length);
+int http_keep_alive(http_response *resp);
+long long http_chunk_size(char *line, int len);
+int http_slice_eq(http_slice s, const char *str);
+int http_slice_cpy(char *dst, int size, http_slice s);
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,174 @@
+/*
+ * mem.c - memory accounting against a limit, with pressure-driven shrinking and shedding
+ *
+ * 샘플링 스레드가 mem_check_ms마다 사용량을 센다. 센 값(캐시 + arena + 스택)과 RSS 중 큰 쪽을
+ * 사용량으로 본다. 센 값은 malloc이 아직 OS에 안 돌려준 것이나 라이브러리가 쓰는 것을 모르고,
+ * RSS는 지금 막 돌려준 것을 조금 늦게 반영하기 때문이다.
+ * 단계(level)는 atomic 하나라서 accept 경로는 락 없이 읽는다.
+ */
+#include "mem.h"
+#include <malloc.h>
+#include "admit.h"
+#include "arena.h"
+#include "cache.h"
+#include "config.h"
+
+#define MEM_UNLIMITED (1LL << 50)   // cgroup이 한도 없음을 이보다 큰 수로 적는다
+
+static int level;                   // MEM_OK, MEM_SOFT, MEM_HARD. atomic
+static pthread_mutex_t mem_mutex = PTHREAD_MUTEX_INITIALIZER;  // 아래 stats
+
+static struct {
+  long long limit;                  // 0이면 한도 없음 (세기만 한다)
+  const char *source;               // 한도를 어디서 얻었는지
+  long long usage, rss, cache, arenas, stacks;  // 마지막 샘플
+  unsigned long long soft_entered;  // soft 이상으로 올라간 횟수
+  unsigned long long hard_entered;
+  long long cache_released;         // 압박 때문에 캐시에서 돌려준 바이트
+} stats;
+
+// path에 적힌 바이트 수. 없거나 "max"면 -1
+static long long read_limit(char *path) {
+  FILE *fp;
+  long long v = -1;
+
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
+  if (fscanf(fp, "%lld", &v) != 1 || v <= 0 || v >= MEM_UNLIMITED)
+    v = -1;
+  fclose(fp);
+  return v;
+}
+
+static void take_min(long long *limit, long long v) {
+  if (v > 0 && (*limit <= 0 || v < *limit))
+    *limit = v;
+}
+
+// 이 프로세스가 든 cgroup의 memory 한도 (v2의 memory.max, v1의 memory.limit_in_bytes). 없으면 0
+static long long cgroup_limit(void) {
+  char line[MAXLINE], path[MAXLINE + 64], *p;
+  long long limit = 0;
+  FILE *fp;
+
+  if ((fp = fopen("/proc/self/cgroup", "r")) != NULL) {
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      line[strcspn(line, "\n")] = '\0';
+      if (!strncmp(line, "0::", 3)) {
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.max", line + 3);
+        take_min(&limit, read_limit(path));
+      } else if ((p = strstr(line, ":memory:")) != NULL) {
+        snprintf(path, sizeof(path), "/sys/fs/cgroup/memory%s/memory.limit_in_bytes", p + 8);
+        take_min(&limit, read_limit(path));
+      }
+    }
+    fclose(fp);
+  }
+  // container 안에서는 자기 cgroup이 마운트의 뿌리로 보인다
+  take_min(&limit, read_limit("/sys/fs/cgroup/memory.max"));
+  take_min(&limit, read_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes"));
+  return limit;
+}
+
+static long long read_rss(void) {
+  long long size, resident = 0;
+  FILE *fp;
+
+  if ((fp = fopen("/proc/self/statm", "r")) == NULL)
+    return 0;
+  if (fscanf(fp, "%lld %lld", &size, &resident) != 2)
+    resident = 0;
+  fclose(fp);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 사용량을 세고 단계를 정한다. 한도에 다가갔으면 캐시와 빈 버퍼를 돌려준다
+static void mem_sample(void) {
+  long long cache = cache_memory(), arenas = arena_bytes();
+  long long stacks = (long long)admit_inflight() * conf.thread_stack_kb * 1024;
+  long long rss = read_rss(), usage, soft, hard, released = 0;
+  int old = __atomic_load_n(&level, __ATOMIC_RELAXED), now = MEM_OK;
+
+  usage = cache + arenas + stacks > rss ? cache + arenas + stacks : rss;
+  soft = stats.limit * conf.mem_soft_pct / 100;
+  hard = stats.limit * conf.mem_hard_pct / 100;
+  if (stats.limit > 0) {
+    if (usage >= hard)
+      now = MEM_HARD;
+    else if (usage >= soft || (old != MEM_OK && usage >= soft - stats.limit * MEM_HYSTERESIS_PCT / 100))
+      now = MEM_SOFT;
+  }
+  if (now != MEM_OK) {
+    // soft 아래(히스테리시스만큼 더)로 내려가는 데 모자란 만큼 캐시를 줄인다
+    arena_trim();
+    malloc_trim(0);
+    released = cache_shrink(cache - (usage - soft) - stats.limit * MEM_HYSTERESIS_PCT / 100);
+  }
+  __atomic_store_n(&level, now, __ATOMIC_RELAXED);
+
+  pthread_mutex_lock(&mem_mutex);
+  stats.usage = usage;
+  stats.rss = rss;
+  stats.cache = cache - released;
+  stats.arenas = arenas;
+  stats.stacks = stacks;
+  stats.cache_released += released;
+  if (now != MEM_OK && old == MEM_OK)
+    stats.soft_entered++;
+  if (now == MEM_HARD && old != MEM_HARD)
+    stats.hard_entered++;
+  pthread_mutex_unlock(&mem_mutex);
+
+  if (now != old)
+    fprintf(stderr, "memory: %s (usage %lld of limit %lld bytes)\n",
+            now == MEM_HARD ? "hard limit, refusing new connections" : now == MEM_SOFT ? "soft limit, shrinking" : "back to normal",
+            usage, stats.limit);
+}
+
+static void *mem_thread(void *vargp) {
+  for (;;) {
+    usleep(conf.mem_check_ms * 1000);
+    mem_sample();
+  }
+  return NULL;
+}
+
+/*
+ * mem_init - 한도를 정하고 샘플링 스레드를 띄운다. 캐시를 만든 다음 main에서 한 번 부른다
+ */
+void mem_init(void) {
+  pthread_t tid;
+
+  if (conf.mem_limit_mb > 0) {
+    stats.limit = (long long)conf.mem_limit_mb * 1024 * 1024;
+    stats.source = "option";
+  } else if ((stats.limit = cgroup_limit()) > 0) {
+    stats.source = "cgroup";
+  } else {
+    stats.limit = 0;
+    stats.source = "none";
+  }
+  if (conf.mem_check_ms <= 0)
+    conf.mem_check_ms = 100;
+  mem_sample();
+  Pthread_create(&tid, NULL, mem_thread, NULL);
+  Pthread_detach(tid);
+}
+
+/*
+ * mem_level - 마지막 샘플의 단계. MEM_OK, MEM_SOFT, MEM_HARD
+ */
+int mem_level(void) {
+  return __atomic_load_n(&level, __ATOMIC_RELAXED);
+}
+
+void mem_stats(FILE *fp) {
+  static const char *names[] = { "ok", "soft", "hard" };
+
+  pthread_mutex_lock(&mem_mutex);
+  fprintf(fp, "memory level %s limit %lld (%s) usage %lld rss %lld cache %lld arenas %lld stacks %lld "
+          "soft_entered %llu hard_entered %llu cache_released %lld\n",
+          names[mem_level()], stats.limit, stats.source, stats.usage, stats.rss, stats.cache, stats.arenas,
+          stats.stacks, stats.soft_entered, stats.hard_entered, stats.cache_released);
+  pthread_mutex_unlock(&mem_mutex);
+}
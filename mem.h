@@ -0,0 +1,26 @@
+/*
+ * mem.h - memory accounting against a limit, with pressure-driven shrinking and shedding
+ *
+ * 프록시는 자기가 메모리를 얼마나 쓰는지 몰라서, 부하가 몰리면 cgroup 한도를 넘고 OOM killer에
+ * 통째로 죽었다. 여기서는 캐시, 연결 버퍼(arena), 연결 스레드 스택을 한 곳에서 세고 RSS와 같이 본다.
+ * 한도(mem_limit_mb, 없으면 cgroup의 memory 한도)에 다가가면 단계별로 물러선다.
+ *   - soft (mem_soft_pct): 캐시의 차가운 slab과 빈 arena를 OS에 돌려주고, 새 응답은 캐시하지 않고,
+ *     max_inflight를 MEM_SOFT_INFLIGHT_PCT로 낮춘다
+ *   - hard (mem_hard_pct): 위에 더해 새 연결은 accept에서 바로 503으로 거절한다
+ * 처리 중인 연결은 끊지 않는다. 지금 사용량은 /proxy-status의 memory 줄에서 본다.
+ */
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include "csapp.h"
+
+enum { MEM_OK, MEM_SOFT, MEM_HARD };
+
+#define MEM_SOFT_INFLIGHT_PCT 50  // soft일 때 max_inflight를 이 비율로 낮춘다
+#define MEM_HYSTERESIS_PCT 5      // soft에서 벗어나려면 mem_soft_pct보다 이만큼(한도의 %) 더 내려가야 한다
+
+void mem_init(void);
+int mem_level(void);
+void mem_stats(FILE *fp);
+
+#endif /* __MEM_H__ */
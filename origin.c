@@ -0,0 +1,485 @@
+/*
+ * origin.c - per-origin state: idle keep-alive connections
+ *
+ * origin(host:port)마다 쉬고 있는 연결을 스택으로 들고 있다. 마지막에 돌려받은 연결부터
+ * 꺼내서, 오래 쉰 연결은 바닥에 남았다가 upstream_idle_ms가 지나면 닫힌다.
+ * 표는 neg_hosts처럼 작은 고정 크기이고 락 하나로 지킨다. 연결을 닫는 건 락 밖에서 한다.
+ * uds_map에 적힌 origin은 TCP 대신 그 경로의 Unix domain socket으로 연결한다(connect_endServer).
+ *
+ * origin마다 동시에 보내는 요청 수에 한도가 있다. 한도는 응답 헤드가 오기까지 걸린 시간으로 조정한다
+ * (Netflix concurrency-limits의 gradient 방식). 최근 latency가 평소(긴 평균)보다 크게 늘면
+ * 그 비율만큼 한도를 줄이고, 아니면 sqrt(한도)만큼 여유를 두고 천천히 늘린다. 연결이나 응답에 실패하면
+ * 한도를 10% 줄인다. 한도가 찬 origin으로 가는 요청은 origin_queue_ms까지 기다리다가 503으로 끝나므로,
+ * 느려진 origin 하나가 연결 스레드를 다 붙잡아서 다른 origin까지 느려지는 일이 없다.
+ *
+ * 죽었거나 에러만 내는 origin에는 circuit breaker가 있다. 연결 실패, 타임아웃, 5xx가 breaker_failures번
+ * 연달아 나거나 breaker_window_ms 동안의 실패 비율이 breaker_error_pct를 넘으면 연다(open).
+ * 열린 동안은 origin에 가지 않고 바로 503이다. breaker_cooldown_ms가 지나면 half-open이 되어 시험 요청
+ * 하나만 보내고, 그게 성공하면 닫고(closed) 실패하면 다시 연다.
+ */
+#include <netinet/tcp.h>
+#include "origin.h"
+#include "cache.h"
+#include "config.h"
+
+typedef struct {
+  int fd;
+  long long since;          // 풀에 들어온 시각
+} idle_conn;
+
+typedef struct {
+  char host[ORIGIN_HOST_MAX];   // ""이면 빈 자리
+  int port;
+  unsigned int hash;
+  long long last_used;
+  int nidle;
+  idle_conn idle[ORIGIN_IDLE_MAX];
+
+  /* concurrency limit */
+  int inflight;                 // 보내고 아직 끝나지 않은 요청. 0이 아니면 이 자리는 비우지 않는다
+  int waiting;                  // 한도가 차서 기다리는 요청
+  double limit;
+  double short_rtt;             // 최근 latency (us, 빠른 이동 평균)
+  double long_rtt;              // 평소 latency (us, 느린 이동 평균)
+  unsigned long long passed, queued, rejected;
+  pthread_cond_t cond;          // 자리가 나면 기다리는 요청 하나를 깨운다
+
+  /* circuit breaker */
+  int breaker;                  // BREAKER_CLOSED, BREAKER_OPEN, BREAKER_HALF_OPEN
+  int failures;                 // 연달아 실패한 요청
+  int probing;                  // half-open에서 보낸 시험 요청이 아직 안 끝났다
+  long long open_until;         // 열린 breaker가 half-open이 되는 시각
+  long long window_start;       // 실패 비율을 세는 구간의 시작
+  int window_requests, window_failures;
+  unsigned long long trips, short_circuited;
+} origin;
+
+enum { BREAKER_CLOSED, BREAKER_OPEN, BREAKER_HALF_OPEN };
+static const char *breaker_names[] = { "closed", "open", "half-open" };
+
+static origin origins[ORIGIN_SLOTS];
+static pthread_mutex_t origin_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// uds_map을 파싱한 것. 시작할 때 한 번 채우고 그 뒤로는 읽기만 한다
+static struct {
+  char host[ORIGIN_HOST_MAX];
+  int port;
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} uds[ORIGIN_UDS_MAX];
+static int nuds;
+
+static struct {
+  unsigned long long limited;   // 한도에 걸려 거절한 요청 (모든 origin)
+  unsigned long long tripped;   // circuit breaker를 연 횟수
+  unsigned long long broken;    // breaker가 열려 있어서 바로 거절한 요청
+  unsigned long long reused;    // 풀에서 꺼내 쓴 연결
+  unsigned long long missed;    // 풀이 비어서 새로 연결해야 했던 요청
+  unsigned long long stale;     // 꺼냈더니 origin이 이미 닫았거나 너무 오래 쉬어서 버린 연결
+  unsigned long long kept;      // 돌려받아 풀에 넣은 연결
+  unsigned long long dropped;   // 풀이 꽉 차서(또는 꺼져 있어서) 닫은 연결
+} stats;
+
+static unsigned int origin_hash(char *hostname, int port) {
+  unsigned int h = 2166136261u;
+
+  for (; *hostname; hostname++) {
+    h ^= (unsigned char)tolower((unsigned char)*hostname);
+    h *= 16777619u;
+  }
+  return h ^ (unsigned int)port;
+}
+
+// hostname:port의 자리. create가 1이면 없을 때 빈 자리나 가장 오래 안 쓴 자리를 내준다
+//   (그 자리에 있던 연결들은 *evicted로 넘겨서 락 밖에서 닫게 한다). 락을 잡고 부른다
+static origin *origin_lookup(char *hostname, int port, int create, idle_conn *evicted, int *nevicted) {
+  unsigned int hash = origin_hash(hostname, port);
+  origin *o, *victim = NULL;
+  int i;
+
+  for (i = 0; i < ORIGIN_SLOTS; i++) {
+    o = &origins[i];
+    if (o->host[0] != '\0' && o->hash == hash && o->port == port && !strcasecmp(o->host, hostname))
+      return o;
+    if (o->inflight > 0 || o->waiting > 0)
+      continue;   // 요청이 오가는 중인 자리는 비우지 않는다
+    if (victim == NULL || (victim->host[0] != '\0' && (o->host[0] == '\0' || o->last_used < victim->last_used)))
+      victim = o;
+  }
+  if (!create || victim == NULL || strlen(hostname) >= ORIGIN_HOST_MAX)
+    return NULL;
+  memcpy(evicted, victim->idle, victim->nidle * sizeof(idle_conn));
+  *nevicted = victim->nidle;
+  strcpy(victim->host, hostname);
+  victim->port = port;
+  victim->hash = hash;
+  victim->nidle = 0;
+  victim->limit = conf.origin_limit_init;
+  victim->short_rtt = victim->long_rtt = 0;
+  victim->passed = victim->queued = victim->rejected = 0;
+  victim->breaker = BREAKER_CLOSED;
+  victim->failures = victim->probing = 0;
+  victim->window_start = victim->window_requests = victim->window_failures = 0;
+  victim->trips = victim->short_circuited = 0;
+  return victim;
+}
+
+/*
+ * origin_init - uds_map("host:port=/path,host:port=/path")을 읽는다. 다른 스레드가 시작하기 전에
+ *   main에서 한 번 부른다. 형식이 잘못됐으면 stderr에 알리고 -1
+ */
+int origin_init(void) {
+  char map[MAXLINE], *item, *save, *eq, *colon, *end;
+  long port;
+  pthread_condattr_t attr;
+  int i;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  for (i = 0; i < ORIGIN_SLOTS; i++)
+    pthread_cond_init(&origins[i].cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  nuds = 0;
+  strcpy(map, conf.uds_map);
+  for (item = strtok_r(map, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    if ((eq = strchr(item, '=')) != NULL)
+      for (colon = eq; colon > item && *colon != ':'; colon--)
+        ;
+    if (eq == NULL || colon == item || eq[1] != '/') {
+      fprintf(stderr, "uds_map: expected host:port=/path, got \"%s\"\n", item);
+      return -1;
+    }
+    port = strtol(colon + 1, &end, 10);
+    if (end != eq || port <= 0 || port > 65535) {
+      fprintf(stderr, "uds_map: bad port in \"%s\"\n", item);
+      return -1;
+    }
+    if (nuds == ORIGIN_UDS_MAX || colon - item >= ORIGIN_HOST_MAX || strlen(eq + 1) >= sizeof(uds[0].path)) {
+      fprintf(stderr, "uds_map: too many entries or name too long at \"%s\"\n", item);
+      return -1;
+    }
+    memcpy(uds[nuds].host, item, colon - item);
+    uds[nuds].host[colon - item] = '\0';
+    uds[nuds].port = port;
+    strcpy(uds[nuds].path, eq + 1);
+    nuds++;
+  }
+  return 0;
+}
+
+/*
+ * origin_uds_path - hostname:port를 Unix domain socket으로 연결해야 하면 그 경로, 아니면 NULL
+ */
+char *origin_uds_path(char *hostname, int port) {
+  int i;
+
+  for (i = 0; i < nuds; i++)
+    if (uds[i].port == port && !strcasecmp(uds[i].host, hostname))
+      return uds[i].path;
+  return NULL;
+}
+
+// 쉬는 동안 origin이 연결을 닫았거나 뭔가 보냈으면(다음 응답과 섞인다) 다시 쓸 수 없다
+static int conn_alive(int fd) {
+  char c;
+  ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ * origin_get - hostname:port로 열려 있는 쉬는 연결 하나. 없으면 -1 (새로 연결해야 한다)
+ */
+int origin_get(char *hostname, int port) {
+  idle_conn c, stale[ORIGIN_IDLE_MAX];
+  int nstale = 0, fd = -1, i;
+  long long now = now_ms();
+  origin *o;
+
+  if (conf.upstream_keepalive <= 0)
+    return -1;
+  pthread_mutex_lock(&origin_mutex);
+  if ((o = origin_lookup(hostname, port, 0, NULL, NULL)) != NULL) {
+    o->last_used = now;
+    while (o->nidle > 0) {
+      c = o->idle[--o->nidle];
+      if (now - c.since <= conf.upstream_idle_ms) {
+        fd = c.fd;
+        break;
+      }
+      // 가장 최근에 돌려받은 것도 너무 오래 쉬었으면 나머지는 더 오래됐다
+      stale[nstale++] = c;
+      for (i = 0; i < o->nidle; i++)
+        stale[nstale++] = o->idle[i];
+      o->nidle = 0;
+    }
+  }
+  pthread_mutex_unlock(&origin_mutex);
+
+  if (fd >= 0 && !conn_alive(fd)) {
+    stale[nstale++].fd = fd;
+    fd = -1;
+  }
+  for (i = 0; i < nstale; i++)
+    close(stale[i].fd);
+
+  pthread_mutex_lock(&origin_mutex);
+  stats.stale += nstale;
+  if (fd >= 0)
+    stats.reused++;
+  else
+    stats.missed++;
+  pthread_mutex_unlock(&origin_mutex);
+  return fd;
+}
+
+/*
+ * origin_quickack - 다시 쓰는 연결에 요청을 보낸 직후에 부른다.
+ *   주고받기를 한 연결은 delayed ACK 상태라서, origin이 헤더와 본문을 따로 쓰면 origin의 Nagle과 맞물려
+ *   응답마다 40ms씩 멈춘다. 요청을 보내면 다시 delayed ACK로 돌아가므로 보낸 뒤에 켠다
+ */
+void origin_quickack(int fd) {
+#ifdef TCP_QUICKACK
+  int one = 1;
+
+  setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+#endif
+}
+
+// breaker가 이 요청을 보내게 해 주는지. 쿨다운이 끝난 breaker는 여기서 half-open이 된다. 락을 잡고 부른다
+static int breaker_allow(origin *o, long long now) {
+  if (o->breaker == BREAKER_OPEN && now >= o->open_until) {
+    o->breaker = BREAKER_HALF_OPEN;
+    o->probing = 0;
+  }
+  return o->breaker == BREAKER_CLOSED || (o->breaker == BREAKER_HALF_OPEN && !o->probing);
+}
+
+static void breaker_trip(origin *o, long long now) {
+  o->breaker = BREAKER_OPEN;
+  o->open_until = now + conf.breaker_cooldown_ms;
+  o->failures = o->probing = 0;
+  o->window_start = now;
+  o->window_requests = o->window_failures = 0;
+  o->trips++;
+  stats.tripped++;
+}
+
+// 끝난 요청 하나를 breaker에 센다. 락을 잡고 부른다
+static void breaker_record(origin *o, int ok, long long now) {
+  if (conf.breaker_failures <= 0 && conf.breaker_error_pct <= 0)
+    return;
+  if (o->breaker == BREAKER_HALF_OPEN) {
+    // 시험 요청의 결과 (열리기 전에 보낸 요청이 이제 끝났어도 origin이 어떤지 알려 주는 건 같다)
+    if (!ok) {
+      breaker_trip(o, now);
+    } else {
+      o->breaker = BREAKER_CLOSED;
+      o->failures = o->probing = 0;
+    }
+    return;
+  }
+  if (o->breaker == BREAKER_OPEN)
+    return;   // 열리기 전에 보낸 요청이 이제 끝났다
+  if (now - o->window_start > conf.breaker_window_ms) {
+    o->window_start = now;
+    o->window_requests = o->window_failures = 0;
+  }
+  o->window_requests++;
+  if (ok) {
+    o->failures = 0;
+    return;
+  }
+  o->failures++;
+  o->window_failures++;
+  if ((conf.breaker_failures > 0 && o->failures >= conf.breaker_failures) ||
+      (conf.breaker_error_pct > 0 && o->window_requests >= BREAKER_MIN_REQUESTS &&
+       o->window_failures * 100 >= conf.breaker_error_pct * o->window_requests))
+    breaker_trip(o, now);
+}
+
+/*
+ * origin_open - hostname:port의 circuit breaker가 열려 있고 쿨다운이 아직 남았는지. 자리를 잡지 않고
+ *   보기만 하므로 줄 서기 전에 부른다. 열려 있으면 origin_acquire의 ORIGIN_OPEN처럼 센다
+ */
+int origin_open(char *hostname, int port) {
+  int open = 0;
+  origin *o;
+
+  pthread_mutex_lock(&origin_mutex);
+  if ((o = origin_lookup(hostname, port, 0, NULL, NULL)) != NULL && o->breaker == BREAKER_OPEN &&
+      now_ms() < o->open_until) {
+    o->short_circuited++;
+    stats.broken++;
+    open = 1;
+  }
+  pthread_mutex_unlock(&origin_mutex);
+  return open;
+}
+
+/*
+ * origin_acquire - hostname:port로 요청 하나를 보내도 되는지. 보내도 되면 자리 번호(>= 0)를 리턴하고,
+ *   끝나면 origin_release로 돌려줘야 한다. circuit breaker가 열려 있으면 ORIGIN_OPEN. 한도가 찼으면
+ *   origin_queue_ms까지 기다리고, 그래도 자리가 없으면 ORIGIN_BUSY. 표가 요청 중인 origin으로 꽉 찼으면
+ *   ORIGIN_UNLIMITED (돌려줄 것 없음)
+ */
+int origin_acquire(char *hostname, int port) {
+  idle_conn evicted[ORIGIN_IDLE_MAX];
+  int nevicted = 0, slot = ORIGIN_UNLIMITED, limited = conf.origin_limit_max > 0, i;
+  struct timespec until;
+  long long now = now_ms();
+  origin *o;
+
+  clock_gettime(CLOCK_MONOTONIC, &until);
+  until.tv_sec += conf.origin_queue_ms / 1000;
+  until.tv_nsec += (conf.origin_queue_ms % 1000) * 1000000L;
+  if (until.tv_nsec >= 1000000000L) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&origin_mutex);
+  if ((o = origin_lookup(hostname, port, 1, evicted, &nevicted)) != NULL) {
+    o->last_used = now;
+    if (!breaker_allow(o, now)) {
+      o->short_circuited++;
+      stats.broken++;
+      slot = ORIGIN_OPEN;
+    } else {
+      if (limited && o->inflight >= (int)o->limit && o->waiting < ORIGIN_QUEUE_MAX && conf.origin_queue_ms > 0) {
+        o->waiting++;
+        o->queued++;
+        while (o->inflight >= (int)o->limit)
+          if (pthread_cond_timedwait(&o->cond, &origin_mutex, &until) == ETIMEDOUT)
+            break;
+        o->waiting--;
+      }
+      if (!limited || o->inflight < (int)o->limit) {
+        // 한도를 꺼 두었어도 자리는 준다 (breaker가 결과를 세고, 요청 중인 자리는 비우지 않는다)
+        o->inflight++;
+        o->passed++;
+        if (o->breaker == BREAKER_HALF_OPEN)
+          o->probing = 1;
+        slot = o - origins;
+      } else {
+        o->rejected++;
+        stats.limited++;
+        slot = ORIGIN_BUSY;
+      }
+    }
+  }
+  stats.dropped += nevicted;
+  pthread_mutex_unlock(&origin_mutex);
+
+  for (i = 0; i < nevicted; i++)
+    close(evicted[i].fd);
+  return slot;
+}
+
+/*
+ * limit_update - 끝난 요청 하나로 한도를 고친다. rtt_us는 응답 헤드가 오기까지 걸린 시간,
+ *   ok가 0이면 연결이나 응답에 실패했다. 락을 잡고 부른다
+ */
+static void limit_update(origin *o, long long rtt_us, int ok) {
+  double gradient, newlimit;
+
+  if (!ok) {
+    o->limit *= 0.9;
+  } else {
+    if (o->long_rtt == 0)
+      o->short_rtt = o->long_rtt = rtt_us;
+    o->short_rtt += (rtt_us - o->short_rtt) / 10;
+    o->long_rtt += (rtt_us - o->long_rtt) / 500;
+    // 평소보다 많이 느려진 뒤 그게 평소가 되면(긴 평균이 최근보다 두 배 넘게 크면) 빨리 따라 내려간다
+    if (o->long_rtt > 2 * o->short_rtt)
+      o->long_rtt *= 0.95;
+    // 한도의 절반도 안 쓰고 있으면 latency가 좋아도 늘리지 않는다 (실제로 필요한 것보다 커지지 않게)
+    if (o->inflight * 2 < o->limit && o->short_rtt <= 1.5 * o->long_rtt)
+      return;
+    gradient = 1.5 * o->long_rtt / o->short_rtt;  // latency가 1.5배까지 느는 것은 봐준다
+    if (gradient > 1.0)
+      gradient = 1.0;
+    if (gradient < 0.5)
+      gradient = 0.5;
+    newlimit = o->limit * gradient + sqrt(o->limit);
+    o->limit = o->limit * 0.8 + newlimit * 0.2;
+  }
+  if (o->limit > conf.origin_limit_max)
+    o->limit = conf.origin_limit_max;
+  if (o->limit < 1)
+    o->limit = 1;
+}
+
+/*
+ * origin_release - origin_acquire로 받은 자리를 돌려준다. 요청이 끝난 뒤(본문까지 주고받은 뒤)에 부른다.
+ *   result는 ORIGIN_OK, ORIGIN_5XX, ORIGIN_FAILED
+ */
+void origin_release(int slot, long long rtt_us, int result) {
+  origin *o;
+
+  if (slot < 0)
+    return;
+  o = &origins[slot];
+  pthread_mutex_lock(&origin_mutex);
+  if (conf.origin_limit_max > 0)
+    limit_update(o, rtt_us, result != ORIGIN_FAILED);
+  breaker_record(o, result == ORIGIN_OK, now_ms());
+  o->inflight--;
+  if (o->waiting > 0)
+    pthread_cond_signal(&o->cond);
+  pthread_mutex_unlock(&origin_mutex);
+}
+
+/*
+ * origin_put - 응답을 끝까지 읽은 연결을 hostname:port의 풀에 돌려준다. 자리가 없으면 닫는다
+ */
+void origin_put(char *hostname, int port, int fd) {
+  idle_conn evicted[ORIGIN_IDLE_MAX];
+  int nevicted = 0, max = conf.upstream_keepalive, i;
+  origin *o;
+
+  if (max > ORIGIN_IDLE_MAX)
+    max = ORIGIN_IDLE_MAX;
+  pthread_mutex_lock(&origin_mutex);
+  if (max > 0 && (o = origin_lookup(hostname, port, 1, evicted, &nevicted)) != NULL && o->nidle < max) {
+    o->idle[o->nidle].fd = fd;
+    o->idle[o->nidle].since = o->last_used = now_ms();
+    o->nidle++;
+    stats.kept++;
+    fd = -1;
+  } else {
+    stats.dropped++;
+  }
+  stats.dropped += nevicted;
+  pthread_mutex_unlock(&origin_mutex);
+
+  if (fd >= 0)
+    close(fd);
+  for (i = 0; i < nevicted; i++)
+    close(evicted[i].fd);
+}
+
+void origin_stats(FILE *fp) {
+  int i, origins_used = 0, idle = 0;
+
+  pthread_mutex_lock(&origin_mutex);
+  for (i = 0; i < ORIGIN_SLOTS; i++) {
+    if (origins[i].host[0] != '\0') {
+      origins_used++;
+      idle += origins[i].nidle;
+    }
+  }
+  fprintf(fp, "upstream origins %d idle %d reused %llu missed %llu stale %llu kept %llu dropped %llu limited %llu "
+          "breaker_trips %llu breaker_rejected %llu\n", origins_used, idle, stats.reused, stats.missed, stats.stale,
+          stats.kept, stats.dropped, stats.limited, stats.tripped, stats.broken);
+  for (i = 0; i < ORIGIN_SLOTS; i++) {
+    origin *o = &origins[i];
+    if (o->host[0] == '\0' || o->passed + o->rejected + o->short_circuited == 0)
+      continue;
+    fprintf(fp, "origin %s:%d limit %.1f inflight %d waiting %d rtt_ms %.2f/%.2f passed %llu queued %llu rejected %llu "
+            "breaker %s failures %d trips %llu short_circuited %llu\n",
+            o->host, o->port, o->limit, o->inflight, o->waiting, o->short_rtt / 1000, o->long_rtt / 1000,
+            o->passed, o->queued, o->rejected, breaker_names[o->breaker], o->failures, o->trips, o->short_circuited);
+  }
+  pthread_mutex_unlock(&origin_mutex);
+}
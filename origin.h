@@ -0,0 +1,43 @@
+/*
+ * origin.h - per-origin state: idle keep-alive connections, Unix socket addresses
+ *
+ * 응답 본문의 끝을 정확히 알게 되면(Content-Length/chunked) origin 연결을 닫지 않고
+ * 여기 돌려줬다가 같은 origin으로 가는 다음 요청이 다시 쓴다. connect 왕복과
+ * origin이 연결을 닫는 시간을 요청마다 내지 않아도 된다.
+ * 같은 호스트에서 도는 origin은 uds_map으로 Unix domain socket 경로에 연결할 수 있다.
+ * origin마다 동시에 보내는 요청 수는 latency를 보고 조정하는 한도 안으로 제한한다.
+ * 계속 실패하는 origin은 circuit breaker를 열어 잠깐 보내지 않는다.
+ */
+#ifndef __ORIGIN_H__
+#define __ORIGIN_H__
+
+#include "csapp.h"
+
+#define ORIGIN_SLOTS 64         // 상태를 들고 있는 origin 수. 넘치면 가장 오래 안 쓴 origin을 비운다
+#define ORIGIN_IDLE_MAX 32      // origin마다 열어 두는 연결 수의 상한 (upstream_keepalive는 이 안에서)
+#define ORIGIN_HOST_MAX 256
+#define ORIGIN_UDS_MAX 16       // uds_map에 적을 수 있는 origin 수
+#define ORIGIN_QUEUE_MAX 64     // origin마다 한도가 풀리기를 기다릴 수 있는 요청 수
+#define BREAKER_MIN_REQUESTS 20 // 구간 안에 요청이 이보다 적으면 실패 비율로는 열지 않는다
+
+// origin_acquire가 자리 번호 대신 돌려주는 것
+#define ORIGIN_UNLIMITED -1     // 한도 없이 보낸다 (origin_release에 넘겨도 된다)
+#define ORIGIN_BUSY -2          // 한도가 차서 기다려도 자리가 나지 않았다
+#define ORIGIN_OPEN -3          // circuit breaker가 열려 있다 (또는 시험 요청이 이미 나가 있다)
+
+// origin_release에 넘기는 요청 결과
+#define ORIGIN_OK 0
+#define ORIGIN_5XX 1            // 응답은 왔지만 5xx. circuit breaker만 실패로 센다
+#define ORIGIN_FAILED 2         // 연결, 응답 헤드, 본문 중 하나가 실패했다. 한도도 줄인다
+
+int origin_init(void);
+char *origin_uds_path(char *hostname, int port);
+int origin_open(char *hostname, int port);
+int origin_acquire(char *hostname, int port);
+void origin_release(int slot, long long rtt_us, int result);
+int origin_get(char *hostname, int port);
+void origin_put(char *hostname, int port, int fd);
+void origin_quickack(int fd);
+void origin_stats(FILE *fp);
+
+#endif /* __ORIGIN_H__ */
@@ -0,0 +1,136 @@
+/*
+ * outbuf.c - per-connection output buffer for the client side
+ *
+ * flush는 세 가지 경우에만 한다.
+ *   - 버퍼가 넘칠 때: 응답이 더 이어지므로 TCP_CORK를 걸고 보낸다. 커널이 꽉 찬 segment로 묶는다
+ *   - origin이 느릴 때(outbuf_idle): 다음 origin read가 기다려야 하면 모아 둔 것을 지금 보낸다.
+ *     cork를 풀고, Nagle에 걸리지 않게 TCP_NODELAY를 켠다
+ *   - 응답 끝(outbuf_end): 남은 것을 보내고 cork를 푼다
+ * 버퍼 하나에 들어가는 응답은 setsockopt 없이 write 한 번으로 끝난다.
+ */
+#include <netinet/tcp.h>
+#include "outbuf.h"
+
+static struct {
+  unsigned long long responses;
+  unsigned long long writes;        // write/writev 호출 수
+  unsigned long long bytes;
+  unsigned long long corks;         // TCP_CORK를 건 응답 수
+  unsigned long long idle_flushes;  // origin을 기다리느라 일찍 보낸 횟수
+} stats;
+
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (n), __ATOMIC_RELAXED)
+
+static void set_tcp_opt(int fd, int opt, int on) {
+  setsockopt(fd, IPPROTO_TCP, opt, &on, sizeof(on));
+}
+
+static void cork(outbuf *ob, int on) {
+#ifdef TCP_CORK
+  if (ob->corked == on || ob->err)
+    return;
+  set_tcp_opt(ob->fd, TCP_CORK, on);
+  ob->corked = on;
+  if (on)
+    STAT_ADD(corks, 1);
+#endif
+}
+
+// 버퍼에 모인 것과 (있으면) extra를 writev 한 번으로 보내고 버퍼를 비운다
+static void send_out(outbuf *ob, const void *extra, size_t n) {
+  struct iovec iov[2];
+  int cnt = 0;
+
+  if (ob->len > 0) {
+    iov[cnt].iov_base = ob->buf;
+    iov[cnt++].iov_len = ob->len;
+  }
+  if (n > 0) {
+    iov[cnt].iov_base = (void *)extra;
+    iov[cnt++].iov_len = n;
+  }
+  if (cnt > 0 && !ob->err) {
+    if (rio_writev(ob->fd, iov, cnt) < 0)
+      ob->err = 1;
+    STAT_ADD(writes, 1);
+    STAT_ADD(bytes, ob->len + n);
+  }
+  ob->len = 0;
+}
+
+void outbuf_init(outbuf *ob, int fd, char *buf, int cap) {
+  ob->fd = fd;
+  ob->buf = buf;
+  ob->len = 0;
+  ob->cap = cap;
+  ob->corked = 0;
+  ob->nodelay = 0;
+  ob->err = 0;
+}
+
+/*
+ * outbuf_write - p[0..n)을 보낼 것에 더한다. 버퍼가 넘치면 보내고, 버퍼보다 큰 조각은
+ *   복사하지 않고 버퍼와 같이 writev로 보낸다
+ */
+void outbuf_write(outbuf *ob, const void *p, size_t n) {
+  size_t room = ob->cap - ob->len;
+
+  if (n <= room) {
+    memcpy(ob->buf + ob->len, p, n);
+    ob->len += n;
+    return;
+  }
+  cork(ob, 1);
+  if (n >= (size_t)ob->cap) {
+    send_out(ob, p, n);
+    return;
+  }
+  memcpy(ob->buf + ob->len, p, room);
+  ob->len = ob->cap;
+  send_out(ob, NULL, 0);
+  memcpy(ob->buf, (const char *)p + room, n - room);
+  ob->len = n - room;
+}
+
+void outbuf_writev(outbuf *ob, struct iovec *iov, int iovcnt) {
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    outbuf_write(ob, iov[i].iov_base, iov[i].iov_len);
+}
+
+/*
+ * outbuf_idle - 다음 origin read가 기다려야 할 때 부른다. 클라이언트가 그동안 놀지 않게 지금 보낸다
+ */
+void outbuf_idle(outbuf *ob) {
+  if (ob->len == 0)
+    return;
+  if (!ob->nodelay && !ob->err) {
+    set_tcp_opt(ob->fd, TCP_NODELAY, 1);
+    ob->nodelay = 1;
+  }
+  cork(ob, 0);
+  send_out(ob, NULL, 0);
+  STAT_ADD(idle_flushes, 1);
+}
+
+/*
+ * outbuf_end - 응답 끝. 남은 것을 보내고 cork를 푼다. 쓰기에 실패한 적이 있으면 -1
+ */
+int outbuf_end(outbuf *ob) {
+  send_out(ob, NULL, 0);
+  cork(ob, 0);
+  STAT_ADD(responses, 1);
+  return ob->err ? -1 : 0;
+}
+
+void outbuf_stats(FILE *fp) {
+  unsigned long long responses = __atomic_load_n(&stats.responses, __ATOMIC_RELAXED);
+  unsigned long long writes = __atomic_load_n(&stats.writes, __ATOMIC_RELAXED);
+
+  fprintf(fp, "client responses %llu writes %llu (%.2f/response) bytes %llu corked %llu idle_flushes %llu\n",
+          responses, writes, responses ? (double)writes / responses : 0.0,
+          __atomic_load_n(&stats.bytes, __ATOMIC_RELAXED),
+          __atomic_load_n(&stats.corks, __ATOMIC_RELAXED),
+          __atomic_load_n(&stats.idle_flushes, __ATOMIC_RELAXED));
+}
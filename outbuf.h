@@ -0,0 +1,32 @@
+/*
+ * outbuf.h - per-connection output buffer for the client side
+ *
+ * 응답 헤드와 본문 조각들을 바로 write하지 않고 모았다가 한 번에 보낸다.
+ * 응답이 버퍼 하나에 들어가면 write 한 번으로 끝나고, 더 크면 TCP_CORK를 걸어서
+ * 중간 flush들이 꽉 찬 segment로 나가게 하고 응답 끝에서 푼다.
+ */
+#ifndef __OUTBUF_H__
+#define __OUTBUF_H__
+
+#include "csapp.h"
+
+#define OUTBUF_SIZE (16 * 1024)
+
+typedef struct {
+  int fd;
+  char *buf;
+  int len;
+  int cap;
+  int corked;       // TCP_CORK를 걸어 둔 상태인지
+  int nodelay;      // TCP_NODELAY를 켰는지 (idle flush가 처음 일어날 때 켠다)
+  int err;          // 쓰기에 한 번 실패하면(클라이언트가 끊었으면) 이후 쓰기는 버린다
+} outbuf;
+
+void outbuf_init(outbuf *ob, int fd, char *buf, int cap);
+void outbuf_write(outbuf *ob, const void *p, size_t n);
+void outbuf_writev(outbuf *ob, struct iovec *iov, int iovcnt);
+void outbuf_idle(outbuf *ob);
+int outbuf_end(outbuf *ob);
+void outbuf_stats(FILE *fp);
+
+#endif /* __OUTBUF_H__ */
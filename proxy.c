@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include "csapp.h"
+#include "uri.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
@@ -30,6 +31,10 @@ void parse_uri(char *uri, char *hostname, char *path, int *port);
 void build_http_header(char *http_header, char *hostname, char *path, int port, rio_t *client_rio);
 int connect_endServer(char *hostname, int port, char *http_header);
 void *thread(void *vargsp);
+void conn_error(char *msg);
+
+// 연결 하나에서 난 I/O 에러 수. 에러가 나면 그 연결만 정리하고 끝내며 프록시는 계속 돈다
+static unsigned long conn_errors;
 
 int main(int argc, char **argv) {
   int listenfd, *connfd;
@@ -48,6 +53,7 @@ int main(int argc, char **argv) {
   // listenfd에 듣기 식별자 리턴
   // 프록시가 서버가 하는 것처럼 듣기 소켓을 만들기
   listenfd = Open_listenfd(argv[1]);
+  Signal(SIGPIPE, SIG_IGN);   // 클라이언트가 끊은 소켓에 쓰면 SIGPIPE로 프로세스가 죽는 대신 EPIPE를 받는다
   while (1) {
     clientlen = sizeof(clientaddr);   // 클라이언트 주소 길이
 
@@ -59,27 +65,52 @@ int main(int argc, char **argv) {
     // 단지 변수로 선언하면 여러 쓰레드가 참조하는 connfd는 하나가 되지만
     // 동적 할당을 하게 되면 여러 쓰레드가 참조하는 connfd는 서로 다른 변수가 된다.
 
-    connfd = Malloc(sizeof(int));     // 피어 스레드 분리 시 경쟁 상태를 피하기 위한 동적 할당.
-    *connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);   // listenfd와 clientaddr를 합쳐서 connfd 만들기. 연결 요청 접수
+    // 대문자 wrapper(Accept, Malloc, ...)는 실패하면 프로세스를 끝내므로 여기서는 직접 부르고 그 연결만 버린다
+    int fd = accept(listenfd, (SA *)&clientaddr, &clientlen);   // listenfd와 clientaddr를 합쳐서 connfd 만들기. 연결 요청 접수
+    if (fd < 0) {
+      conn_error("accept");
+      continue;
+    }
+    if ((connfd = malloc(sizeof(int))) == NULL) {   // 피어 스레드 분리 시 경쟁 상태를 피하기 위한 동적 할당.
+      conn_error("malloc");
+      close(fd);
+      continue;
+    }
+    *connfd = fd;
 
     /* print accepted message */
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0); // 소켓 구조체를 호스트의 서비스들(문자열)로 변환
+    // 소켓 구조체를 숫자 주소/포트 문자열로 변환 (역방향 DNS를 기다리지 않고, 실패해도 연결은 받는다)
+    if (getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+      strcpy(hostname, "?");
+      strcpy(port, "?");
+    }
     printf("Accepted connection from (%s %s).\n", hostname, port);
 
-    Pthread_create(&tid, NULL, thread, (void *)connfd);   // 프로세스 내에서 쓰레드 만들기
+    if (pthread_create(&tid, NULL, thread, (void *)connfd) != 0) {   // 프로세스 내에서 쓰레드 만들기
+      conn_error("pthread_create");
+      close(fd);
+      free(connfd);
+    }
   }
   return 0;
 }
 
 void *thread(void *vargs) {
   int connfd = *((int *)vargs);
-  Pthread_detach(pthread_self());   // 연결 가능한 스레드 tid 분리. pthread_self()를 인자로 넣으면 자신을 분리
-  Free(vargs);
+  pthread_detach(pthread_self());   // 연결 가능한 스레드 tid 분리. pthread_self()를 인자로 넣으면 자신을 분리
+  free(vargs);
   doit(connfd);
-  Close(connfd);
+  close(connfd);
   return NULL;
 }
 
+// 연결 하나에서 난 에러를 세고 알린다. errno는 실패한 호출의 것
+void conn_error(char *msg) {
+  unsigned long n = __atomic_add_fetch(&conn_errors, 1, __ATOMIC_RELAXED);
+
+  fprintf(stderr, "%s: %s (%lu connection errors so far)\n", msg, strerror(errno), n);
+}
+
 
 /* handle the client HTTP transaction */
 void doit(int connfd) {
@@ -94,7 +125,13 @@ void doit(int connfd) {
 // rio의 장점? EOF를 만났을 때만 short count가 나옴을 보장함. short count : 원하는 만큼 읽겠다고 했는데 다 못 읽는 경우에 발생.
   rio_t rio, server_rio;  /* rio is client's rio, server_rio is endserver's rio */
   Rio_readinitb(&rio, connfd);    // 읽기 버퍼 초기화. rio_t 타입의 읽기 버퍼와 식별자 connfd 연결
-  Rio_readlineb(&rio, buf, MAXLINE);  // 클라이언트가 보낸 요청 라인을 읽고 분석. buf에 복사
+  // 클라이언트가 보낸 요청 라인을 읽고 분석. buf에 복사. 요청 없이 끊었거나 읽다가 에러가 나면 이 연결만 끝낸다
+  ssize_t n = rio_readlineb(&rio, buf, MAXLINE);
+  if (n <= 0) {
+    if (n < 0)
+      conn_error("read request");
+    return;
+  }
   sscanf(buf, "%s %s %s", method, uri, version);  /* read the client request line */  // 문자열에서 형식화된 데이터 읽어와서 각 변수에 맵핑
 
   if (strcasecmp(method, "GET")) {    // GET이 아니면 처리하지 않음
@@ -122,25 +159,35 @@ void doit(int connfd) {
 
   Rio_readinitb(&server_rio, end_serverfd); // 서버의 읽기 버퍼 초기화. rio_t 타입의 읽기 버퍼와 식별자 fd 연결
   /* write the http header to endserver */
-  Rio_writen(end_serverfd, endserver_http_header, strlen(endserver_http_header)); // 아까 만든 http 헤더를 fd에 write
+  // 아까 만든 http 헤더를 fd에 write
+  if (rio_writen(end_serverfd, endserver_http_header, strlen(endserver_http_header)) < 0) {
+    conn_error("write to server");
+    close(end_serverfd);
+    return;
+  }
 
   /* receive message from end server and send to client */
-  // 최종 서버로부터 메시지 수신 후 클라이언트에게 전송
-  size_t n;   // 버퍼에다 쓴 내용의 바이트 크기
-  while ((n = Rio_readlineb(&server_rio, buf, MAXLINE)) != 0) {   // server_rio에 있는 내용들을 모두 한줄씩 읽으면서 buf에 복사하고 connfd에 write
+  // 최종 서버로부터 메시지 수신 후 클라이언트에게 전송. 어느 쪽이든 에러가 나면 두 소켓을 정리하고 끝낸다
+  // server_rio에 있는 내용들을 모두 한줄씩 읽으면서 buf에 복사하고 connfd에 write
+  while ((n = rio_readlineb(&server_rio, buf, MAXLINE)) > 0) {
     printf("proxy received %ld bytes, then send\n", n);
-    Rio_writen(connfd, buf, n);   // 서버에게서 받은 메시지를 클라이언트에게 줄 connfd에 write
+    if (rio_writen(connfd, buf, n) < 0) {   // 서버에게서 받은 메시지를 클라이언트에게 줄 connfd에 write
+      conn_error("write to client");
+      break;
+    }
   }
-  Close(end_serverfd);    // 식별자 다 썼으니 Close
+  if (n < 0)
+    conn_error("read from server");
+  close(end_serverfd);    // 식별자 다 썼으니 close
 }
 
 // 헤더, 호스트 이름, 경로, 포트, 읽기 버퍼(현재 클라이언트의 요청이 들어와있음)
 void build_http_header(char *http_header, char *hostname, char *path, int port, rio_t *client_rio) {
-  char buf[MAXLINE], request_hdr[MAXLINE], other_hdr[MAXLINE], host_hdr[MAXLINE];
+  char buf[MAXLINE], request_hdr[MAXLINE], other_hdr[MAXLINE] = "", host_hdr[MAXLINE] = "";
   /* request lint */
   sprintf(request_hdr, requestlint_hdr_format, path); // request_hdr에 "GET %s HTTP/1.0\r\n" 이 폼으로 경로 넣어서 저장
   /* get other request header for client rio and change it */
-  while (Rio_readlineb(client_rio, buf, MAXLINE) > 0) {   // 읽기에 성공한 경우.  client_rio : 아까 가져온 클라이언트의 읽기 버퍼. buf에 옮겨쓰기
+  while (rio_readlineb(client_rio, buf, MAXLINE) > 0) {   // 읽기에 성공한 경우.  client_rio : 아까 가져온 클라이언트의 읽기 버퍼. buf에 옮겨쓰기
     if (strcmp(buf, endof_hdr) == 0)  /* EOF */   // 종료 조건
       break;
 
@@ -171,31 +218,22 @@ void build_http_header(char *http_header, char *hostname, char *path, int port,
 inline int connect_endServer(char *hostname, int port, char *http_header) {
   char portStr[100];
   sprintf(portStr, "%d", port);
-  return Open_clientfd(hostname, portStr);  // 클라이언트 입장에서 fd 열기. 서버와 연결 설정
+  return open_clientfd(hostname, portStr);  // 클라이언트 입장에서 fd 열기. 서버와 연결 설정. 실패하면 음수
 }
 
 /* parse the uri to get hostname, file path, port */
+// 실제 파싱은 uri.c의 uri_parse가 한다. 입력을 건드리지 않고 [::1]:8080 같은 IPv6 주소, userinfo, 쿼리도 처리한다
 void parse_uri(char *uri, char *hostname, char *path, int *port) {
+  uri_parts u;
+
   *port = 80; // 디플트 값.
-  char *pos = strstr(uri, "//");    // 문자열에 담긴 '//'을 찾고 그 위치를 반환. 못 찾으면 NULL. http'//' 인 경우에 무시하려고 넣은 코드인듯
-  
-  pos = pos != NULL ? pos+2 : uri;  // pos안에 '//'가 있으면 포인터를 슬래시 다음으로, 없으면 pos = uri
-
-  char *pos2 = strstr(pos, ":");  // ':' 찾고 포인터 반환
-  if (pos2 != NULL) {   // ':'가 있다면 ex) localhost:8000/home.html
-    *pos2 = '\0';   // 이게 무슨 뜻이지? : 자리에 \0이 들어온다. 스트링을 끊어주는 역할.
-    sscanf(pos, "%s", hostname);  // localhost
-    sscanf(pos2+1, "%d%s", port, path); // port : 8000, path = /home.html
-  } else {    // ':'가 없다면 무슨 경우? 포트를 입력하지 않았을 때. 디폴트 포트 80 사용
-    pos2 = strstr(pos, "/");
-    if (pos2 != NULL) {
-      *pos2 = '\0';
-      sscanf(pos, "%s", hostname);
-      *pos2 = '/';
-      sscanf(pos2, "%s", path);
-    } else {
-      sscanf(pos, "%s", hostname);
-    }
-  }
-  return;
+  hostname[0] = '\0';
+  strcpy(path, "/");
+  if (uri_parse(uri, strlen(uri), &u) < 0)
+    return;
+  http_slice_cpy(hostname, MAXLINE, u.host);
+  if (u.port_num != 0)
+    *port = u.port_num;
+  // path가 비었으면("http://host?q") 앞에 '/'를 붙인다
+  snprintf(path, MAXLINE, "%s%.*s", u.path.len ? "" : "/", u.target.len, u.target.p);
 }
@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include "csapp.h"
+#include "uri.h"
 
 // block.list limit entry num
 #define MAXENTRY 100
@@ -140,43 +141,22 @@ int main(int argc, char **argv){
  * do nothing, return -1, it's error
  */
 int separate_uri(char *uri, char *host, char *port, char *path) {
+  uri_parts u;
+
   // relative path
   if (uri[0] == '/')
     return 0;
 
   // abslute path
-  char *prefix = "http://";
-  int prelen = strlen(prefix);
-  // if not http protocol, error
-  if (strncmp(uri, prefix, prelen) != 0)
+  // if not a valid uri or not http protocol, error
+  if (uri_parse(uri, strlen(uri), &u) < 0 || !http_slice_eq(u.scheme, "http") || u.host.len == 0)
     return -1;
 
-  char *start, *end;
-  start = uri + prelen;
-  end = start;
-
-  // copy host
-  while (*end != ':' && *end != '/') {
-    end++;
-  }
-  strncpy(host, start, end-start);
-
-  // port is porvided
-  if (*end == ':') {
-    // skip ':'
-    ++end;
-    start = end;
-    //copy port
-    while (*end != '/')
-      end++;
-    strncpy(port, start, end-start);
-  } else {
-    // port is not provided, default 80
-    strncpy(port, "80", 2);
-  }
-
-  // copy path
-  strcpy(path, end);
+  // copy host, port (default is 80) and path
+  http_slice_cpy(host, MAXLINE, u.host);
+  sprintf(port, "%d", u.port_num);
+  snprintf(path, MAXLINE, "%s%.*s", u.path.len ? "" : "/", u.target.len, u.target.p);
+  return 1;
 }
 
 /*
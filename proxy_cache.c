@@ -1,81 +1,119 @@
 #include <stdio.h>
 #include "csapp.h"
+#include "cache.h"
+#include "config.h"
+#include "http.h"
+#include "uri.h"
+#include "arena.h"
+#include "origin.h"
+#include "outbuf.h"
+#include "deadline.h"
+#include "admit.h"
+#include "ratelimit.h"
+#include "fairq.h"
+#include "restart.h"
+#include "mem.h"
 
 // Proxy part.3 - Cache
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
-#define LRU_MAGIC_NUMBER 9999
-// Least Recently Used
-// LRU: 가장 오랫동안 참조되지 않은 페이지를 교체하는 기법
-
-#define CACHE_OBJS_COUNT 10
+// 캐시 구현은 cache.c 참고
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
     "Firefox/10.0.3\r\n";
-static const char *requestline_hdr_format = "GET %s HTTP/1.0\r\n";
+static const char *requestline_prefix = "GET ";
+static const char *requestline_suffix = " HTTP/1.1\r\n";
 static const char *endof_hdr = "\r\n";
-static const char *host_hdr_format = "Host: %s\r\n";
+static const char *host_prefix = "Host: ";
 static const char *conn_hdr = "Connection: close\r\n";
 static const char *prox_hdr = "Proxy-Connection: close\r\n";
-
-static const char *host_key = "Host";
-static const char *connection_key = "Connection";
-static const char *proxy_connection_key = "Proxy-Connection";
-static const char *user_agent_key = "User-Agent";
+static const char *keepalive_hdr = "Connection: keep-alive\r\n";
 
 void *thread(void *vargsp);
-void doit(int connfd);
-void parse_uri(char *uri, char *hostname, char *path, int *port);
-void build_http_header(char *http_header, char *hostname, char *path, int port, rio_t *client_rio);
-int connect_endServer(char *hostname, int port, char *http_header);
-
-// cache function
-void cache_init();
-int cache_find(char *url);
-void cache_uri(char *uri, char *buf);
-
-void readerPre(int i);
-void readerAfter(int i);
-
-typedef struct 
-{
-  char cache_obj[MAX_OBJECT_SIZE];
-  char cache_url[MAXLINE];
-  int LRU; // least recently used 가장 최근에 사용한 것의 우선순위를 뒤로 미움 (캐시에서 삭제할 때)
-  int isEmpty; // 이 블럭에 캐시 정보가 들었는지 empty인지 아닌지 체크
-
-  int readCnt;  // count of readers
-  sem_t wmutex;  // protects accesses to cache 세마포어 타입. 1: 사용가능, 0: 사용 불가능
-  sem_t rdcntmutex;  // protects accesses to readcnt
-}cache_block; // 캐쉬블럭 구조체로 선언
-
-
-typedef struct
-{
-  cache_block cacheobjs[CACHE_OBJS_COUNT];  // ten cache blocks
-  int cache_num; // 캐시(10개) 넘버 부여
-}Cache;
-
-Cache cache;
-
+void doit(int connfd, arena *a, deadline *dl, int shedding, rl_client *client, fair_ticket *ft);
+int resolve_uri(http_request *req, uri_parts *u);
+// 엔드 서버로 보낼 요청의 iovec 수 상한: 요청 줄(3) + Host(3) + 고정 헤더(3) + 클라이언트 헤더 + 빈 줄
+#define UPSTREAM_IOV_MAX (HTTP_MAX_HEADERS + 10)
+#define RESP_BUF_INIT (16 * 1024)   // 캐시하려고 모으는 응답 버퍼의 처음 크기
+// 클라이언트로 보낼 응답 헤드의 iovec 수 상한: 상태 줄 + origin 헤더 + Connection + 빈 줄
+#define RESPONSE_IOV_MAX (HTTP_MAX_HEADERS + 3)
+
+// fetch_head가 연결 대신 돌려주는 실패
+#define FETCH_CONNECT_FAILED -1
+#define FETCH_BAD_RESPONSE -2
+#define FETCH_CONNECT_TIMEOUT -3    // upstream_connect_total_ms 안에 어느 주소로도 연결하지 못했다
+#define FETCH_FIRST_BYTE_TIMEOUT -4 // upstream_first_byte_ms 안에 응답 헤드가 오지 않았다
+
+// 연결 하나에서 난 I/O 에러. 에러가 나면 그 연결만 정리하고(소켓을 닫고 잘린 응답은 캐시하지 않고) 끝낸다
+static struct {
+  unsigned long long client_read;   // 요청 헤드를 읽다가 에러 (reset 등)
+  unsigned long long client_write;  // 응답을 쓰다가 에러 (클라이언트가 먼저 끊었다)
+  unsigned long long upstream_body; // origin 응답 본문이 중간에 끊겼다
+} conn_errors;
+
+#define CONN_ERROR(field) __atomic_add_fetch(&conn_errors.field, 1, __ATOMIC_RELAXED)
+
+// 연결 스레드에 넘기는 것
+typedef struct {
+  int connfd;
+  long long accepted;   // accept한 시각. 스레드가 돌기까지 기다린 시간(queueing delay)을 잰다
+  rl_client client;     // 보낸 응답 바이트를 청구할 클라이언트
+} conn_arg;
+
+// origin 응답 중 캐시하려고 모아 두는 부분. MAX_OBJECT_SIZE를 넘으면 더 모으지 않고 크기만 센다
+typedef struct {
+  char *buf;
+  int size;
+  int cap;    // buf에 할당한 크기. 필요할 때만 두 배씩 늘린다. -1이면 늘리지 못해서 복사를 그만뒀다
+} resp_buf;
+
+int build_http_header(struct iovec *iov, uri_parts *u, http_request *req);
+int build_response_header(struct iovec *iov, http_response *resp, int framing);
+int build_gzip_header(char *out, int maxlen, http_response *resp);
+int connect_endServer(char *hostname, int port);
+void proxy_error(int fd, char *errnum, char *shortmsg, char *longmsg);
+void serve_status(int fd);
 
 int main(int argc, char **argv) {
   int listenfd, connfd;
+  conn_arg *c;
   socklen_t clientlen;
   char hostname[MAXLINE], port[MAXLINE];
   pthread_t tid;
+  pthread_attr_t attr;
   struct sockaddr_storage clientaddr;
+  rl_client client;
 
-  cache_init(); 
+  int opt;
 
-  if (argc != 2) {
+  config_init();
+  http_init();
+
+  // -o name=value 로 런타임 옵션 지정 (config.c 참고)
+  while ((opt = getopt(argc, argv, "o:")) != -1) {
+    if (opt != 'o' || config_set(optarg) < 0) {
+      if (opt == 'o')
+        fprintf(stderr, "bad option: %s\n", optarg);
+      fprintf(stderr, "usage: %s [-o name=value]... <port> \n", argv[0]);
+      config_usage(stderr);
+      exit(1);
+    }
+  }
+
+  if (argc - optind != 1) {
     // fprintf: 출력을 파일에다 씀. strerr: 파일 포인터
-    fprintf(stderr, "usage: %s <port> \n", argv[0]);
+    fprintf(stderr, "usage: %s [-o name=value]... <port> \n", argv[0]);
+    config_usage(stderr);
     exit(1);  // exit(1): 에러 시 강제 종료
   }
+  restart_init(argv);   // 스레드를 만들기 전에. hot restart로 띄워졌으면 listening socket과 캐시를 받는다
+  cache_init(restart_cache_fd());   // cache_shm 옵션을 알아야 하므로 옵션을 읽은 다음에
+  if (origin_init() < 0 || fairq_init() < 0)
+    exit(1);
+  deadline_init();
+  admit_init();
+  ratelimit_init();
+  mem_init();   // 캐시를 만든 다음에. 한도에 다가가면 캐시를 줄이고 admit_accept가 덜 받는다
   Signal(SIGPIPE, SIG_IGN); // 특정 클라가 종료되어있다고 해서 남은 클라에 영향가지않게 그 한쪽 종료됐다는 시그널을 무시해라.
   /* 클라이언트를 여러개 받고 서버랑 연결하는데, 만약 정상적인 커넥션과 클로즈를 한다면 소켓을 받으면서 다 닫는 것 까지가 프로세스 과정인데,
     그건 정상적인 과정이니 문제가 안생김. but 클라이언트에서 정상적이지 않은 종료를 해서 소켓이 자기 혼자 닫히거나 사라졌을 때
@@ -84,283 +122,721 @@ int main(int argc, char **argv) {
     하지만 이 프로세스는 현재 다른 여러 클라이언트들과도 연결되어있는 상태기 때문에 하나 종료됐다고 해서 다 꺼버리면 안되니까
     그런 시그널을 무시해라, 라는 함수. SIG_IGN : signal ignore */
 
-  listenfd = Open_listenfd(argv[1]);
-  while (1) {
+  // 요청 처리에 쓰는 큰 버퍼들은 arena에 있으므로 스레드 스택은 작아도 된다
+  pthread_attr_init(&attr);
+  if (pthread_attr_setstacksize(&attr, (size_t)conf.thread_stack_kb * 1024) != 0) {
+    fprintf(stderr, "bad thread_stack_kb: %d\n", conf.thread_stack_kb);
+    exit(1);
+  }
+
+  listenfd = restart_listen(argv[optind]);
+  restart_ready();
+  // SIGUSR2로 새 프로세스에 넘겼으면 restart_wait가 0을 돌려준다
+  while (restart_wait(listenfd)) {
     clientlen = sizeof(clientaddr);
-    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+    // Accept는 실패하면 프로세스를 끝내므로 직접 부른다. fd가 바닥났으면 대기열의 연결에 503을 보낸다
+    if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0) {
+      if (errno == EMFILE || errno == ENFILE)
+        admit_overflow(listenfd);
+      continue;
+    }
+    // 요청을 너무 많이 보내는 클라이언트는 429, 과부하면 503으로 스레드를 만들거나 이름을 찾기 전에 끝낸다
+    ratelimit_key((SA *)&clientaddr, &client);
+    if (!ratelimit_accept(connfd, &client) || !admit_accept(connfd))
+      continue;
 
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
+    // 역방향 DNS를 기다리지 않고 숫자로. 실패해도 (Getnameinfo처럼 프로세스를 끝내지 않고) 연결은 받는다
+    if (getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+      strcpy(hostname, "?");
+      strcpy(port, "?");
+    }
     printf("Accepted connection from (%s %s).\n", hostname, port);
 
     // 첫 번째 인자 *thread: 쓰레드 식별자 / 두 번째: 쓰레드 특성 지정 (기본: NULL) / 세 번째: 쓰레드 함수 / 네 번째: 쓰레드 함수의 매개변수
-    Pthread_create(&tid, NULL, thread, (void *)connfd);
+    // 스레드를 못 만들면(메모리가 바닥나면) 죽지 않고 이 연결만 503으로 거절한다
+    if ((c = malloc(sizeof(conn_arg))) == NULL) {
+      admit_failed(connfd);
+      continue;
+    }
+    c->connfd = connfd;
+    c->accepted = now_ms();
+    c->client = client;
+    if (pthread_create(&tid, &attr, thread, c) != 0) {
+      free(c);
+      admit_failed(connfd);
+    }
     // doit(connfd);
     // Close(connfd);
   }
+  restart_drain(listenfd);
   return 0;
 }
 
 void *thread(void *vargsp) {
-  int connfd = (int)vargsp;
-  Pthread_detach(pthread_self());
-  doit(connfd);
-  Close(connfd);
+  conn_arg c = *(conn_arg *)vargsp;
+  int connfd = c.connfd, shedding;
+  arena *a = arena_get();   // 이 연결에서 쓰는 버퍼는 모두 여기서 할당하고, 끝나면 한 번에 돌려준다
+  deadline dl;              // 지금 기다리는 단계의 deadline. 지나면 타이머 스레드가 소켓을 끊는다
+  fair_ticket ft = { 0 };   // 요청을 처리하는 자리. doit이 차례를 기다려 받는다
+  free(vargsp);
+  pthread_detach(pthread_self());
+  if (a == NULL) {          // arena도 못 만들 만큼 메모리가 바닥났으면 스레드를 못 만든 것처럼 503
+    admit_failed(connfd);
+    return NULL;
+  }
+  shedding = admit_start(c.accepted);   // 너무 오래 기다렸으면 origin까지 가지 않고 503
+  deadline_start(&dl, connfd);
+  deadline_set(&dl, DL_HEADER, conf.client_header_ms, -1);
+  doit(connfd, a, &dl, shedding, &c.client, &ft);
+  fairq_exit(&ft);          // 다음 클라이언트에게 자리를 넘긴다
+  deadline_clear(&dl);      // connfd를 닫기 전에
+  close(connfd);
+  arena_put(a);
+  admit_done();
+  return NULL;
+}
+
+static void resp_append(arena *a, resp_buf *rb, const char *p, int n) {
+  char *q;
+
+  if (rb->cap >= 0 && rb->size + n < MAX_OBJECT_SIZE) { // 작으면 response 내용을 적어놈 (바이너리일 수 있으니 strcat 대신 memcpy)
+    if (rb->size + n > rb->cap) {
+      int newcap = rb->cap ? rb->cap * 2 : RESP_BUF_INIT;
+      while (newcap < rb->size + n)
+        newcap *= 2;
+      if (newcap > MAX_OBJECT_SIZE)
+        newcap = MAX_OBJECT_SIZE;
+      if ((q = arena_grow(a, rb->buf, rb->cap, newcap)) == NULL) {   // 할당한 크기만큼이 arena의 마지막 할당이다
+        rb->cap = -1;   // 메모리가 모자라면 복사를 그만두고 캐시하지 않는다
+        rb->size += n;
+        return;
+      }
+      rb->buf = q;
+      rb->cap = newcap;
+    }
+    memcpy(rb->buf + rb->size, p, n);
+  }
+  rb->size += n;
 }
 
-void doit(int connfd) {
+/* proxy거쳐서 서버에서 response오는데, 그 응답을 저장하고 클라이언트에 보냄 */
+static void relay(outbuf *out, arena *a, resp_buf *rb, char *p, int n, deadline *dl) {
+  deadline_touch(dl);   // origin에서 받았으니 idle deadline을 미룬다
+  resp_append(a, rb, p, n);
+  outbuf_write(out, p, n);
+}
+
+// 다음 origin read가 기다려야 하면(rio 버퍼가 비었고 지난 read가 소켓을 다 비웠으면) 모아 둔 것을 먼저 보낸다
+static inline void flush_if_idle(outbuf *out, rio_t *rp) {
+  if (rp->rio_cnt <= 0 && rp->rio_drained)
+    outbuf_idle(out);
+}
+
+static inline int is_empty_line(char *p, ssize_t n) {
+  return (n == 1 && p[0] == '\n') || (n == 2 && p[0] == '\r' && p[1] == '\n');
+}
+
+// origin에서 정확히 n 바이트를 rio 버퍼에서 바로 읽어서 보낸다. 다 보냈으면 1, 중간에 끊겼으면 0
+static int relay_n(outbuf *out, rio_t *rp, long long n, arena *a, resp_buf *rb, deadline *dl) {
+  ssize_t m;
+  char *p;
+
+  while (n > 0) {
+    flush_if_idle(out, rp);
+    if ((m = rio_readn_view(rp, &p, n < RIO_BUFSIZE ? n : RIO_BUFSIZE)) <= 0)
+      return 0;
+    relay(out, a, rb, p, m, dl);
+    n -= m;
+  }
+  return 1;
+}
+
+/*
+ * relay_body - framing에 맞게 origin 응답 본문을 읽어서 클라이언트로 보낸다.
+ *   chunked는 풀어서 데이터만 보낸다 (클라이언트 쪽은 연결을 닫아서 끝을 알린다).
+ *   origin이 말한 끝까지 받았으면 1, 중간에 끊겼거나 형식이 잘못됐으면 0
+ */
+static int relay_body(outbuf *out, rio_t *rp, int framing, long long length, arena *a, resp_buf *rb, deadline *dl) {
+  ssize_t n;
+  long long size;
+  char *p;
+
+  switch (framing) {
+  case HTTP_BODY_NONE:
+    return 1;
+  case HTTP_BODY_LENGTH:
+    return relay_n(out, rp, length, a, rb, dl);
+  case HTTP_BODY_EOF:
+    for (;;) {
+      flush_if_idle(out, rp);
+      if ((n = rio_readn_view(rp, &p, RIO_BUFSIZE)) <= 0)
+        return n == 0;
+      relay(out, a, rb, p, n, dl);
+    }
+  }
+
+  // chunked: chunk-size 줄, 데이터, CRLF 를 크기가 0인 chunk까지 반복
+  for (;;) {
+    flush_if_idle(out, rp);
+    if ((n = rio_readline_view(rp, &p)) <= 0 || (size = http_chunk_size(p, n)) < 0)
+      return 0;
+    if (size == 0)
+      break;
+    if (!relay_n(out, rp, size, a, rb, dl))
+      return 0;
+    if ((n = rio_readline_view(rp, &p)) <= 0 || !is_empty_line(p, n))
+      return 0;
+  }
+  // trailer는 버리고 빈 줄까지 읽는다
+  while ((n = rio_readline_view(rp, &p)) > 0 && !is_empty_line(p, n))
+    ;
+  return n > 0;
+}
+
+/*
+ * fetch_head - origin에 요청을 보내고 응답 헤드(1xx 중간 응답은 건너뛰고)를 resp에 파싱한다.
+ *   쓴 origin 연결을 리턴하고, 실패하면 FETCH_CONNECT_FAILED, FETCH_CONNECT_TIMEOUT,
+ *   FETCH_FIRST_BYTE_TIMEOUT, FETCH_BAD_RESPONSE.
+ *   풀에서 꺼낸 연결이 한 바이트도 보내지 않고 닫히면 origin이 쉬는 연결을 먼저 닫은 것이므로
+ *   새 연결로 한 번 더 보낸다. GET이라 다시 보내도 안전하다.
+ *   응답 헤드를 기다리는 동안은 DL_FIRST_BYTE, 리턴할 때는 origin 연결까지 묶은 DL_IDLE이 걸려 있다
+ */
+static int fetch_head(deadline *dl, char *hostname, int port, struct iovec *iov, int iovcnt, rio_t *rp, http_response *resp) {
+  int fd, reused, fresh = 0, expired;
+  ssize_t n = 0;
+  char *head;
+
+  for (;;) {
+    if (!fresh && (fd = origin_get(hostname, port)) >= 0) {
+      reused = 1;
+    } else {
+      reused = 0;
+      // -2(getaddrinfo 실패)는 errno를 남기지 않으므로 -1일 때만 errno로 타임아웃인지 본다
+      if ((fd = connect_endServer(hostname, port)) < 0)
+        return fd == -1 && errno == ETIMEDOUT ? FETCH_CONNECT_TIMEOUT : FETCH_CONNECT_FAILED;
+    }
+    Rio_readinitb(rp, fd);
+    deadline_set(dl, DL_FIRST_BYTE, conf.upstream_first_byte_ms, fd);
+    expired = 0;
+
+    // write the http header to endserver: 복사 없이 writev 한 번으로
+    if (rio_writev(fd, iov, iovcnt) >= 0) {
+      if (reused && origin_uds_path(hostname, port) == NULL)
+        origin_quickack(fd);
+      while ((n = rio_readhdrs_view(rp, &head)) > 0) {
+        if (http_parse_response(head, n, resp) < 0 || resp->status == 101)
+          break;
+        if (resp->status / 100 != 1) {
+          // 응답 헤드가 왔다. 이제부터는 본문이 멈춰 있는 시간을 본다
+          if (deadline_set(dl, DL_IDLE, conf.relay_idle_ms, fd) < 0)
+            return fd;
+          expired = 1;
+          break;
+        }
+      }
+    }
+    if (deadline_set(dl, DL_IDLE, conf.relay_idle_ms, -1) >= 0)  // fd를 닫기 전에 deadline에서 뗀다
+      expired = 1;
+    close(fd);
+    if (expired)
+      return FETCH_FIRST_BYTE_TIMEOUT;
+    if (!reused || n > 0 || rp->rio_cnt > 0)
+      return FETCH_BAD_RESPONSE;
+    fresh = 1;
+  }
+}
+
+// 요청이 본문이 있다고 하는지: Transfer-Encoding이 있거나 Content-Length가 0이 아니다
+static int request_has_body(http_request *req) {
+  http_hdr *h;
+  char *p, *end;
+
+  if (http_find(req, HDR_TRANSFER_ENCODING) != NULL)
+    return 1;
+  for (h = http_find(req, HDR_CONTENT_LENGTH); h != NULL; h = h->next < 0 ? NULL : &req->hdrs[h->next]) {
+    end = h->value.p + h->value.len;
+    if (h->value.len == 0)
+      return 1;
+    for (p = h->value.p; p < end; p++)
+      if (*p != '0')
+        return 1;
+  }
+  return 0;
+}
+
+// 이 요청으로 받은 응답을 다른 클라이언트에게 줘도 되는지. Range나 조건부 요청의 응답은 그 요청에만
+// 맞는 것이고, Authorization이 붙은 요청의 응답은 공유 캐시에 두지 않는다 (RFC 7234 3, 3.2)
+static int request_storable(http_request *req) {
+  return http_find(req, HDR_RANGE) == NULL && http_find(req, HDR_IF_NONE_MATCH) == NULL &&
+         http_find(req, HDR_IF_MODIFIED_SINCE) == NULL && http_find(req, HDR_AUTHORIZATION) == NULL;
+}
+
+// 따로 신선도를 알려 주지 않아도 캐시해도 되는 status (RFC 7231 6.1)와, 짧게만 캐시하는 5xx
+static int status_storable(int status) {
+  switch (status) {
+  case 200: case 203: case 204: case 300: case 301: case 404: case 405: case 410: case 414: case 501:
+    return 1;
+  }
+  return status >= 500 && status < 600;
+}
+
+void doit(int connfd, arena *a, deadline *dl, int shedding, rl_client *client, fair_ticket *ft) {
   int end_serverfd;
 
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char endserver_http_header[MAXLINE];
-  char hostname[MAXLINE], path[MAXLINE];
+  // 큰 것들(rio 버퍼, 파싱한 요청, 캐시 키, 응답 버퍼)은 스택 대신 연결의 arena에 둔다
+  rio_t *rio = arena_alloc(a, sizeof(rio_t));   // client's rio
+  rio_t *server_rio;                            // endserver's rio
+  http_response *resp;                          // origin 응답 헤드. server_rio 버퍼를 가리킨다
+  int framing;                                  // 응답 본문의 끝을 아는 방법 (HTTP_BODY_*)
+  long long length;                             // HTTP_BODY_LENGTH일 때 본문 길이
+  http_request *req = arena_alloc(a, sizeof(http_request));  // 파싱한 요청. 캐시 키, variant 선택, 엔드 서버 헤더 만들 때 모두 이걸 쓴다
+  cache_key *key = arena_alloc(a, sizeof(cache_key));
+  struct iovec *endserver_iov;  // 엔드 서버로 보낼 요청. 고정 문자열과 클라이언트 요청 버퍼를 가리킨다
+  int endserver_iovcnt;
+  char *hostname;
+  uri_parts u;       // 요청 uri의 각 부분. req와 같은 버퍼를 가리킨다
+  char *head;
+  ssize_t head_len;
   int port;
 
-  // rio: client's rio / server_rio: endserver's rio
-  rio_t rio, server_rio;
+  // arena에서 할당하지 못하면(메모리가 바닥나면) 죽지 않고 이 요청만 503. 연결 하나라도 처리할 메모리가
+  // 없으니 admission 거절과 같은 응답을 보낸다
+  if (rio == NULL || req == NULL || key == NULL) {
+    admit_reject(connfd);
+    return;
+  }
 
-  Rio_readinitb(&rio, connfd);
-  Rio_readlineb(&rio, buf, MAXLINE);
-  sscanf(buf, "%s %s %s", method, uri, version);  // read the client reqeust line
+  // 요청 줄과 헤더를 rio 버퍼에서 복사 없이 한 번에 읽고 파싱한다.
+  // req의 slice들은 rio 버퍼를 가리키므로 클라이언트에서 더 읽지 않는 이 함수 안에서는 계속 유효하다
+  Rio_readinitb(rio, connfd);
+  if ((head_len = rio_readhdrs_view(rio, &head)) <= 0) {
+    if (head_len < 0 && errno == EMSGSIZE)
+      proxy_error(connfd, "431", "Request Header Fields Too Large", "request head too large");
+    else if (head_len < 0)
+      CONN_ERROR(client_read);
+    return;
+  }
+  // 헤드를 다 받았다. 이제부터는 클라이언트와 주고받는 게 멈춰 있는 시간만 본다
+  deadline_set(dl, DL_IDLE, conf.relay_idle_ms, -1);
+  // 과부하: hit을 찾아볼 것도 아니면 파싱도 하지 않고 503
+  if (shedding && !conf.shed_allow_hits) {
+    admit_reject(connfd);
+    return;
+  }
+  if (http_parse_request(head, head_len, req) < 0) {
+    proxy_error(connfd, "400", "Bad Request", "malformed request");
+    return;
+  }
 
-  if (strcasecmp(method, "GET")) {
+  if (!http_slice_eq(req->method, "GET")) {
     printf("Proxy does not implement the method");
     return;
   }
+  // 요청 본문은 origin에 전달하지 않는다. 본문이 있다고 하는 요청을 그대로 보내면 origin은 오지 않을
+  // 본문을 기다리거나, 풀에 돌아간 연결에서 다음 요청을 본문으로 먹어 버린다
+  if (request_has_body(req)) {
+    proxy_error(connfd, "400", "Bad Request", "request bodies are not supported");
+    return;
+  }
+
+  // 프록시 자신에게 온 상태 조회 (origin-form "GET /proxy-status")
+  if (http_slice_eq(req->target, "/proxy-status")) {
+    serve_status(connfd);
+    return;
+  }
+
+  // parse the uri to get hostname, path, port
+  if (resolve_uri(req, &u) < 0) {
+    proxy_error(connfd, "400", "Bad Request", "malformed request target");
+    return;
+  }
+  if (!http_slice_eq(u.scheme, "http")) {
+    proxy_error(connfd, "501", "Not Implemented", "only http URIs are supported");
+    return;
+  }
 
-  char url_store[100]; // 아직 doit 함수 ㅎㅎ 
-  strcpy(url_store, uri); // doit으로 받아온 connfd가 들고있는 uri를 넣어준다
+  // 정규화된 캐시 키와 해시는 여기서 한 번만 만들고 모든 캐시 연산에 재사용한다
+  cache_key_build(&u, key);
 
   // the url is cached?
-  int cache_index;
-  // in cache then return the cache content
-  // cache_index정수 선언, url_store에 있는 인덱스를 뒤짐(chche_find:10개의 캐시블럭) 뒤져서 나온 인덱스가 -1이 아니면
-  if ((cache_index=cache_find(url_store)) != -1) { // 아니면 -> 내가 url_store에 들어있는 캐쉬인덱스에 접근을 했다는 것 
-    readerPre(cache_index); // 캐시 뮤텍스를 풀어줌 (열어줌 0->1)
-    Rio_writen(connfd, cache.cacheobjs[cache_index].cache_obj, strlen(cache.cacheobjs[cache_index].cache_obj));
-    // 캐시에서 찾은 값을 connfd에 쓰고, 캐시에서 그 값을 바로 보내게 됨
-    readerAfter(cache_index); // 닫아줌 1->0 doit 끝
+  // url과 요청 헤더에 맞는 variant가 있으면 응답이 arena에 복사되어 나온다.
+  // 캐시 락은 복사하는 동안만 잡고, 클라이언트에 쓰는 동안에는 놓고 있다
+  char *cachebuf = NULL;
+  int cached_size;
+  if ((cached_size = cache_read(key, req, a, &cachebuf)) >= 0) {
+    if (rio_writen(connfd, cachebuf, cached_size) < 0)   // 클라이언트가 끊었거나 idle deadline에 걸렸으면 그냥 끝낸다
+      CONN_ERROR(client_write);
+    ratelimit_charge(client, cached_size);
+    if (shedding)
+      admit_hit_served();
+    return;
+  }
+  if (shedding) {   // 과부하: miss는 origin까지 가지 않는다
+    admit_reject(connfd);
+    return;
+  }
+
+  // getaddrinfo는 NUL로 끝나는 문자열을 원하므로 host만 복사한다
+  if ((hostname = arena_alloc(a, u.host.len + 1)) == NULL) {
+    admit_reject(connfd);
+    return;
+  }
+  http_slice_cpy(hostname, u.host.len + 1, u.host);
+  port = u.port_num;
+
+  // 최근에 연결이 안 됐던 origin이면 getaddrinfo/connect 타임아웃을 다시 겪지 않고 바로 502
+  if (neg_host_check(hostname, port)) {
+    proxy_error(connfd, "502", "Bad Gateway", "origin recently unreachable");
+    return;
+  }
+  // 계속 실패하던 origin이라 circuit breaker가 열려 있어도 보내지 않고 503.
+  // 둘 다 origin까지 가지 않는 요청이므로 아래 tenant 차례를 기다리지 않는다
+  if (origin_open(hostname, port)) {
+    proxy_error(connfd, "503", "Service Unavailable", "origin is failing; circuit breaker open");
+    return;
+  }
+
+  // 여기부터는 origin으로 가는 miss다. hit은 위에서 이 연결의 스레드가 바로 보냈으므로 느린 origin을
+  // 기다리는 miss 뒤에 줄 서지 않는다. miss만 동시에 처리하는 수가 차 있으면 클라이언트(tenant 헤더나 IP)별
+  // 차례를 기다린다
+  char tenant[FAIRQ_KEY_MAX];
+  if (conf.fair_tenant_header[0] == '\0' || !http_header_value(req, conf.fair_tenant_header, tenant, FAIRQ_KEY_MAX) ||
+      tenant[0] == '\0')
+    ratelimit_name(client, tenant, FAIRQ_KEY_MAX);
+  if (!fairq_enter(ft, tenant)) {
+    admit_reject(connfd);
     return;
   }
 
-  // parse the uri to get hostname, file path, port
-  parse_uri(uri, hostname, path, &port);
+  // origin 요청과 응답에 쓸 버퍼는 origin 자리를 받기 전에 다 할당해 둔다 (할당에 실패해도 돌려줄 게 없다)
+  endserver_iov = arena_alloc(a, UPSTREAM_IOV_MAX * sizeof(struct iovec));
+  server_rio = arena_alloc(a, sizeof(rio_t));
+  resp = arena_alloc(a, sizeof(http_response));
+  outbuf *out = arena_alloc(a, sizeof(outbuf));
+  char *outdata = arena_alloc(a, OUTBUF_SIZE);
+  struct iovec *resp_iov = arena_alloc(a, RESPONSE_IOV_MAX * sizeof(struct iovec));
+  if (endserver_iov == NULL || server_rio == NULL || resp == NULL || out == NULL || outdata == NULL ||
+      resp_iov == NULL) {
+    admit_reject(connfd);
+    return;
+  }
 
   // build the http header which will send to the end server
-  build_http_header(endserver_http_header, hostname, path, port, &rio);
+  endserver_iovcnt = build_http_header(endserver_iov, &u, req);
+
+  // origin마다 동시에 보내는 요청 수 한도. 차 있으면 잠깐 기다리고, 그래도 자리가 없으면 503.
+  // 줄 서는 동안 circuit breaker가 열렸으면 보내지 않고 503.
+  // 받은 자리는 이 함수의 어느 길로 끝나든 origin_release로 결과와 함께 돌려준다
+  int slot = origin_acquire(hostname, port);
+  if (slot == ORIGIN_OPEN) {
+    proxy_error(connfd, "503", "Service Unavailable", "origin is failing; circuit breaker open");
+    return;
+  }
+  if (slot == ORIGIN_BUSY) {
+    proxy_error(connfd, "503", "Service Unavailable", "origin is at its concurrency limit");
+    return;
+  }
 
-  // connect to the end server
-  end_serverfd = connect_endServer(hostname, port, endserver_http_header);
-  if (end_serverfd < 0) {
+  // 요청을 보내고 응답 헤드를 받는다. 쉬고 있는 origin 연결이 있으면 그걸 쓴다
+  long long rtt_us = now_us();    // 응답 헤드가 오기까지 걸린 시간. origin 한도를 조정하는 데 쓴다
+  end_serverfd = fetch_head(dl, hostname, port, endserver_iov, endserver_iovcnt, server_rio, resp);
+  rtt_us = now_us() - rtt_us;
+  if (end_serverfd < 0)
+    origin_release(slot, rtt_us, ORIGIN_FAILED);
+  if (end_serverfd == FETCH_CONNECT_FAILED || end_serverfd == FETCH_CONNECT_TIMEOUT) {
     printf("connection failed\n");
+    neg_host_add(hostname, port, conf.neg_connect_ttl_ms);
+    if (end_serverfd == FETCH_CONNECT_TIMEOUT) {
+      deadline_note(DL_CONNECT);
+      proxy_error(connfd, "504", "Gateway Timeout", "origin did not accept the connection in time");
+    } else {
+      proxy_error(connfd, "502", "Bad Gateway", "could not connect to origin");
+    }
+    return;
+  }
+  if (end_serverfd == FETCH_FIRST_BYTE_TIMEOUT) {
+    proxy_error(connfd, "504", "Gateway Timeout", "origin did not respond in time");
+    return;
+  }
+  if (end_serverfd < 0 || (framing = http_body_framing(resp, &length)) < 0) {
+    if (end_serverfd >= 0) {
+      deadline_set(dl, DL_IDLE, conf.relay_idle_ms, -1);
+      close(end_serverfd);
+      origin_release(slot, rtt_us, ORIGIN_FAILED);
+    }
+    proxy_error(connfd, "502", "Bad Gateway", "invalid response from origin");
     return;
   }
 
-  Rio_readinitb(&server_rio, end_serverfd);
+  // resp는 server_rio 버퍼를 가리키므로 본문을 읽기 전에 필요한 것을 다 꺼내 둔다.
+  // arena에서 할당할 것도 여기서 끝낸다. 이 뒤로는 캐시할 복사본(rb)이 arena의 마지막 할당이라
+  // 본문이 늘어나도 제자리에서 커진다
+  char vary_field[MAXLINE], vary[CACHE_VARY_MAX];
+  int keep_alive = framing != HTTP_BODY_EOF && http_keep_alive(resp);
+  int status = resp->status;
+  http_resp_header_value(resp, "Vary", vary_field, MAXLINE);  // 여러 줄로 올 수도 있으니 이어붙인다
+  char *gz_hdr = NULL;      // 압축해서 캐시할 때 저장할 헤드
+  int gz_hdr_size = 0;
+  if (cache_compressible(resp) && (gz_hdr = arena_alloc(a, MAXLINE)) != NULL) {  // 못 얻으면 압축하지 않는다
+    if ((gz_hdr_size = build_gzip_header(gz_hdr, MAXLINE, resp)) < 0)
+      gz_hdr = NULL;
+  }
 
-  // write the http header to endserver
-  Rio_writen(end_serverfd, endserver_http_header, strlen(endserver_http_header));
+  // 응답 헤드: hop-by-hop 헤더를 바꿔서 출력 버퍼에 넣고, 캐시할 복사본에도 같은 헤드를 넣는다.
+  // 헤드와 본문 앞부분은 같은 write로 나간다
+  resp_buf rb = { NULL, 0, 0 };
+  outbuf_init(out, connfd, outdata, OUTBUF_SIZE);
+  int resp_iovcnt = build_response_header(resp_iov, resp, framing), i;
+  outbuf_writev(out, resp_iov, resp_iovcnt);
+  for (i = 0; i < resp_iovcnt; i++)
+    resp_append(a, &rb, resp_iov[i].iov_base, resp_iov[i].iov_len);
+  int hdr_size = rb.size;   // 응답 헤더(빈 줄 포함) 길이
 
   // recieve message from end server and send to the client
-  char cachebuf[MAX_OBJECT_SIZE];
-  int sizebuf = 0;
-  size_t n; // 캐시에 없을 때 찾아주는 과정?
-  while ((n=Rio_readlineb(&server_rio, buf, MAXLINE)) != 0) {
-    // printf("proxy received %ld bytes, then send\n", n);
-    sizebuf += n;
-    /* proxy거쳐서 서버에서 response오는데, 그 응답을 저장하고 클라이언트에 보냄 */
-    if (sizebuf < MAX_OBJECT_SIZE) // 작으면 response 내용을 적어놈
-      strcat(cachebuf, buf); // cachebuf에 but(response값) 다 이어붙혀놓음(캐시내용)
-    Rio_writen(connfd, buf, n);
-  }
-  Close(end_serverfd);
-
-  // store it
-  if (sizebuf < MAX_OBJECT_SIZE) {
-    cache_uri(url_store, cachebuf); // url_store에 cachebuf 저장
+  // 본문의 끝을 알고 다 받았으면 origin 연결은 닫지 않고 다음 요청을 위해 풀에 돌려준다
+  int complete = relay_body(out, server_rio, framing, length, a, &rb, dl);
+  if (outbuf_end(out) < 0)    // 캐시에 넣기(압축) 전에 클라이언트에 먼저 보낸다
+    CONN_ERROR(client_write);   // 클라이언트가 끊어도 본문은 끝까지 받아서 캐시한다
+  ratelimit_charge(client, rb.size);
+  // origin 연결을 닫거나 풀에 돌려주기 전에 deadline에서 뗀다. 시간이 지나서 끊었으면 잘린 응답이다
+  if (deadline_set(dl, DL_IDLE, conf.relay_idle_ms, -1) >= 0)
+    complete = 0;
+  if (complete && keep_alive && server_rio->rio_cnt == 0)
+    origin_put(hostname, port, end_serverfd);
+  else
+    close(end_serverfd);
+  origin_release(slot, rtt_us, !complete ? ORIGIN_FAILED : status >= 500 ? ORIGIN_5XX : ORIGIN_OK);
+  if (!complete) {
+    CONN_ERROR(upstream_body);
+    return;   // 잘린 응답은 캐시하지 않는다
   }
-}
-
-void build_http_header(char *http_header, char *hostname, char *path, int port, rio_t *client_rio) {
-  char buf[MAXLINE], request_hdr[MAXLINE], other_hdr[MAXLINE], host_hdr[MAXLINE];
 
-  // request line
-  sprintf(request_hdr, requestline_hdr_format, path);
+  // chunked를 풀어서 받았으면 캐시할 복사본에는 Content-Length를 넣어 둔다
+  if (framing == HTTP_BODY_CHUNKED) {
+    char cl[64];
+    int cl_len = snprintf(cl, sizeof(cl), "Content-Length: %d\r\n", rb.size - hdr_size);
+    resp_append(a, &rb, cl, cl_len);
+    if (rb.cap >= 0 && rb.size < MAX_OBJECT_SIZE) {
+      char *blank = rb.buf + hdr_size - 2;
+      memmove(blank + cl_len, blank, rb.size - cl_len - (hdr_size - 2));
+      memcpy(blank, cl, cl_len);
+      hdr_size += cl_len;
+    }
+  }
 
-  // get other request header for client rio and change it
-  while (Rio_readlineb(client_rio, buf, MAXLINE) > 0) {
-    if (strcmp(buf, endof_hdr) == 0)
-      break;  // EOF
+  int cacheable = 1;    // Vary: * 이면 캐시하지 않음
+  int ttl_ms = 0;       // 0이면 만료 없이 캐시
+  if (vary_normalize(vary_field, vary, CACHE_VARY_MAX) < 0)
+    cacheable = 0;
+  // 206, 302, 304 같은 응답이나 이 요청에만 맞는 응답은 저장하지 않는다
+  if (!status_storable(status) || !request_storable(req))
+    cacheable = 0;
+
+  // 404/5xx는 짧게만 캐시해서 장애 중인 origin에 같은 요청이 계속 몰리지 않게 한다
+  if (status == 404 || status >= 500) {
+    ttl_ms = conf.neg_error_ttl_ms;
+    if (ttl_ms <= 0)
+      cacheable = 0;
+  }
 
-    if (!strncasecmp(buf, host_key, strlen(host_key))) {
-      strcpy(host_hdr, buf);
-      continue;
-    }
+  // 메모리가 모자라서 캐시를 줄이는 중이거나 복사본을 끝까지 만들지 못했으면 새로 넣지 않는다 (mem.c)
+  if (mem_level() != MEM_OK || rb.cap < 0)
+    cacheable = 0;
 
-    if (strncasecmp(buf, connection_key, strlen(connection_key))
-        &&strncasecmp(buf, proxy_connection_key, strlen(proxy_connection_key))
-        &&strncasecmp(buf, user_agent_key, strlen(user_agent_key))) {
-        strcat(other_hdr, buf);
-      }
+  // store it
+  if (cacheable && rb.size < MAX_OBJECT_SIZE) {
+    cache_uri(key, vary, req, rb.buf, rb.size, hdr_size, gz_hdr, gz_hdr_size, ttl_ms); // key + variant에 응답 저장
   }
-  if (strlen(host_hdr) == 0) {
-    sprintf(host_hdr, host_hdr_format, hostname);
-  }
-  sprintf(http_header, "%s%s%s%s%s%s%s",
-          request_hdr,
-          host_hdr,
-          conn_hdr,
-          prox_hdr,
-          user_agent_hdr,
-          other_hdr,
-          endof_hdr);
-  return;
 }
 
-// Connect to the end server
-inline int connect_endServer(char *hostname, int port, char *http_header) {
-  char portStr[100];
-  sprintf(portStr, "%d", port);
-  return Open_clientfd(hostname, portStr);
+static inline void iov_add(struct iovec *iov, int *n, const char *base, size_t len) {
+  iov[*n].iov_base = (void *)base;
+  iov[*n].iov_len = len;
+  (*n)++;
 }
 
-// parse the uri to get hostname, file path, port
-void parse_uri(char *uri, char *hostname, char *path, int *port) {
-  *port = 80;
-  char *pos = strstr(uri, "//");
-
-  pos = pos!=NULL? pos+2:uri;
+/*
+ * build_http_header - 엔드 서버에 보낼 요청을 iovec 목록으로 만든다. 리턴 값은 iovec 수.
+ *   고정 헤더 문자열과 클라이언트 요청 버퍼의 줄들을 그대로 가리키므로 복사도, 크기 제한도 없다.
+ *   iov는 UPSTREAM_IOV_MAX개가 있어야 하고, req(와 u)가 가리키는 버퍼가 살아 있는 동안만 유효하다
+ */
+int build_http_header(struct iovec *iov, uri_parts *u, http_request *req) {
+  http_hdr *h;
+  int n = 0, i;
 
-  char *pos2 = strstr(pos, ":");
-  // sscanf(pos, "%s", hostname);
-  if (pos2 != NULL) {
-    *pos2 = '\0';
-    sscanf(pos, "%s", hostname);
-    sscanf(pos2+1, "%d%s", port, path);
+  // request line
+  iov_add(iov, &n, requestline_prefix, strlen(requestline_prefix));
+  if (u->path.len == 0)   // "http://host?q" 처럼 path가 비었으면 "/"
+    iov_add(iov, &n, "/", 1);
+  iov_add(iov, &n, u->target.p, u->target.len);
+  iov_add(iov, &n, requestline_suffix, strlen(requestline_suffix));
+
+  // 클라이언트가 보낸 Host가 있으면 그대로 쓴다
+  if ((h = http_find(req, HDR_HOST)) != NULL) {
+    iov_add(iov, &n, h->line.p, h->line.len);
   } else {
-    pos2 = strstr(pos, "/");
-    if (pos2 != NULL) {
-      *pos2 = '\0';  // 중간에 끊으려고
-      sscanf(pos, "%s", hostname);
-      *pos2 = '/';
-      sscanf(pos2, "%s", path);
-    } else {
-      scanf(pos, "%s", hostname);
-    }
+    iov_add(iov, &n, host_prefix, strlen(host_prefix));
+    iov_add(iov, &n, u->hostport.p, u->hostport.len);
+    iov_add(iov, &n, endof_hdr, strlen(endof_hdr));
   }
-  return;
-}
-
-void cache_init() {
-  cache.cache_num = 0; // 맨 처음이니까
-  int i;
-  for (i=0; i<CACHE_OBJS_COUNT; i++) {
-    cache.cacheobjs[i].LRU = 0; // LRU : 우선 순위를 미는 것. 처음이니까 0
-    cache.cacheobjs[i].isEmpty = 1; // 1이 비어있다는 뜻
-
-    // Sem_init : 세마포어 함수 
-    // 첫 번째 인자: 초기화할 세마포어의 포인터 / 두 번째: 0 - 쓰레드들끼리 세마포어 공유, 그 외 - 프로세스 간 공유 / 세 번째: 초기 값
-    //    뮤텍스 만들 포인터 / 0 : 세마포어를 뮤텍스로 쓰려면 0을 써야 쓰레드끼리 사용하는거라고 표시하는 것이 됨 / 1 : 초깃값 
-    // 세마포어는 프로세스를 쓰는 것. 지금 세마포어를 쓰레드에 적용하고 싶으니까 0을 써서 쓰레드에서 쓰는거라고 표시, 나머지 숫자를 프로세스에서 쓰는거라는 표시.
-    Sem_init(&cache.cacheobjs[i].wmutex, 0, 1); // wmutex : 캐시에 접근하는 것을 프로텍트해주는 뮤텍스
-    Sem_init(&cache.cacheobjs[i].rdcntmutex, 0, 1); // read count mutex : 리드카운트에 접근하는걸 프로텍트해주는 뮤텍스
-    // ㄴ flag 지정
-    cache.cacheobjs[i].readCnt = 0; // read count를 0으로 놓고 init을 끝냄
+  // origin 연결을 풀에 돌려줄 수 있으면 keep-alive로 연다
+  if (conf.upstream_keepalive > 0) {
+    iov_add(iov, &n, keepalive_hdr, strlen(keepalive_hdr));
+  } else {
+    iov_add(iov, &n, conn_hdr, strlen(conn_hdr));
+    iov_add(iov, &n, prox_hdr, strlen(prox_hdr));
   }
+  iov_add(iov, &n, user_agent_hdr, strlen(user_agent_hdr));
+
+  // 나머지 헤더는 받은 줄 그대로 전달한다. hop-by-hop 헤더는 클라이언트와의 연결에만 해당하므로 뺀다.
+  // 본문을 보내지 않으므로 본문 framing 헤더(Content-Length, Transfer-Encoding)도 뺀다.
+  // 남겨 두면 origin이 없는 본문을 기다리거나 같은 연결의 다음 요청을 본문으로 읽는다
+  for (i = 0; i < req->nhdrs; i++) {
+    h = &req->hdrs[i];
+    if (h->id == HDR_HOST || h->id == HDR_CONNECTION || h->id == HDR_PROXY_CONNECTION
+        || h->id == HDR_USER_AGENT || h->id == HDR_KEEP_ALIVE || h->id == HDR_TE || h->id == HDR_UPGRADE
+        || h->id == HDR_CONTENT_LENGTH || h->id == HDR_TRANSFER_ENCODING)
+      continue;
+    iov_add(iov, &n, h->line.p, h->line.len);
+  }
+  iov_add(iov, &n, endof_hdr, strlen(endof_hdr));
+  return n;
 }
 
-void readerPre(int i) { // i = 해당인덱스
-  // 내가 받아온 index오브젝트의 리드카운트 뮤텍스를 P함수(recntmutex에 접근을 가능하게) 해준다
-  /* rdcntmutex로 특정 readcnt에 접근하고 +1해줌. 원래 0으로 세팅되어있어서, 누가 안쓰고 있으면 0이었다가 1로 되고 if문 들어감 */
-  P(&cache.cacheobjs[i].rdcntmutex); // P연산(locking):정상인지 검사, 기다림 (P함수 비정상이면 에러 도출되는 로직임)
-  cache.cacheobjs[i].readCnt++; // readCnt 풀고 들어감
-  /* 조건문 들어오면 그때서야 캐쉬에 접근 가능. 그래서 만약 누가 쓰고있어도 P, readCnt까지는 할 수 있는데 +1이 되니까 1->2가 되고 
-    그러면 캐시에 접근을 못하게 됨. but readerAfter에서 -1 다시 내려주기때문에 0, 1, 0 에서만 움직임 */
-  if (cache.cacheobjs[i].readCnt == 1)
-    P(&cache.cacheobjs[i].wmutex); // write mutex 뮤텍스를 풀고(캐시에 접근)
-  V(&cache.cacheobjs[i].rdcntmutex); // V연산 풀기(캐시 쫒아냄) / read count mutex
-}
-
-void readerAfter(int i) {
-  P(&cache.cacheobjs[i].rdcntmutex);
-  cache.cacheobjs[i].readCnt--;
-  if (cache.cacheobjs[i].readCnt == 0)
-    V(&cache.cacheobjs[i].wmutex);
-  V(&cache.cacheobjs[i].rdcntmutex);
-}
-
-int cache_find(char *url) {
-  int i;
-  for (i=0; i<CACHE_OBJS_COUNT; i++) {
-    readerPre(i);
-    if ((cache.cacheobjs[i].isEmpty == 0) && (strcmp(url, cache.cacheobjs[i].cache_url) == 0))
-      break;
-    readerAfter(i);
+/*
+ * build_response_header - 클라이언트에 보낼 응답 헤드를 iovec 목록으로 만든다. 리턴 값은 iovec 수.
+ *   origin의 상태 줄과 헤더 줄을 그대로 가리키되, hop-by-hop 헤더는 빼고 Connection: close를 붙인다.
+ *   chunked를 풀어서 보낼 때는 Transfer-Encoding과 Content-Length도 뺀다.
+ *   iov는 RESPONSE_IOV_MAX개가 있어야 한다
+ */
+int build_response_header(struct iovec *iov, http_response *resp, int framing) {
+  http_hdr *h;
+  int n = 0, i;
+
+  iov_add(iov, &n, resp->status_line.p, resp->status_line.len);
+  for (i = 0; i < resp->nhdrs; i++) {
+    h = &resp->hdrs[i];
+    if (h->id == HDR_CONNECTION || h->id == HDR_PROXY_CONNECTION || h->id == HDR_KEEP_ALIVE)
+      continue;
+    if (framing == HTTP_BODY_CHUNKED && (h->id == HDR_TRANSFER_ENCODING || h->id == HDR_CONTENT_LENGTH))
+      continue;
+    iov_add(iov, &n, h->line.p, h->line.len);
   }
-  if (i >= CACHE_OBJS_COUNT)
-    return -1;
-  return i;
+  iov_add(iov, &n, conn_hdr, strlen(conn_hdr));
+  iov_add(iov, &n, endof_hdr, strlen(endof_hdr));
+  return n;
 }
 
-int cache_eviction() { // 캐시 쫒아내기
-  int min = LRU_MAGIC_NUMBER;
-  int minindex = 0;
-  int i;
-  for (i=0; i<CACHE_OBJS_COUNT; i++) {
-    readerPre(i);
-    if (cache.cacheobjs[i].isEmpty == 1) {
-      minindex = i;
-      readerAfter(i);
-      break;
-    }
-    if (cache.cacheobjs[i].LRU < min) {
-      minindex = i;
-      min = cache.cacheobjs[i]. LRU;
-      readerAfter(i);
+/*
+ * build_gzip_header - 압축해서 캐시할 응답의 헤드를 out에 만든다. 리턴 값은 길이, 안 들어가면 -1.
+ *   build_response_header와 같은 줄에서 Content-Length, Content-Encoding, Transfer-Encoding과
+ *   끝의 빈 줄을 뺀 것이다. 캐시에서 내보낼 때 인코딩에 맞는 값을 붙인다 (cache.c의 compose).
+ *   이 헤드로 gzip과 identity를 둘 다 내보내므로 strong ETag도 뺀다. strong validator는 바이트가
+ *   같은 표현끼리만 같아야 한다 (RFC 7232 2.3). 의미만 같으면 되는 weak ETag(W/)는 둔다
+ */
+int build_gzip_header(char *out, int maxlen, http_response *resp) {
+  int len = 0, conn_len = strlen(conn_hdr), i;
+  http_hdr *h;
+
+  if (resp->status_line.len + conn_len >= maxlen)
+    return -1;
+  memcpy(out, resp->status_line.p, resp->status_line.len);
+  len = resp->status_line.len;
+  for (i = 0; i < resp->nhdrs; i++) {
+    h = &resp->hdrs[i];
+    if (h->id == HDR_CONNECTION || h->id == HDR_PROXY_CONNECTION || h->id == HDR_KEEP_ALIVE
+        || h->id == HDR_CONTENT_LENGTH || h->id == HDR_CONTENT_ENCODING || h->id == HDR_TRANSFER_ENCODING)
       continue;
-    }
-    readerAfter(i);
+    if (h->id == HDR_ETAG && !(h->value.len >= 2 && !strncmp(h->value.p, "W/", 2)))
+      continue;
+    if (len + h->line.len + conn_len >= maxlen)
+      return -1;
+    memcpy(out + len, h->line.p, h->line.len);
+    len += h->line.len;
   }
-  return minindex;
+  memcpy(out + len, conn_hdr, conn_len);
+  return len + conn_len;
 }
 
-void writePre(int i) {
-  P(&cache.cacheobjs[i].wmutex);
+// Connect to the end server
+//   Open_clientfd는 실패하면 프로세스를 끝내버리므로 에러를 리턴하는 쪽을 쓴다.
+//   주소가 여럿이면 하나가 응답하지 않아도 커널의 SYN 재전송(분 단위) 동안 스레드가 묶이지 않게
+//   open_clientfd_timeout이 주소들을 엇갈려 동시에 시도한다.
+//   uds_map에 있는 origin은 TCP 대신 Unix domain socket으로 (같은 호스트라 TCP 스택을 거칠 필요가 없다).
+//   getaddrinfo가 실패하면 -2, 그 밖의 실패는 -1이고 errno가 남는다 (시간이 다 됐으면 ETIMEDOUT)
+inline int connect_endServer(char *hostname, int port) {
+  char portStr[100], *path;
+
+  if ((path = origin_uds_path(hostname, port)) != NULL)
+    return open_unix_clientfd(path);
+  sprintf(portStr, "%d", port);
+  return open_clientfd_timeout(hostname, portStr, conf.upstream_connect_ms, conf.upstream_connect_total_ms);
 }
 
-void writeAfter(int i) {
-  V(&cache.cacheobjs[i].wmutex);
+// 프록시가 직접 만든 에러 응답을 클라이언트에 보낸다 (tiny의 clienterror와 같은 모양)
+void proxy_error(int fd, char *errnum, char *shortmsg, char *longmsg) {
+  char buf[MAXLINE], body[MAXBUF];
+
+  snprintf(body, MAXBUF, "<html><title>Proxy Error</title><body bgcolor=\"ffffff\">\r\n"
+           "%s: %s\r\n<p>%s\r\n</body></html>\r\n", errnum, shortmsg, longmsg);
+  snprintf(buf, MAXLINE, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\n"
+           "Content-length: %d\r\nConnection: close\r\n\r\n", errnum, shortmsg, (int)strlen(body));
+  struct iovec iov[2] = { { buf, strlen(buf) }, { body, strlen(body) } };
+  rio_writev(fd, iov, 2);   // 클라이언트가 끊었거나 deadline에 걸려 끊겼으면 보낼 곳이 없다
 }
 
-// update the LRU number except the new cache one
-void cache_LRU(int index) {
-  int i;
-  for (i=0; i<index; i++) { // ex) 5 일때 5 이하 다 내려줌
-    writePre(i);
-    if (cache.cacheobjs[i].isEmpty == 0 && i != index)
-      cache.cacheobjs[i].LRU--;
-    writeAfter(i);
-  }
-  i++;
-  for (i; i<CACHE_OBJS_COUNT; i++) { // 5부터 10 사이 수도 내려줌
-    writePre(i);
-    if (cache.cacheobjs[i].isEmpty == 0 && i != index) {
-      cache.cacheobjs[i].LRU--; // 이미 찾은 애는 9999로 보냈으니 그 앞에있는 애들 인덱스 -1씩 내려준다
-    }
-    writeAfter(i);
+/*
+ * serve_status - 캐시와 각 모듈의 상태를 text/plain으로 보낸다.
+ *   모듈마다 *_stats(FILE *)로 자기 부분을 쓴다
+ */
+void serve_status(int fd) {
+  char hdr[MAXLINE], *body = NULL;
+  size_t body_len = 0;
+  FILE *fp;
+
+  if ((fp = open_memstream(&body, &body_len)) == NULL) {
+    proxy_error(fd, "500", "Internal Server Error", "out of memory");
+    return;
   }
+  cache_stats(fp);
+  origin_stats(fp);
+  outbuf_stats(fp);
+  deadline_stats(fp);
+  admit_stats(fp);
+  ratelimit_stats(fp);
+  fairq_stats(fp);
+  restart_stats(fp);
+  mem_stats(fp);
+  fprintf(fp, "conn_errors client_read %llu client_write %llu upstream_body %llu\n",
+          conn_errors.client_read, conn_errors.client_write, conn_errors.upstream_body);
+  fclose(fp);
+  snprintf(hdr, MAXLINE, "HTTP/1.0 200 OK\r\nContent-type: text/plain\r\n"
+           "Content-length: %d\r\nConnection: close\r\n\r\n", (int)body_len);
+  struct iovec iov[2] = { { hdr, strlen(hdr) }, { body, body_len } };
+  rio_writev(fd, iov, 2);
+  free(body);
 }
 
-// cache the uri and content in cache
-void cache_uri(char *uri, char *buf) {
-  int i = cache_eviction(); // 빈 캐시 블럭을 찾는 첫번째 index
-
-  writePre(i);
+/*
+ * resolve_uri - 요청의 request-target을 파싱한다. origin-form("/path")이면 host와 port를 Host 헤더에서 가져와서
+ *   absolute-form과 같은 모양(http://host:port/path)으로 채운다. 성공하면 0, 잘못된 요청이면 -1
+ */
+int resolve_uri(http_request *req, uri_parts *u) {
+  http_hdr *h;
 
-  strcpy(cache.cacheobjs[i].cache_obj, buf);
-  strcpy(cache.cacheobjs[i].cache_url, uri);
-  cache.cacheobjs[i].isEmpty = 0;
-  cache.cacheobjs[i].LRU = LRU_MAGIC_NUMBER; // 가장 최근에 했으니 우선순위 9999로 보내줌
-  cache_LRU(i); // 나 빼고 LRU 다 내려.. 난 9999니까
-
-  writeAfter(i);
-}
\ No newline at end of file
+  if (uri_parse(req->target.p, req->target.len, u) < 0)
+    return -1;
+  if (!u->has_authority) {
+    if (u->scheme.len > 0 || (h = http_find(req, HDR_HOST)) == NULL
+        || uri_parse_authority(h->value.p, h->value.len, u) < 0 || u->userinfo.len > 0)
+      return -1;
+    u->scheme.p = "http";
+    u->scheme.len = 4;
+    u->has_authority = 1;
+    if (u->port.len == 0)
+      u->port_num = 80;
+  }
+  if (u->host.len == 0)
+    return -1;
+  return 0;
+}
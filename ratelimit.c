@@ -0,0 +1,199 @@
+/*
+ * ratelimit.c - per-client token buckets for requests and bytes
+ *
+ * 표는 주소의 hash로 RL_SHARDS 조각에 나뉘고 조각마다 락이 따로 있어서, 서로 다른 클라이언트를
+ * 받는 스레드끼리는 거의 부딪치지 않는다. 조각이 꽉 차면 가장 오래 안 온 클라이언트를 잊는다.
+ * 오래 쉰 클라이언트의 버킷은 어차피 가득 차 있으므로 잊어도 달라지는 것이 없다.
+ *
+ * 요청 버킷은 accept할 때 하나씩 뺀다. 바이트 버킷은 응답 크기를 보내기 전에는 모르므로 보낸 뒤에
+ * 빼고(ratelimit_charge) 음수가 될 수 있다. 빚이 있는 클라이언트는 다 갚을 때까지 다음 연결을 거절한다.
+ */
+#include "ratelimit.h"
+#include "admit.h"
+#include "cache.h"
+#include "config.h"
+
+typedef struct {
+  unsigned char addr[16];
+  unsigned int hash;
+  int used;
+  long long last_us;            // 버킷을 마지막으로 채운 시각
+  double reqs;                  // 남은 요청 token
+  double bytes;                 // 남은 바이트 token. 음수면 빚
+} rl_entry;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  rl_entry entries[RL_SHARD_SLOTS];
+} __attribute__((aligned(64))) rl_shard;
+
+static rl_shard shards[RL_SHARDS];
+static char limit_resp[256];
+static int limit_len;
+
+static struct {
+  unsigned long long passed;
+  unsigned long long limited_reqs;    // 초당 요청 수에 걸려 거절
+  unsigned long long limited_bytes;   // 바이트 빚 때문에 거절
+  unsigned long long forgotten;       // 조각이 꽉 차서 잊은 클라이언트
+} stats;
+
+#define STAT_ADD(field, n) __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+#define STAT_GET(field) __atomic_load_n(&stats.field, __ATOMIC_RELAXED)
+
+void ratelimit_init(void) {
+  static const char body[] = "too many requests from this client, slow down\n";
+  int i;
+
+  for (i = 0; i < RL_SHARDS; i++)
+    pthread_mutex_init(&shards[i].mutex, NULL);
+  limit_len = snprintf(limit_resp, sizeof(limit_resp), "HTTP/1.0 429 Too Many Requests\r\n"
+                       "Content-type: text/plain\r\nContent-length: %d\r\nRetry-After: 1\r\n"
+                       "Connection: close\r\n\r\n%s", (int)strlen(body), body);
+}
+
+/*
+ * ratelimit_key - accept가 돌려준 주소로 버킷을 찾을 열쇠를 만든다
+ */
+void ratelimit_key(struct sockaddr *sa, rl_client *c) {
+  unsigned int h = 2166136261u;
+  int i;
+
+  memset(c, 0, sizeof(*c));
+  if (sa->sa_family == AF_INET) {
+    c->addr[10] = c->addr[11] = 0xff;
+    memcpy(c->addr + 12, &((struct sockaddr_in *)sa)->sin_addr, 4);
+  } else if (sa->sa_family == AF_INET6) {
+    memcpy(c->addr, &((struct sockaddr_in6 *)sa)->sin6_addr, 8);
+  } else {
+    return;
+  }
+  for (i = 0; i < 16; i++) {
+    h ^= c->addr[i];
+    h *= 16777619u;
+  }
+  c->hash = h;
+  c->valid = 1;
+}
+
+/*
+ * ratelimit_name - 열쇠를 사람이 읽는 이름으로 (IPv4 주소나 IPv6 /64 prefix). Unix socket이면 "local"
+ */
+void ratelimit_name(rl_client *c, char *buf, int size) {
+  unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+  if (!c->valid)
+    snprintf(buf, size, "local");
+  else if (!memcmp(c->addr, v4mapped, 12))
+    inet_ntop(AF_INET, c->addr + 12, buf, size);
+  else
+    inet_ntop(AF_INET6, c->addr, buf, size);
+}
+
+static double rps_burst(void) {
+  return conf.client_rps_burst > 0 ? conf.client_rps_burst : conf.client_rps;
+}
+
+static double bps_burst(void) {
+  return conf.client_bps_burst > 0 ? (double)conf.client_bps_burst : conf.client_bps;
+}
+
+// c의 버킷을 찾아서 지금까지 쌓인 token을 채운다. create면 없을 때 새로 (또는 가장 오래 안 온 자리에) 만든다.
+// 조각의 락을 잡고 부른다
+static rl_entry *bucket(rl_shard *s, rl_client *c, int create) {
+  long long now = now_us();
+  rl_entry *e, *victim = NULL;
+  int i;
+
+  for (i = 0; i < RL_SHARD_SLOTS; i++) {
+    e = &s->entries[i];
+    if (e->used && e->hash == c->hash && !memcmp(e->addr, c->addr, 16))
+      break;
+    if (victim == NULL || (victim->used && (!e->used || e->last_us < victim->last_us)))
+      victim = e;
+  }
+  if (i == RL_SHARD_SLOTS) {
+    if (!create)
+      return NULL;
+    if (victim->used)
+      STAT_ADD(forgotten, 1);
+    e = victim;
+    memcpy(e->addr, c->addr, 16);
+    e->hash = c->hash;
+    e->used = 1;
+    e->last_us = now;
+    e->reqs = rps_burst();
+    e->bytes = bps_burst();
+    return e;
+  }
+  e->reqs += (now - e->last_us) * conf.client_rps / 1e6;
+  if (e->reqs > rps_burst())
+    e->reqs = rps_burst();
+  e->bytes += (now - e->last_us) * conf.client_bps / 1e6;
+  if (e->bytes > bps_burst())
+    e->bytes = bps_burst();
+  e->last_us = now;
+  return e;
+}
+
+/*
+ * ratelimit_accept - 방금 받은 연결의 요청 token을 하나 쓴다. 받으면 1, 클라이언트가 token을 다 썼거나
+ *   바이트 빚이 있으면 429를 보내고 닫은 뒤 0. accept 스레드에서 부른다
+ */
+int ratelimit_accept(int connfd, rl_client *c) {
+  rl_shard *s;
+  rl_entry *e;
+  int ok = 1;
+
+  if (!c->valid || (conf.client_rps <= 0 && conf.client_bps <= 0))
+    return 1;
+  s = &shards[c->hash % RL_SHARDS];
+  pthread_mutex_lock(&s->mutex);
+  e = bucket(s, c, 1);
+  if (conf.client_rps > 0 && e->reqs < 1) {
+    STAT_ADD(limited_reqs, 1);
+    ok = 0;
+  } else if (conf.client_bps > 0 && e->bytes < 0) {
+    STAT_ADD(limited_bytes, 1);
+    ok = 0;
+  } else if (conf.client_rps > 0) {
+    e->reqs -= 1;
+  }
+  pthread_mutex_unlock(&s->mutex);
+
+  if (!ok) {
+    admit_refuse(connfd, limit_resp, limit_len);
+    return 0;
+  }
+  STAT_ADD(passed, 1);
+  return 1;
+}
+
+/*
+ * ratelimit_charge - c에게 응답 bytes를 보냈다. 바이트 버킷에서 뺀다 (모자라면 빚으로 남는다)
+ */
+void ratelimit_charge(rl_client *c, long long bytes) {
+  rl_shard *s;
+  rl_entry *e;
+
+  if (!c->valid || conf.client_bps <= 0 || bytes <= 0)
+    return;
+  s = &shards[c->hash % RL_SHARDS];
+  pthread_mutex_lock(&s->mutex);
+  if ((e = bucket(s, c, 0)) != NULL)
+    e->bytes -= bytes;
+  pthread_mutex_unlock(&s->mutex);
+}
+
+void ratelimit_stats(FILE *fp) {
+  int i, j, clients = 0;
+
+  for (i = 0; i < RL_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].mutex);
+    for (j = 0; j < RL_SHARD_SLOTS; j++)
+      clients += shards[i].entries[j].used;
+    pthread_mutex_unlock(&shards[i].mutex);
+  }
+  fprintf(fp, "ratelimit clients %d passed %llu limited requests %llu bytes %llu forgotten %llu\n",
+          clients, STAT_GET(passed), STAT_GET(limited_reqs), STAT_GET(limited_bytes), STAT_GET(forgotten));
+}
@@ -0,0 +1,31 @@
+/*
+ * ratelimit.h - per-client token buckets for requests and bytes
+ *
+ * 클라이언트 하나가 요청을 쏟아붓거나 큰 응답을 계속 받아 가면 다른 클라이언트가 쓸 스레드와
+ * 대역폭이 없어진다. 클라이언트 IP마다 초당 요청 수와 초당 바이트 수의 token bucket을 두고,
+ * 다 쓴 클라이언트의 연결은 accept에서 바로 429로 닫는다 (연결 하나에 요청 하나이므로
+ * accept가 곧 요청마다 거는 검사다).
+ */
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include "csapp.h"
+
+#define RL_SHARDS 64            // 표를 나눈 조각 수. 조각마다 락이 따로 있다
+#define RL_SHARD_SLOTS 64       // 조각마다 기억하는 클라이언트 수. 넘치면 가장 오래 안 온 클라이언트를 잊는다
+
+// 버킷을 찾는 열쇠. accept에서 주소로 만들어 연결 스레드에 넘긴다
+typedef struct {
+  unsigned char addr[16];       // IPv4는 ::ffff:a.b.c.d, IPv6는 앞 64비트(한 사이트가 받는 prefix)만
+  unsigned int hash;
+  int valid;                    // 0이면 제한하지 않는다 (Unix domain socket으로 들어온 연결)
+} rl_client;
+
+void ratelimit_init(void);
+void ratelimit_key(struct sockaddr *sa, rl_client *c);
+void ratelimit_name(rl_client *c, char *buf, int size);
+int ratelimit_accept(int connfd, rl_client *c);
+void ratelimit_charge(rl_client *c, long long bytes);
+void ratelimit_stats(FILE *fp);
+
+#endif /* __RATELIMIT_H__ */
@@ -0,0 +1,296 @@
+/*
+ * restart.c - zero-downtime restart: hand the listening socket to a new binary, then drain
+ *
+ * 순서:
+ *   1. 예전 프로세스가 SIGUSR2를 받는다. signalfd로 받으므로 accept 루프(restart_wait)가 직접 처리한다
+ *   2. socketpair를 만들고 fork해서 실행 파일을 exec한다. 새 프로세스는 한쪽 끝을 HANDOFF_FD로 받는다
+ *   3. 예전 프로세스는 그 socket으로 listening socket과 캐시 영역의 fd를 보낸다. 그동안에도 accept는 계속한다
+ *   4. 새 프로세스는 초기화를 다 끝내고 'R'을 보낸 뒤, 예전 프로세스가 socket을 닫을 때까지 기다린다
+ *   5. 예전 프로세스는 'R'을 받으면 listening socket을 닫고 handoff socket을 닫는다 (새 프로세스에게는
+ *      이제 accept해도 된다는 뜻). 처리 중인 연결이 다 끝나면 exit
+ * 두 프로세스가 같은 socket에서 accept하는 때가 없으므로, 한쪽이 먼저 가져간 연결 때문에 다른 쪽이
+ * accept에서 막히는 일이 없다. 새 프로세스가 준비되기 전에 죽으면 예전 프로세스는 EOF를 받고 그대로 일한다.
+ */
+#include "restart.h"
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include "admit.h"
+#include "cache.h"
+#include "config.h"
+
+#define HANDOFF_FD 3    // 새 프로세스에서 handoff socket이 갈 fd 번호
+#define HANDOFF_READY 'R'
+
+static char exe[MAXLINE];       // 시작할 때의 실행 파일 경로. 그 자리에 새로 깐 바이너리를 띄운다
+static char **saved_argv;
+static int sigfd = -1;          // SIGUSR2를 읽는 signalfd
+static int handoff = -1;        // 예전 프로세스와 새 프로세스를 잇는 socket. 주고받는 중이 아니면 -1
+static pid_t child = -1;        // 띄워서 준비되기를 기다리는 새 프로세스
+static int inherited[2] = { -1, -1 };   // 넘겨받은 listening socket, 캐시 영역
+
+static struct {
+  int generation;               // 몇 번째로 넘겨받은 프로세스인지. 처음 띄운 프로세스는 0
+  unsigned long long started;   // 새 프로세스를 띄운 횟수
+  unsigned long long failed;    // 새 프로세스가 준비되기 전에 죽은 횟수
+} stats;
+
+// fds를 SCM_RIGHTS로 보낸다. 본문은 새 프로세스의 generation
+static int send_fds(int sock, int *fds, int nfds) {
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  int gen = stats.generation + 1;
+  struct iovec iov = { &gen, sizeof(gen) };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&ctl, 0, sizeof(ctl));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(gen) ? 0 : -1;
+}
+
+// send_fds가 보낸 것을 받아 inherited에 채운다
+static int recv_fds(int sock) {
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  int gen, nfds;
+  struct iovec iov = { &gen, sizeof(gen) };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = sizeof(ctl.buf);
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(gen))
+    return -1;
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    return -1;
+  nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  if (nfds < 1 || nfds > 2)
+    return -1;
+  memcpy(inherited, CMSG_DATA(cmsg), nfds * sizeof(int));
+  stats.generation = gen;
+  return 0;
+}
+
+/*
+ * restart_init - 옵션을 읽은 다음, 다른 스레드를 만들기 전에 main에서 부른다.
+ *   SIGUSR2는 모든 스레드에서 막아 두고 signalfd로만 받는다 (그래서 스레드가 생기기 전에 막아야 한다).
+ *   예전 프로세스가 띄운 것이면 넘겨준 fd들을 받는다
+ */
+void restart_init(char **argv) {
+  sigset_t set;
+  ssize_t n;
+  char *env;
+
+  saved_argv = argv;
+  // 경로를 지금 읽어 둔다. 나중에 읽으면 바이너리를 바꾼 뒤라 지워진 예전 파일을 가리킨다
+  if ((n = readlink("/proc/self/exe", exe, sizeof(exe) - 1)) > 0)
+    exe[n] = '\0';
+  else
+    snprintf(exe, sizeof(exe), "%s", argv[0]);
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  if ((sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+    unix_error("signalfd error");
+
+  if ((env = getenv(RESTART_ENV)) == NULL)
+    return;
+  handoff = atoi(env);
+  unsetenv(RESTART_ENV);  // 이 프로세스가 다음에 띄울 프로세스는 자기 번호를 따로 받는다
+  fcntl(handoff, F_SETFD, FD_CLOEXEC);
+  if (recv_fds(handoff) < 0) {
+    fprintf(stderr, "restart: did not get the listening socket from the old process\n");
+    exit(1);
+  }
+}
+
+/*
+ * restart_listen - 넘겨받은 listening socket. 처음 띄운 프로세스면 port에 새로 연다
+ */
+int restart_listen(char *port) {
+  if (inherited[0] >= 0)
+    return inherited[0];
+  return Open_listenfd(port);
+}
+
+// 넘겨받은 캐시 영역. 없으면 -1 (cache_init에 넘긴다)
+int restart_cache_fd(void) {
+  return inherited[1];
+}
+
+/*
+ * restart_ready - 초기화를 다 끝내고 accept 루프에 들어가기 직전에 부른다. 넘겨받은 프로세스면
+ *   예전 프로세스에 준비됐다고 알리고, 그쪽이 accept를 멈출 때(socket을 닫을 때)까지 기다린다.
+ *   그쪽이 멈추지 않고 있어도 1초 뒤에는 accept를 시작한다
+ */
+void restart_ready(void) {
+  struct pollfd p;
+  char c = HANDOFF_READY;
+
+  if (handoff < 0)
+    return;
+  if (write(handoff, &c, 1) == 1) {
+    p.fd = handoff;
+    p.events = POLLIN;
+    if (poll(&p, 1, 1000) > 0)
+      while (read(handoff, &c, 1) > 0)
+        ;
+  }
+  close(handoff);
+  handoff = -1;
+  printf("restart: took over from the old process (generation %d)\n", stats.generation);
+  fflush(stdout);
+}
+
+// 새 바이너리를 띄우고 fd들을 보낸다. 실패하면 지금 프로세스가 그대로 일한다
+static void restart_begin(int listenfd) {
+  extern char **environ;
+  char env[32], **envp;
+  int sv[2], fds[2], nfds = 0, n;
+  struct rlimit rl;
+  pid_t pid;
+  int fd, maxfd;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    perror("restart: socketpair");
+    return;
+  }
+  // fork한 뒤에는 malloc을 부를 수 없으므로 exec할 환경과 닫을 fd 범위를 미리 만든다
+  for (n = 0; environ[n] != NULL; n++)
+    ;
+  if ((envp = malloc((n + 2) * sizeof(char *))) == NULL) {
+    close(sv[0]);
+    close(sv[1]);
+    return;
+  }
+  snprintf(env, sizeof(env), "%s=%d", RESTART_ENV, HANDOFF_FD);
+  envp[0] = env;
+  memcpy(envp + 1, environ, (n + 1) * sizeof(char *));
+  maxfd = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY ? (int)rl.rlim_cur : 65536;
+
+  if ((pid = fork()) == 0) {
+    // 새 프로세스에는 handoff socket만 넘긴다. 클라이언트와 origin 연결이 남으면 예전 프로세스가
+    // 닫아도 끊기지 않는다
+    if (sv[1] == HANDOFF_FD)
+      fcntl(sv[1], F_SETFD, 0);
+    else
+      dup2(sv[1], HANDOFF_FD);
+    for (fd = HANDOFF_FD + 1; fd < maxfd; fd++)
+      close(fd);
+    execve(exe, saved_argv, envp);
+    _exit(127);
+  }
+  free(envp);
+  close(sv[1]);
+  if (pid < 0) {
+    perror("restart: fork");
+    close(sv[0]);
+    return;
+  }
+
+  fds[nfds++] = listenfd;
+  if (cache_region_fd() >= 0)
+    fds[nfds++] = cache_region_fd();
+  if (send_fds(sv[0], fds, nfds) < 0) {
+    perror("restart: sendmsg");
+    close(sv[0]);
+    waitpid(pid, NULL, 0);    // 새 프로세스는 fd를 못 받으면 바로 끝난다
+    stats.failed++;
+    return;
+  }
+  handoff = sv[0];
+  child = pid;
+  stats.started++;
+  printf("restart: started %s as pid %d\n", exe, (int)pid);
+  fflush(stdout);
+}
+
+/*
+ * restart_wait - accept 루프에서 accept 전에 부른다. listenfd에 연결이 오면 1 (accept할 차례).
+ *   기다리는 동안 SIGUSR2가 오면 새 프로세스를 띄우고, 그 프로세스가 준비되면 0 (이제 accept를 멈추고
+ *   restart_drain할 차례)
+ */
+int restart_wait(int listenfd) {
+  struct pollfd p[3];
+  struct signalfd_siginfo si;
+  char c;
+  int n;
+
+  while (1) {
+    p[0].fd = listenfd;
+    p[1].fd = sigfd;
+    p[2].fd = handoff;        // -1이면 poll이 보지 않는다
+    p[0].events = p[1].events = p[2].events = POLLIN;
+    p[0].revents = p[1].revents = p[2].revents = 0;
+    if (poll(p, 3, -1) < 0) {
+      if (errno != EINTR)
+        return 1;     // poll을 못 쓰면 그냥 accept에서 기다린다
+      continue;
+    }
+    if (p[1].revents & POLLIN) {
+      while (read(sigfd, &si, sizeof(si)) == sizeof(si))
+        ;
+      if (child < 0)
+        restart_begin(listenfd);
+      else
+        printf("restart: already waiting for pid %d\n", (int)child);
+    }
+    if (p[2].revents) {
+      if ((n = read(handoff, &c, 1)) == 1 && c == HANDOFF_READY)
+        return 0;
+      // 준비되기 전에 죽었다 (새 바이너리가 옵션을 거부했거나 시작하다 실패했다)
+      fprintf(stderr, "restart: new process %d exited before taking over, still serving\n", (int)child);
+      close(handoff);
+      handoff = -1;
+      waitpid(child, NULL, 0);
+      child = -1;
+      stats.failed++;
+    }
+    if (p[0].revents)
+      return 1;
+  }
+}
+
+/*
+ * restart_drain - 새 프로세스가 준비된 뒤에 부른다. accept를 멈추고 처리 중인 연결이 끝나기를
+ *   restart_drain_ms까지 기다린 다음 프로세스를 끝낸다. 돌아오지 않는다
+ */
+void restart_drain(int listenfd) {
+  long long until = now_ms() + conf.restart_drain_ms;
+  int left;
+
+  close(listenfd);    // socket은 새 프로세스에 남아 있다. backlog의 연결도 그쪽이 받는다
+  close(handoff);     // 새 프로세스에게 accept를 시작하라고 알린다
+  handoff = -1;
+  printf("restart: handed over to pid %d, draining %d connections\n", (int)child, admit_inflight());
+  fflush(stdout);
+  while ((left = admit_inflight()) > 0 && now_ms() < until)
+    usleep(10000);
+  if (left > 0)
+    fprintf(stderr, "restart: drain deadline passed, cutting %d connections\n", left);
+  printf("restart: old process exiting\n");
+  exit(0);
+}
+
+void restart_stats(FILE *fp) {
+  fprintf(fp, "restart generation %d pid %d started %llu failed %llu\n",
+          stats.generation, (int)getpid(), stats.started, stats.failed);
+}
@@ -0,0 +1,28 @@
+/*
+ * restart.h - zero-downtime restart: hand the listening socket to a new binary, then drain
+ *
+ * 프록시를 죽이고 다시 띄우면 받던 응답이 끊기고, 다시 bind할 때까지 포트가 비어서 연결이 거절된다.
+ * SIGUSR2를 받으면 프록시는 같은 경로의 실행 파일(새로 깔린 바이너리)을 같은 인자로 띄우고
+ * Unix socket으로 listening socket과 캐시 영역의 fd를 넘긴다 (SCM_RIGHTS). 새 프로세스가 준비됐다고
+ * 알리면 예전 프로세스는 accept를 멈추고, 처리 중인 연결이 다 끝나거나 restart_drain_ms가 지나면 끝난다.
+ * socket은 커널에 그대로 있으므로 그 사이에 온 연결은 backlog에 있다가 새 프로세스가 받는다.
+ * 캐시 영역도 그대로 넘어가므로 배포 직후에 캐시가 비지 않는다.
+ *
+ *   kill -USR2 <pid>
+ */
+#ifndef __RESTART_H__
+#define __RESTART_H__
+
+#include "csapp.h"
+
+#define RESTART_ENV "PROXY_HANDOFF_FD"   // 새 프로세스가 예전 프로세스와 이어진 socket 번호를 받는 환경 변수
+
+void restart_init(char **argv);
+int restart_listen(char *port);
+int restart_cache_fd(void);
+void restart_ready(void);
+int restart_wait(int listenfd);
+void restart_drain(int listenfd);
+void restart_stats(FILE *fp);
+
+#endif /* __RESTART_H__ */
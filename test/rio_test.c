@@ -0,0 +1,485 @@
+/*
+ * rio_test.c - check the rio line readers against the original
+ *    byte-at-a-time rio_readlineb, then report header-reading throughput
+ *
+ * The same input goes through the old rio_readlineb, the new one,
+ * rio_readline_view and rio_readhdrs_view, once per newline scan (AVX2
+ * if the CPU has it, SSE2, byte loop), both from a file (full reads) and
+ * from a pipe fed in random small chunks (short reads, refills in the
+ * middle of a line). csapp.c is included rather than linked so the test
+ * can pin rio_scan_level and call the static rio_read the old reader
+ * was built on.
+ *
+ *   usage: rio_test [megabytes]   (size of the throughput run, default 32)
+ *   exits 1 if any reader disagrees with the old one
+ */
+#include "../csapp.c"
+
+static int failures;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            failures++;                                         \
+            return;                                             \
+        }                                                       \
+    } while (0)
+
+/* The rio_readlineb that csapp.c shipped with, one rio_read per byte */
+static ssize_t old_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    int n, rc;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+        if ((rc = rio_read(rp, &c, 1)) == 1) {
+            *bufp++ = c;
+            if (c == '\n') {
+                n++;
+                break;
+            }
+        } else if (rc == 0) {
+            if (n == 1)
+                return 0; /* EOF, no data read */
+            else
+                break;    /* EOF, some data was read */
+        } else
+            return -1;    /* Error */
+    }
+    *bufp = 0;
+    return n-1;
+}
+
+/* xorshift32, fixed seed so a failure reproduces */
+static unsigned int rnd_state = 2463534242u;
+
+static unsigned int rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/* Growable byte buffer for building inputs */
+typedef struct {
+    char *p;
+    size_t len, cap;
+} buf_t;
+
+static void put(buf_t *b, const void *s, size_t n)
+{
+    if (b->len + n > b->cap) {
+        b->cap = (b->len + n) * 2;
+        b->p = Realloc(b->p, b->cap);
+    }
+    memcpy(b->p + b->len, s, n);
+    b->len += n;
+}
+
+static void puts_(buf_t *b, const char *s)
+{
+    put(b, s, strlen(s));
+}
+
+static void put_filler(buf_t *b, size_t n)
+{
+    while (n-- > 0) {
+        char c = 'a' + rnd() % 26;
+        put(b, &c, 1);
+    }
+}
+
+/*
+ * Input sources. A file gives full RIO_BUFSIZE reads; a pipe written in
+ * random 1..700 byte chunks by another thread gives short reads that
+ * split lines and "\r\n" pairs.
+ */
+typedef struct {
+    int fd;          /* Read end */
+    int wfd;         /* Pipe write end, or -1 */
+    pthread_t tid;
+    const char *data;
+    size_t len;
+} feed_t;
+
+static void *feeder(void *vargp)
+{
+    feed_t *f = vargp;
+    size_t off = 0, n;
+
+    while (off < f->len) {
+        n = 1 + rnd() % 700;
+        if (n > f->len - off)
+            n = f->len - off;
+        if (rio_writen(f->wfd, (void *)(f->data + off), n) < 0)
+            break;   /* Reader gave up */
+        off += n;
+    }
+    close(f->wfd);
+    return NULL;
+}
+
+static void feed_open(feed_t *f, const char *data, size_t len, int chunky)
+{
+    char path[] = "/tmp/rio_testXXXXXX";
+    int fds[2];
+
+    f->data = data;
+    f->len = len;
+    f->wfd = -1;
+    if (chunky) {
+        if (pipe(fds) < 0)
+            unix_error("pipe error");
+        f->fd = fds[0];
+        f->wfd = fds[1];
+        Pthread_create(&f->tid, NULL, feeder, f);
+        return;
+    }
+    if ((f->fd = mkstemp(path)) < 0)
+        unix_error("mkstemp error");
+    unlink(path);
+    if (rio_writen(f->fd, (void *)data, len) != (ssize_t)len)
+        unix_error("write error");
+    lseek(f->fd, 0, SEEK_SET);
+}
+
+static void feed_close(feed_t *f)
+{
+    close(f->fd);
+    if (f->wfd >= 0)
+        Pthread_join(f->tid, NULL);
+}
+
+/* Header-like lines with the awkward cases mixed in */
+static void make_lines(buf_t *b, size_t size)
+{
+    unsigned int k;
+    size_t n;
+
+    while (b->len < size) {
+        k = rnd() % 100;
+        if (k < 3) {
+            puts_(b, "\r\n");                          /* Empty line */
+        } else if (k < 4) {
+            put_filler(b, 7000 + rnd() % 12000);       /* Longer than RIO_BUFSIZE */
+            puts_(b, "\r\n");
+        } else if (k < 6) {
+            for (n = rnd() % 300; n > 0; n--) {        /* Any byte, NUL and lone '\r' too */
+                char c = rnd();
+                put(b, &c, 1);
+            }
+            puts_(b, "\n");
+        } else {
+            puts_(b, "X-Header-");
+            put_filler(b, rnd() % 200);
+            puts_(b, k < 11 ? "\n" : "\r\n");          /* Some bare '\n' endings */
+        }
+    }
+    put_filler(b, 1 + rnd() % 50);                     /* Last line has no newline */
+}
+
+static const char *level_name(int level)
+{
+    return level == 2 ? "avx2" : level == 1 ? "sse2" : "scalar";
+}
+
+/* New rio_readlineb must return what the old one did, call for call */
+static void test_readlineb(buf_t *in, size_t maxlen, int chunky)
+{
+    static char a[3 * RIO_BUFSIZE], b[3 * RIO_BUFSIZE];
+    feed_t fa, fb;
+    rio_t ra, rb;
+    ssize_t na, nb;
+    long calls = 0;
+
+    feed_open(&fa, in->p, in->len, chunky);
+    feed_open(&fb, in->p, in->len, chunky);
+    rio_readinitb(&ra, fa.fd);
+    rio_readinitb(&rb, fb.fd);
+    do {
+        na = old_readlineb(&ra, a, maxlen);
+        nb = rio_readlineb(&rb, b, maxlen);
+        calls++;
+        if (na != nb || (na > 0 && memcmp(a, b, na + 1))) {
+            feed_close(&fa);
+            feed_close(&fb);
+            CHECK(0, "rio_readlineb maxlen %zu call %ld: old %zd new %zd", maxlen, calls, na, nb);
+        }
+    } while (na > 0);
+    feed_close(&fa);
+    feed_close(&fb);
+}
+
+/* rio_readline_view must split the input where the old reader does with
+   maxlen RIO_BUFSIZE + 1 (long lines come back in RIO_BUFSIZE pieces) */
+static void test_readline_view(buf_t *in, int chunky)
+{
+    static char a[RIO_BUFSIZE + 1];
+    feed_t fa, fb;
+    rio_t ra, rb;
+    ssize_t na, nb;
+    char *line;
+    long calls = 0;
+
+    feed_open(&fa, in->p, in->len, chunky);
+    feed_open(&fb, in->p, in->len, chunky);
+    rio_readinitb(&ra, fa.fd);
+    rio_readinitb(&rb, fb.fd);
+    do {
+        na = old_readlineb(&ra, a, sizeof(a));
+        nb = rio_readline_view(&rb, &line);
+        calls++;
+        if (na != nb || (na > 0 && memcmp(a, line, na))) {
+            feed_close(&fa);
+            feed_close(&fb);
+            CHECK(0, "rio_readline_view call %ld: old %zd new %zd", calls, na, nb);
+        }
+    } while (na > 0);
+    feed_close(&fa);
+    feed_close(&fb);
+}
+
+/* Old-reader version of rio_readhdrs_view: lines up to an empty one */
+static ssize_t old_readhdrs(rio_t *rp, buf_t *head)
+{
+    char line[RIO_BUFSIZE + 1];
+    ssize_t n;
+
+    head->len = 0;
+    while ((n = old_readlineb(rp, line, sizeof(line))) > 0) {
+        put(head, line, n);
+        if (!strcmp(line, "\n") || !strcmp(line, "\r\n"))
+            return head->len;
+    }
+    return n;
+}
+
+/* A request head of exactly len bytes (len >= 40) */
+static void make_head(buf_t *b, size_t len)
+{
+    size_t start = b->len;
+
+    puts_(b, "GET /index.html HTTP/1.1\r\nX-Pad: ");
+    put_filler(b, len - (b->len - start) - 4);
+    puts_(b, "\r\n\r\n");
+}
+
+/* Pipelined heads of random size up to RIO_BUFSIZE; each must match the old reader */
+static void test_readhdrs_view(int chunky)
+{
+    buf_t in = { 0 }, head = { 0 };
+    feed_t fa, fb;
+    rio_t ra, rb;
+    ssize_t na, nb;
+    char *hdrs;
+    int i, j, nhdrs;
+
+    for (i = 0; i < 2000; i++) {
+        size_t start = in.len;
+
+        puts_(&in, "GET /x HTTP/1.1\r\n");
+        nhdrs = rnd() % 20;
+        for (j = 0; j < nhdrs && in.len - start < RIO_BUFSIZE - 200; j++) {  /* Stay under the limit */
+            puts_(&in, "Header-");
+            put_filler(&in, rnd() % (j == 0 && i % 50 == 0 ? 7000 : 150));
+            puts_(&in, rnd() % 8 ? "\r\n" : "\n");
+        }
+        puts_(&in, rnd() % 8 ? "\r\n" : "\n");
+    }
+
+    feed_open(&fa, in.p, in.len, chunky);
+    feed_open(&fb, in.p, in.len, chunky);
+    rio_readinitb(&ra, fa.fd);
+    rio_readinitb(&rb, fb.fd);
+    for (i = 0; ; i++) {
+        na = old_readhdrs(&ra, &head);
+        nb = rio_readhdrs_view(&rb, &hdrs);
+        if (na != nb || (na > 0 && memcmp(head.p, hdrs, na))) {
+            printf("FAIL rio_readhdrs_view head %d: old %zd new %zd\n", i, na, nb);
+            failures++;
+            break;
+        }
+        if (na <= 0)
+            break;
+    }
+    feed_close(&fa);
+    feed_close(&fb);
+    free(in.p);
+    free(head.p);
+}
+
+/*
+ * Heads at the RIO_BUFSIZE boundary. A head of exactly RIO_BUFSIZE bytes
+ * fits in the buffer and is returned; one byte more is EMSGSIZE. Tried
+ * first in the stream and after a small head, so the buffer has to be
+ * compacted before the big head fits.
+ */
+static void test_head_limit(size_t len, int after_small, int chunky)
+{
+    buf_t in = { 0 };
+    feed_t f;
+    rio_t r;
+    ssize_t n;
+    char *hdrs;
+
+    if (after_small)
+        make_head(&in, 100);
+    make_head(&in, len);
+    make_head(&in, 60);        /* Pipelined behind it */
+    feed_open(&f, in.p, in.len, chunky);
+    rio_readinitb(&r, f.fd);
+    if (after_small) {
+        n = rio_readhdrs_view(&r, &hdrs);
+        if (n != 100) {
+            printf("FAIL head limit: small head returned %zd\n", n);
+            failures++;
+        }
+    }
+    errno = 0;
+    n = rio_readhdrs_view(&r, &hdrs);
+    if (len <= RIO_BUFSIZE && (n != (ssize_t)len || hdrs[len - 1] != '\n')) {
+        printf("FAIL head of %zu bytes (%s, %s): returned %zd, want %zu\n", len,
+               after_small ? "after a small head" : "first", chunky ? "pipe" : "file", n, len);
+        failures++;
+    } else if (len > RIO_BUFSIZE && (n != -1 || errno != EMSGSIZE)) {
+        printf("FAIL head of %zu bytes (%s, %s): returned %zd errno %d, want -1 EMSGSIZE\n", len,
+               after_small ? "after a small head" : "first", chunky ? "pipe" : "file", n, errno);
+        failures++;
+    }
+    feed_close(&f);
+    free(in.p);
+}
+
+static void check_all(buf_t *lines)
+{
+    static const size_t maxlens[] = { 1, 2, 3, 17, 256, MAXLINE, RIO_BUFSIZE + 1, 2 * RIO_BUFSIZE };
+    size_t i, len;
+    int chunky, after;
+
+    for (chunky = 0; chunky <= 1; chunky++) {
+        for (i = 0; i < sizeof(maxlens) / sizeof(maxlens[0]); i++)
+            test_readlineb(lines, maxlens[i], chunky);
+        test_readline_view(lines, chunky);
+        test_readhdrs_view(chunky);
+        for (after = 0; after <= 1; after++)
+            for (len = RIO_BUFSIZE - 2; len <= RIO_BUFSIZE + 2; len++)
+                test_head_limit(len, after, chunky);
+    }
+}
+
+/*
+ * Throughput: read a file of realistic request heads (in the page cache)
+ * with each reader and report MB/s, read() calls included
+ */
+static const char *sample_head =
+    "GET http://www.example.com/static/js/app.3f9c2a.js?v=20261019 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Referer: http://www.example.com/articles/2026/10/a-long-article-title.html\r\n"
+    "Cookie: session=7f3a9b2c4d5e6f708192a3b4c5d6e7f8; theme=dark; consent=1\r\n"
+    "If-None-Match: \"5f1e-62a3b4c5d6e7f\"\r\n"
+    "Connection: keep-alive\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "\r\n";
+
+enum { R_OLD, R_LINEB, R_LINE_VIEW, R_HDRS_VIEW };
+
+static double run_reader(int fd, int reader, size_t len)
+{
+    static char line[MAXLINE];
+    struct timespec t0, t1;
+    rio_t r;
+    char *p;
+    size_t total = 0;
+    ssize_t n;
+
+    lseek(fd, 0, SEEK_SET);
+    rio_readinitb(&r, fd);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (;;) {
+        if (reader == R_OLD)
+            n = old_readlineb(&r, line, MAXLINE);
+        else if (reader == R_LINEB)
+            n = rio_readlineb(&r, line, MAXLINE);
+        else if (reader == R_LINE_VIEW)
+            n = rio_readline_view(&r, &p);
+        else
+            n = rio_readhdrs_view(&r, &p);
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (total != len)
+        printf("FAIL throughput run read %zu of %zu bytes\n", total, len), failures++;
+    return len / 1e6 / ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+static void bench(size_t mb, int *levels, int nlevels)
+{
+    static const char *names[] = { "rio_readlineb (old)", "rio_readlineb", "rio_readline_view", "rio_readhdrs_view" };
+    buf_t in = { 0 };
+    feed_t f;
+    int reader, i;
+
+    while (in.len < mb * 1000000)
+        puts_(&in, sample_head);
+    feed_open(&f, in.p, in.len, 0);
+    printf("throughput over %zu MB of %zu-byte request heads:\n", in.len / 1000000, strlen(sample_head));
+    printf("  %-22s %10.0f MB/s\n", names[R_OLD], run_reader(f.fd, R_OLD, in.len));
+    for (reader = R_LINEB; reader <= R_HDRS_VIEW; reader++) {
+        printf("  %-22s", names[reader]);
+        for (i = 0; i < nlevels; i++) {
+#ifdef RIO_SIMD
+            rio_scan_level = levels[i];
+#endif
+            printf(" %6s %6.0f MB/s", level_name(levels[i]), run_reader(f.fd, reader, in.len));
+        }
+        printf("\n");
+    }
+    feed_close(&f);
+    free(in.p);
+}
+
+int main(int argc, char **argv)
+{
+    int levels[3], nlevels = 0, i;
+    size_t mb = argc > 1 ? atoi(argv[1]) : 32;
+    buf_t lines = { 0 };
+
+    Signal(SIGPIPE, SIG_IGN);
+#ifdef RIO_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        levels[nlevels++] = 2;
+    else
+        printf("no AVX2 on this CPU, skipping the AVX2 scan\n");
+    levels[nlevels++] = 1;
+#endif
+    levels[nlevels++] = 0;
+
+    make_lines(&lines, 2000000);
+    for (i = 0; i < nlevels; i++) {
+        int before = failures;
+#ifdef RIO_SIMD
+        rio_scan_level = levels[i];
+#endif
+        check_all(&lines);
+        printf("%-6s scan: rio_readlineb, rio_readline_view, rio_readhdrs_view %s\n",
+               level_name(levels[i]), failures == before ? "match the old reader" : "FAILED");
+    }
+    free(lines.p);
+
+    if (mb > 0)
+        bench(mb, levels, nlevels);
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
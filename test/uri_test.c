@@ -0,0 +1,318 @@
+/*
+ * uri_test.c - uri_parse / uri_parse_authority 검사
+ *
+ * 1. corpus: test/uri_corpus.txt의 각 입력을 파싱해서 돌려준 slice와 값이 기대와 같은지 본다.
+ * 2. fuzz: corpus 입력을 무작위로 바꿔 가며 파싱하고, 받아들인 입력이면 결과가 지켜야 할 것
+ *    (slice가 입력 안에 있음, 제어 문자 없음, port는 숫자, target = path ['?' query] 등)을 본다.
+ * 입력은 딱 그 길이만큼 malloc한 버퍼에 넣어서 끝을 넘어 읽으면 valgrind/ASan에 걸린다.
+ *
+ *   usage: uri_test <corpus> [fuzz 횟수, 기본 1000000]
+ *   하나라도 틀리면 1로 끝난다
+ */
+#include "../uri.h"
+
+#define MAX_CASES 1024
+
+typedef struct {
+  int line;
+  int authority;        // uri_parse_authority로 파싱
+  char *in;
+  int len;
+  char *expect;         // 기대값 부분 ("INVALID" 또는 name=value 들)
+} test_case;
+
+static test_case cases[MAX_CASES];
+static int ncases, failures;
+
+/*
+ * unescape - s의 \xHH, \t, \r, \n, \0, \\ 를 풀어서 out에 쓰고 길이를 리턴한다. "" 는 빈 입력
+ */
+static int unescape(const char *s, char *out) {
+  int len = 0;
+  unsigned int c;
+
+  if (!strcmp(s, "\"\""))
+    return 0;
+  while (*s) {
+    if (*s != '\\') {
+      out[len++] = *s++;
+      continue;
+    }
+    s++;
+    if (*s == 'x' && sscanf(s + 1, "%2x", &c) == 1) {
+      out[len++] = c;
+      s += 3;
+      continue;
+    }
+    out[len++] = *s == 't' ? '\t' : *s == 'r' ? '\r' : *s == 'n' ? '\n' : *s == '0' ? '\0' : *s;
+    s++;
+  }
+  return len;
+}
+
+static void load_corpus(char *path) {
+  char line[MAXLINE], buf[MAXLINE], func[64], in[MAXLINE];
+  FILE *fp;
+  int lineno = 0, n;
+
+  if ((fp = fopen(path, "r")) == NULL)
+    unix_error("corpus");
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '#' || line[0] == '\0')
+      continue;
+    if (ncases == MAX_CASES || sscanf(line, "%63s %s%n", func, in, &n) != 2
+        || (strcmp(func, "uri") && strcmp(func, "authority"))) {
+      fprintf(stderr, "%s:%d: bad line\n", path, lineno);
+      exit(2);
+    }
+    test_case *t = &cases[ncases++];
+    t->line = lineno;
+    t->authority = !strcmp(func, "authority");
+    t->len = unescape(in, buf);
+    t->in = Malloc(t->len + 1);   // len 0이어도 유효한 포인터
+    memcpy(t->in, buf, t->len);
+    t->expect = strdup(line + n + strspn(line + n, " "));
+  }
+  fclose(fp);
+}
+
+// 출력용: 제어 문자와 0x80 이상은 \xHH로
+static void print_bytes(const char *p, int len) {
+  int i;
+
+  for (i = 0; i < len; i++)
+    if (p[i] > 0x20 && p[i] < 0x7f)
+      putchar(p[i]);
+    else
+      printf("\\x%02x", (unsigned char)p[i]);
+}
+
+static int parse(test_case *t, char *in, int len, uri_parts *u) {
+  if (t->authority) {
+    memset(u, 0, sizeof(*u));
+    return uri_parse_authority(in, len, u);
+  }
+  return uri_parse(in, len, u);
+}
+
+/*
+ * check_slice - 돌려준 slice s가 기대값과 같은지. want가 NULL이면 적지 않은 필드:
+ *   absent가 1이면(query/fragment) 없어야 하고, 아니면 길이 0이어야 한다
+ */
+static int check_slice(test_case *t, const char *name, http_slice s, const char *want, int absent) {
+  char buf[MAXLINE];
+  int len;
+
+  if (want == NULL) {
+    if ((absent && s.p == NULL) || (!absent && s.len == 0))
+      return 1;
+  } else {
+    len = unescape(want, buf);
+    if (s.p != NULL && s.len == len && !memcmp(s.p, buf, len))
+      return 1;
+  }
+  printf("FAIL uri_corpus.txt:%d: %s is ", t->line, name);
+  if (s.p == NULL)
+    printf("(none)");
+  else
+    print_bytes(s.p, s.len);
+  printf(", want %s\n", want ? want : absent ? "(none)" : "(empty)");
+  return 0;
+}
+
+static int check_int(test_case *t, const char *name, int v, const char *want) {
+  int w = want ? atoi(want) : 0;
+
+  if (v == w)
+    return 1;
+  printf("FAIL uri_corpus.txt:%d: %s is %d, want %d\n", t->line, name, v, w);
+  return 0;
+}
+
+static void run_case(test_case *t) {
+  static const char *names[] = { "scheme", "userinfo", "hostport", "host", "port", "path", "query",
+                                 "fragment", "target", "auth", "ipv6", "port_num" };
+  enum { NFIELDS = sizeof(names) / sizeof(names[0]) };
+  char expect[MAXLINE], *want[NFIELDS] = { 0 }, *tok, *save, *eq;
+  uri_parts u;
+  int rc, i, ok = 1;
+
+  rc = parse(t, t->in, t->len, &u);
+  if (!strcmp(t->expect, "INVALID")) {
+    if (rc != -1) {
+      printf("FAIL uri_corpus.txt:%d: accepted, want INVALID\n", t->line);
+      failures++;
+    }
+    return;
+  }
+  if (rc != 0) {
+    printf("FAIL uri_corpus.txt:%d: INVALID, want accepted\n", t->line);
+    failures++;
+    return;
+  }
+
+  strcpy(expect, t->expect);
+  for (tok = strtok_r(expect, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)) {
+    if ((eq = strchr(tok, '=')) != NULL) {
+      *eq = '\0';
+      for (i = 0; i < NFIELDS && strcmp(tok, names[i]); i++)
+        ;
+      if (i < NFIELDS) {
+        want[i] = eq + 1;
+        continue;
+      }
+    }
+    fprintf(stderr, "uri_corpus.txt:%d: unknown field %s\n", t->line, tok);
+    exit(2);
+  }
+  ok &= check_slice(t, "scheme", u.scheme, want[0], 0);
+  ok &= check_slice(t, "userinfo", u.userinfo, want[1], 0);
+  ok &= check_slice(t, "hostport", u.hostport, want[2], 0);
+  ok &= check_slice(t, "host", u.host, want[3], 0);
+  ok &= check_slice(t, "port", u.port, want[4], 0);
+  ok &= check_slice(t, "path", u.path, want[5], 0);
+  ok &= check_slice(t, "query", u.query, want[6], 1);
+  ok &= check_slice(t, "fragment", u.fragment, want[7], 1);
+  ok &= check_slice(t, "target", u.target, want[8], 0);
+  ok &= check_int(t, "auth", u.has_authority, want[9]);
+  ok &= check_int(t, "ipv6", u.ipv6, want[10]);
+  ok &= check_int(t, "port_num", u.port_num, want[11]);
+  if (!ok)
+    failures++;
+}
+
+/*
+ * check_invariants - 받아들인 입력이면 결과가 지켜야 하는 것들. 틀리면 무엇이 틀렸는지, 맞으면 NULL
+ */
+static const char *check_invariants(test_case *t, char *in, int len, uri_parts *u) {
+  http_slice all[] = { u->scheme, u->userinfo, u->hostport, u->host, u->port, u->path, u->query,
+                       u->fragment, u->target };
+  char host[MAXLINE];
+  struct in6_addr addr;
+  int i, j, port = 0;
+
+  for (i = 0; i < (int)(sizeof(all) / sizeof(all[0])); i++) {
+    if (all[i].p == NULL)
+      continue;
+    if (all[i].len < 0 || all[i].p < in || all[i].p + all[i].len > in + len)
+      return "slice outside the input";
+    for (j = 0; j < all[i].len; j++)
+      if ((unsigned char)all[i].p[j] <= 0x20 || all[i].p[j] == 0x7f)
+        return "control character or space in a slice";
+  }
+  if (u->userinfo.len > 0 && memchr(u->userinfo.p, '@', u->userinfo.len) != NULL)
+    return "'@' in userinfo";
+  if (u->host.len == 0 && u->has_authority && uri_default_port(u->scheme))
+    return "http(s) with an empty host";
+  for (j = 0; j < u->port.len; j++) {
+    if (!isdigit((unsigned char)u->port.p[j]))
+      return "non-digit in port";
+    port = port * 10 + (u->port.p[j] - '0');
+    if (port > 65535)
+      return "port above 65535";
+  }
+  if (u->port.len > 0 ? u->port_num != port : u->port_num != (t->authority ? 0 : uri_default_port(u->scheme)))
+    return "port_num does not match port";
+  if (u->ipv6) {
+    if (http_slice_cpy(host, sizeof(host), u->host) < 0 || inet_pton(AF_INET6, host, &addr) != 1)
+      return "ipv6 host that inet_pton rejects";
+  } else if (u->host.len > 0 && (memchr(u->host.p, ':', u->host.len) || memchr(u->host.p, '[', u->host.len))) {
+    return "':' or '[' in a non-ipv6 host";
+  }
+  if (!t->authority && (u->target.p != u->path.p
+      || u->target.len != u->path.len + (u->query.p ? 1 + u->query.len : 0)))
+    return "target is not path ['?' query]";
+  return NULL;
+}
+
+// xorshift32, 고정 seed라 실패가 재현된다
+static unsigned int rnd_state = 2463534242u;
+
+static unsigned int rnd(void) {
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+/*
+ * fuzz - corpus 입력을 1~4번 바꿔서(글자 넣기, 빼기, 바꾸기) 파싱한다.
+ *   바꿀 글자는 URI 구조에 쓰이는 글자, 영숫자, 제어 문자, 아무 바이트 중에서 고른다
+ */
+static void fuzz(long iterations) {
+  static const char alphabet[] = ":/@[]?#%.-_~!$&'()*+,;=09afAFhx \t\r\n\x7f";
+  char buf[MAXLINE], *in;
+  const char *why;
+  long i, accepted = 0;
+  int len, k, m, pos;
+  uri_parts u;
+  unsigned char c;
+
+  for (i = 0; i < iterations; i++) {
+    test_case *t = &cases[rnd() % ncases];
+    len = t->len;
+    memcpy(buf, t->in, len);
+    for (m = 1 + rnd() % 4; m > 0; m--) {
+      k = rnd() % 8;
+      c = k < 6 ? alphabet[rnd() % (sizeof(alphabet) - 1)] : rnd();
+      pos = len > 0 ? rnd() % (len + 1) : 0;
+      if (k % 3 == 0 && len < (int)sizeof(buf) - 1) {          // 넣기
+        memmove(buf + pos + 1, buf + pos, len - pos);
+        buf[pos] = c;
+        len++;
+      } else if (k % 3 == 1 && pos < len) {                    // 빼기
+        memmove(buf + pos, buf + pos + 1, len - pos - 1);
+        len--;
+      } else if (pos < len) {                                  // 바꾸기
+        buf[pos] = c;
+      }
+    }
+    in = Malloc(len > 0 ? len : 1);
+    memcpy(in, buf, len);
+    if (parse(t, in, len, &u) == 0) {
+      accepted++;
+      if ((why = check_invariants(t, in, len, &u)) != NULL) {
+        printf("FAIL fuzz (%s of ", t->authority ? "authority" : "uri");
+        print_bytes(in, len);
+        printf("): %s\n", why);
+        if (++failures > 20)
+          exit(1);
+      }
+    }
+    Free(in);
+  }
+  printf("fuzz: %ld inputs, %ld accepted\n", iterations, accepted);
+}
+
+int main(int argc, char **argv) {
+  long iterations = argc > 2 ? atol(argv[2]) : 1000000;
+  uri_parts u;
+  const char *why;
+  int i, before;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <corpus> [fuzz iterations]\n", argv[0]);
+    exit(2);
+  }
+  load_corpus(argv[1]);
+  for (i = 0; i < ncases; i++) {
+    before = failures;
+    run_case(&cases[i]);
+    // corpus 입력 자체도 불변식을 지켜야 한다
+    if (failures == before && parse(&cases[i], cases[i].in, cases[i].len, &u) == 0
+        && (why = check_invariants(&cases[i], cases[i].in, cases[i].len, &u)) != NULL) {
+      printf("FAIL uri_corpus.txt:%d: %s\n", cases[i].line, why);
+      failures++;
+    }
+  }
+  printf("corpus: %d cases, %d failed\n", ncases, failures);
+  if (ncases > 0)
+    fuzz(iterations);
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,144 @@
+#!/bin/bash
+#
+# write_bench.sh - Drives proxy_cache with tiny as the origin and prints,
+#     per response, how many write() calls the proxy made and how many
+#     TCP segments went out, for cache misses and for cache hits.
+#
+#     usage: test/write_bench.sh [rounds [hits]]
+#
+#     Run it from the proxylab directory after make and make -C tiny
+#     (make bench does both). PROXY=<binary> measures another build,
+#     e.g. one made from an older commit, to compare before and after.
+#
+#     Every round starts a fresh proxy, fetches each file once (a miss,
+#     relayed through the output buffer) and then <hits> times (hits).
+#       client writes   outbuf counters from /proxy-status (misses only)
+#       write syscalls  syscw from /proc/<pid>/io; includes the request
+#                       the proxy writes to the origin on a miss
+#       segments        Tcp OutSegs from /proc/net/snmp. It counts the
+#                       whole host, so the same fetches are repeated
+#                       straight from tiny; "added" is proxied - direct
+#
+
+ROUNDS=${1:-5}
+HITS=${2:-20}
+PROXY=${PROXY:-./proxy_cache}
+FILES="home.html godzilla.jpg csapp.c tiny.c"
+HOME_DIR=`pwd`
+
+if [ ! -x "${PROXY}" ] || [ ! -x tiny/tiny ]; then
+    echo "write_bench: build ${PROXY} and tiny/tiny first (make bench)"
+    exit 1
+fi
+
+TINY_PORT=`./free-port.sh`
+PROXY_PORT=`expr ${TINY_PORT} + 1`
+ORIGIN="http://localhost:${TINY_PORT}"
+
+#####
+# Helper functions
+#
+
+# out_segs - the host's Tcp OutSegs counter
+function out_segs {
+    awk '/^Tcp:/ { if (n++) print $(col); else for (i = 1; i <= NF; i++) if ($i == "OutSegs") col = i }' /proc/net/snmp
+}
+
+# syscw - write syscalls made so far by process $1
+function syscw {
+    awk '/^syscw:/ { print $2 }' /proc/$1/io
+}
+
+# outbuf_counts - "responses writes" from the proxy's outbuf counters
+function outbuf_counts {
+    curl --silent --max-time 5 http://localhost:${PROXY_PORT}/proxy-status |
+        awk '/^client responses/ { print $3, $5; found = 1 } END { if (!found) print "0 0" }'
+}
+
+# wait_for_port - wait up to 5 seconds until something accepts on port $1
+#     (only connects: "GET /" to the proxy would be proxied to itself)
+function wait_for_port {
+    for i in `seq 50`; do
+        (exec 3<> /dev/tcp/localhost/$1) 2> /dev/null && return 0
+        sleep 0.1
+    done
+    echo "write_bench: nothing listening on port $1"
+    return 1
+}
+
+# fetch - fetch every file once, through the proxy if $1 is set
+function fetch {
+    for file in ${FILES}; do
+        curl --silent --max-time 5 --output /dev/null ${1:+--proxy http://localhost:$1} ${ORIGIN}/${file}
+    done
+}
+
+function cleanup {
+    kill ${PROXY_PID} ${TINY_PID} 2> /dev/null
+    wait 2> /dev/null
+}
+trap 'cleanup; exit 1' INT TERM
+
+#####
+# Measure
+#
+
+cd tiny
+./tiny ${TINY_PORT} > /dev/null 2>&1 &
+TINY_PID=$!
+cd ${HOME_DIR}
+wait_for_port ${TINY_PORT} || { cleanup; exit 1; }
+
+# Straight from tiny: the segments the proxy hop is compared against
+segs=`out_segs`
+for round in `seq ${ROUNDS}`; do
+    fetch
+done
+direct_segs=$(( `out_segs` - segs ))
+
+miss_n=0; miss_writes=0; miss_syscw=0; miss_segs=0
+hit_n=0; hit_syscw=0; hit_segs=0
+for round in `seq ${ROUNDS}`; do
+    ${PROXY} ${PROXY_PORT} > /dev/null 2>&1 &
+    PROXY_PID=$!
+    wait_for_port ${PROXY_PORT} || { cleanup; exit 1; }
+
+    read responses writes <<< `outbuf_counts`
+    w=`syscw ${PROXY_PID}`; segs=`out_segs`
+    fetch ${PROXY_PORT}
+    miss_syscw=$(( miss_syscw + `syscw ${PROXY_PID}` - w ))
+    miss_segs=$(( miss_segs + `out_segs` - segs ))
+    read responses2 writes2 <<< `outbuf_counts`
+    miss_n=$(( miss_n + responses2 - responses ))
+    miss_writes=$(( miss_writes + writes2 - writes ))
+
+    w=`syscw ${PROXY_PID}`; segs=`out_segs`
+    for i in `seq ${HITS}`; do
+        fetch ${PROXY_PORT}
+    done
+    hit_syscw=$(( hit_syscw + `syscw ${PROXY_PID}` - w ))
+    hit_segs=$(( hit_segs + `out_segs` - segs ))
+    hit_n=$(( hit_n + HITS * `echo ${FILES} | wc -w` ))
+
+    kill ${PROXY_PID}
+    wait ${PROXY_PID} 2> /dev/null
+done
+kill ${TINY_PID}
+wait 2> /dev/null
+
+#####
+# Report
+#
+
+nfiles=`echo ${FILES} | wc -w`
+awk -v proxy="${PROXY}" -v rounds=${ROUNDS} -v hits=${HITS} -v nfiles=${nfiles} \
+    -v direct=${direct_segs} \
+    -v mn=${miss_n} -v mw=${miss_writes} -v msw=${miss_syscw} -v ms=${miss_segs} \
+    -v hn=${hit_n} -v hsw=${hit_syscw} -v hs=${hit_segs} 'BEGIN {
+    d = direct / (rounds * nfiles)
+    printf "%s: %d rounds of %d files, %d hits per file\n", proxy, rounds, nfiles, hits
+    printf "%-6s %9s %15s %16s %10s %8s %8s\n", "", "responses", "client writes", "write syscalls", "segments", "direct", "added"
+    printf "%-6s %9d %15s %16.2f %10.2f %8.2f %8.2f\n", "miss", mn,
+        mn ? sprintf("%.2f", mw / mn) : "-", msw / (rounds * nfiles), ms / (rounds * nfiles), d, ms / (rounds * nfiles) - d
+    printf "%-6s %9d %15s %16.2f %10.2f %8.2f %8.2f\n", "hit", hn, "-", hsw / hn, hs / hn, d, hs / hn - d
+}'
@@ -1,6 +1,19 @@
 /* 
  * csapp.c - Functions for the CS:APP3e book
  *
+ * Updated for the proxy:
+ *   - rio_readlineb: copies whole runs from the internal buffer instead of
+ *     one byte per rio_read call; newlines are found with SSE2/AVX2 scans
+ *   - Added rio_readline_view, rio_readhdrs_view and rio_readn_view,
+ *     which return pointers into the internal buffer instead of copying
+ *   - Added rio_writev, a gather version of rio_writen
+ *   - rio_t records whether the last read() drained the descriptor, so
+ *     callers can tell when the next read would block
+ *   - Added open_unix_clientfd and open_unix_listenfd; open_listenfd
+ *     listens on a Unix domain socket when given "unix:<path>"
+ *   - Added open_clientfd_timeout, which races the server's addresses
+ *     with staggered non-blocking connects (RFC 8305) under a deadline
+ *
  * Updated 10/2016 reb:
  *   - Fixed bug in sio_ltoa that didn't cover negative numbers
  *
@@ -24,6 +37,11 @@
 /* $begin csapp.c */
 #include "csapp.h"
 
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define RIO_SIMD 1
+#endif
+
 /************************** 
  * Error-handling functions
  **************************/
@@ -792,6 +810,45 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write an iovec list (unbuffered). Short writes
+ *    are resumed where they stopped, so iov[] is modified. Returns the
+ *    number of bytes written or -1 on error.
+ */
+/* $begin rio_writev */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    ssize_t nwritten;
+    int cnt;
+
+    while (iovcnt > 0) {
+	if (iov->iov_len == 0) {  /* Skip empty entries */
+	    iov++;
+	    iovcnt--;
+	    continue;
+	}
+	cnt = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+	if ((nwritten = writev(fd, iov, cnt)) <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;        /* and call writev() again */
+	    return -1;           /* errno set by writev() */
+	}
+	total += nwritten;
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (nwritten > 0) {      /* Partially written entry */
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return total;
+}
+/* $end rio_writev */
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -815,8 +872,10 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 	}
 	else if (rp->rio_cnt == 0)  /* EOF */
 	    return 0;
-	else 
+	else {
 	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+	    rp->rio_drained = rp->rio_cnt < RIO_BUFSIZE;
+	}
     }
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
@@ -839,6 +898,7 @@ void rio_readinitb(rio_t *rp, int fd)
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
     rp->rio_bufptr = rp->rio_buf;
+    rp->rio_drained = 0;
 }
 /* $end rio_readinitb */
 
@@ -864,34 +924,242 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 }
 /* $end rio_readnb */
 
+/*
+ * rio_scan_nl - Return a pointer to the first '\n' in [p, end), or NULL.
+ *    Scans 32 (AVX2) or 16 (SSE2) bytes per step; the AVX2 path is picked
+ *    at run time, and other targets fall back to a byte loop.
+ */
+/* $begin rio_scan_nl */
+static char *rio_scan_nl_scalar(char *p, char *end)
+{
+    for (; p < end; p++)
+        if (*p == '\n')
+            return p;
+    return NULL;
+}
+
+#ifdef RIO_SIMD
+static char *rio_scan_nl_sse2(char *p, char *end)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    int mask;
+
+    for (; p + 16 <= end; p += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)p), nl));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return rio_scan_nl_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static char *rio_scan_nl_avx2(char *p, char *end)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    unsigned int mask;
+
+    for (; p + 32 <= end; p += 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)p), nl));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return rio_scan_nl_sse2(p, end);
+}
+#endif
+
+/* 
+ * Which scan rio_scan_nl uses on x86: 2 = AVX2, 1 = SSE2, 0 = byte loop,
+ * -1 = not picked yet. Picked on first use (a racy first call is harmless:
+ * every thread gets the same answer); test/rio_test.c sets it to run
+ * the same input through every path.
+ */
+#ifdef RIO_SIMD
+static int rio_scan_level = -1;
+#endif
+
+static char *rio_scan_nl(char *p, char *end)
+{
+#ifdef RIO_SIMD
+    if (rio_scan_level < 0)
+        rio_scan_level = __builtin_cpu_supports("avx2") ? 2 : 1;
+    if (rio_scan_level == 2)
+        return rio_scan_nl_avx2(p, end);
+    if (rio_scan_level == 1)
+        return rio_scan_nl_sse2(p, end);
+#endif
+    return rio_scan_nl_scalar(p, end);
+}
+/* $end rio_scan_nl */
+
+/*
+ * rio_fill - Move the unread bytes to the front of the internal buffer
+ *    and read more behind them. Returns the number of bytes read, 0 on
+ *    EOF, or -1 on error.
+ */
+/* $begin rio_fill */
+static ssize_t rio_fill(rio_t *rp)
+{
+    ssize_t n;
+
+    if (rp->rio_cnt < 0)
+        rp->rio_cnt = 0;
+    if (rp->rio_bufptr != rp->rio_buf) {
+        if (rp->rio_cnt > 0)
+            memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+        rp->rio_bufptr = rp->rio_buf;
+    }
+    while ((n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+                     RIO_BUFSIZE - rp->rio_cnt)) < 0) {
+        if (errno != EINTR) /* Interrupted by sig handler return */
+            return -1;
+    }
+    rp->rio_drained = n < RIO_BUFSIZE - rp->rio_cnt;
+    rp->rio_cnt += n;
+    return n;
+}
+/* $end rio_fill */
+
 /* 
  * rio_readlineb - Robustly read a text line (buffered)
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
+
+    if (maxlen == 0)
+        return 0;
+    while (n + 1 < maxlen) {
+        if (rp->rio_cnt <= 0) {
+            if ((rc = rio_fill(rp)) < 0)
+                return -1;   /* Error */
+            if (rc == 0)
+                break;       /* EOF */
+        }
+        /* Copy up to and including the newline in one go */
+        cnt = rp->rio_cnt;
+        if (cnt > maxlen - 1 - n)
+            cnt = maxlen - 1 - n;
+        if ((nl = rio_scan_nl(rp->rio_bufptr, rp->rio_bufptr + cnt)) != NULL)
+            cnt = nl + 1 - rp->rio_bufptr;
+        memcpy(bufp + n, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        n += cnt;
+        if (nl != NULL)
+            break;
+    }
+    bufp[n] = 0;
+    return n;
+}
+/* $end rio_readlineb */
+
+/*
+ * rio_readline_view - Read a text line without copying it. On return
+ *    *linep points at the line inside the internal buffer; it stays valid
+ *    until the next read from rp. Returns the line length (including the
+ *    '\n'), 0 on EOF, -1 on error. A line longer than RIO_BUFSIZE comes
+ *    back in RIO_BUFSIZE pieces.
+ */
+/* $begin rio_readline_view */
+ssize_t rio_readline_view(rio_t *rp, char **linep)
+{
+    size_t scanned = 0, len;
+    ssize_t rc;
+    char *nl;
 
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
+    for (;;) {
+        if (rp->rio_cnt > 0 && (nl = rio_scan_nl(rp->rio_bufptr + scanned,
+                                                 rp->rio_bufptr + rp->rio_cnt)) != NULL) {
+            len = nl + 1 - rp->rio_bufptr;
+            break;
+        }
+        scanned = rp->rio_cnt > 0 ? rp->rio_cnt : 0;
+        if (scanned >= RIO_BUFSIZE) {
+            len = scanned;  /* Line longer than the buffer */
+            break;
+        }
+        if ((rc = rio_fill(rp)) < 0)
+            return -1;
+        if (rc == 0) {
+            if (rp->rio_cnt <= 0)
+                return 0;   /* EOF, no data read */
+            len = rp->rio_cnt; /* EOF, some data was read */
+            break;
+        }
+    }
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += len;
+    rp->rio_cnt -= len;
+    return len;
+}
+/* $end rio_readline_view */
+
+/*
+ * rio_readhdrs_view - Read a whole HTTP message head (start line and
+ *    header lines up to and including the empty line) without copying
+ *    it. *hdrsp points into the internal buffer and stays valid until
+ *    the next read from rp. Returns the head length, 0 on EOF before a
+ *    complete head, -1 on error (errno is EMSGSIZE if the head does not
+ *    fit in RIO_BUFSIZE).
+ */
+/* $begin rio_readhdrs_view */
+ssize_t rio_readhdrs_view(rio_t *rp, char **hdrsp)
+{
+    size_t pos = 0, len;     /* pos: start of the next unexamined line */
+    ssize_t rc;
+    char *line, *nl;
+
+    for (;;) {
+        while (rp->rio_cnt > 0 && (nl = rio_scan_nl(rp->rio_bufptr + pos,
+                                                    rp->rio_bufptr + rp->rio_cnt)) != NULL) {
+            line = rp->rio_bufptr + pos;
+            if (nl == line || (nl == line + 1 && *line == '\r')) {
+                len = nl + 1 - rp->rio_bufptr;
+                *hdrsp = rp->rio_bufptr;
+                rp->rio_bufptr += len;
+                rp->rio_cnt -= len;
+                return len;
             }
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+            pos = nl + 1 - rp->rio_bufptr;
+        }
+        if (rp->rio_cnt >= RIO_BUFSIZE) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        if ((rc = rio_fill(rp)) < 0)
+            return -1;
+        if (rc == 0)
+            return 0;       /* EOF */
     }
-    *bufp = 0;
-    return n-1;
 }
-/* $end rio_readlineb */
+/* $end rio_readhdrs_view */
+
+/*
+ * rio_readn_view - Read up to n bytes without copying them. Returns
+ *    whatever is buffered (refilling the buffer first if it is empty),
+ *    so the count may be less than n; 0 on EOF, -1 on error. *bufp
+ *    stays valid until the next read from rp.
+ */
+/* $begin rio_readn_view */
+ssize_t rio_readn_view(rio_t *rp, char **bufp, size_t n)
+{
+    ssize_t rc;
+
+    if (rp->rio_cnt <= 0) {
+        if ((rc = rio_fill(rp)) <= 0)
+            return rc;
+    }
+    if (n > (size_t)rp->rio_cnt)
+        n = rp->rio_cnt;
+    *bufp = rp->rio_bufptr;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return n;
+}
+/* $end rio_readn_view */
 
 /**********************************
  * Wrappers for robust I/O routines
@@ -911,6 +1179,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 	unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    if (rio_writev(fd, iov, iovcnt) < 0)
+	unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -934,6 +1208,15 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+ssize_t Rio_readline_view(rio_t *rp, char **linep)
+{
+    ssize_t rc;
+
+    if ((rc = rio_readline_view(rp, linep)) < 0)
+	unix_error("Rio_readline_view error");
+    return rc;
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
@@ -985,6 +1268,163 @@ int open_clientfd(char *hostname, char *port) {
 }
 /* $end open_clientfd */
 
+/*
+ * open_clientfd_timeout - Like open_clientfd, but never blocks for more
+ *     than total_ms, and a dead address does not hold up the others.
+ *     The addresses are reordered to alternate between families, and a
+ *     new non-blocking connect is started every CONNECT_STAGGER_MS (or as
+ *     soon as an earlier one fails) while earlier ones stay in flight, as
+ *     in Happy Eyeballs (RFC 8305). Each attempt is given up after
+ *     attempt_ms. The first socket to connect is returned in blocking
+ *     mode and the rest are closed. A limit <= 0 means no limit.
+ *     Returns -2 for getaddrinfo error, -1 with errno set on other errors
+ *     (ETIMEDOUT when time ran out).
+ */
+/* $begin open_clientfd_timeout */
+#define CONNECT_STAGGER_MS 250  /* RFC 8305 Connection Attempt Delay */
+#define CONNECT_MAX_ADDRS 16    /* Addresses tried per call */
+#define CONNECT_NO_LIMIT (1LL << 40)
+
+static long long mono_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int open_clientfd_timeout(char *hostname, char *port, int attempt_ms, int total_ms)
+{
+    struct addrinfo hints, *listp, *p;
+    struct addrinfo *addrs[CONNECT_MAX_ADDRS], *same[CONNECT_MAX_ADDRS], *other[CONNECT_MAX_ADDRS];
+    struct pollfd pfds[CONNECT_MAX_ADDRS];
+    long long started[CONNECT_MAX_ADDRS], now, deadline, next_start, wait, attempt;
+    int naddrs = 0, nsame = 0, nother = 0, next = 0, npending = 0;
+    int clientfd = -1, err = ETIMEDOUT, fd, soerr, rc, i;
+    socklen_t len;
+
+    /* Get a list of potential server addresses */
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if ((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0) {
+        fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", hostname, port, gai_strerror(rc));
+        return -2;
+    }
+
+    /* Alternate families, keeping the resolver's order within each */
+    for (p = listp; p && nsame + nother < CONNECT_MAX_ADDRS; p = p->ai_next) {
+        if (p->ai_family == listp->ai_family)
+            same[nsame++] = p;
+        else
+            other[nother++] = p;
+    }
+    for (i = 0; i < nsame || i < nother; i++) {
+        if (i < nsame)
+            addrs[naddrs++] = same[i];
+        if (i < nother)
+            addrs[naddrs++] = other[i];
+    }
+
+    attempt = attempt_ms > 0 ? attempt_ms : CONNECT_NO_LIMIT;
+    now = next_start = mono_ms();
+    deadline = now + (total_ms > 0 ? total_ms : CONNECT_NO_LIMIT);
+    for (;;) {
+        /* Start the next attempt when its turn comes or nothing is in flight */
+        while (clientfd < 0 && next < naddrs && (now >= next_start || npending == 0)) {
+            p = addrs[next++];
+            if ((fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol)) < 0) {
+                err = errno;
+                continue;
+            }
+            if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+                clientfd = fd;
+            } else if (errno == EINPROGRESS) {
+                pfds[npending].fd = fd;
+                pfds[npending].events = POLLOUT;
+                started[npending++] = now;
+                next_start = now + CONNECT_STAGGER_MS;
+            } else {
+                err = errno;
+                close(fd);
+            }
+        }
+        if (clientfd >= 0)
+            break;
+
+        /* Drop attempts that ran out of time; the next one may start now */
+        for (i = 0; i < npending; ) {
+            if (now - started[i] >= attempt) {
+                close(pfds[i].fd);
+                pfds[i] = pfds[--npending];
+                started[i] = started[npending];
+                next_start = now;
+                err = ETIMEDOUT;
+            } else {
+                i++;
+            }
+        }
+        if (now >= deadline) {
+            err = ETIMEDOUT;
+            break;
+        }
+        if (npending == 0) {
+            if (next == naddrs)
+                break;  /* Every address failed */
+            continue;
+        }
+
+        /* Sleep until something connects, fails, or a timer comes due */
+        wait = deadline - now;
+        if (next < naddrs && next_start - now < wait)
+            wait = next_start - now;
+        for (i = 0; i < npending; i++)
+            if (started[i] + attempt - now < wait)
+                wait = started[i] + attempt - now;
+        if (wait > 60000)
+            wait = 60000;
+        rc = poll(pfds, npending, (int)wait);
+        now = mono_ms();
+        if (rc < 0 && errno != EINTR) {
+            err = errno;
+            break;
+        }
+        for (i = 0; rc > 0 && i < npending; ) {
+            if (pfds[i].revents == 0) {
+                i++;
+                continue;
+            }
+            len = sizeof(soerr);
+            if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &soerr, &len) < 0)
+                soerr = errno;
+            if (soerr == 0) {
+                clientfd = pfds[i].fd;
+                pfds[i] = pfds[--npending];
+                break;
+            }
+            err = soerr;
+            close(pfds[i].fd);
+            pfds[i] = pfds[--npending];
+            started[i] = started[npending];
+            next_start = now;
+        }
+        if (clientfd >= 0)
+            break;
+    }
+
+    /* Clean up */
+    for (i = 0; i < npending; i++)
+        close(pfds[i].fd);
+    freeaddrinfo(listp);
+    if (clientfd < 0) {
+        errno = err;
+        return -1;
+    }
+    fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) & ~O_NONBLOCK);
+    return clientfd;
+}
+/* $end open_clientfd_timeout */
+
 /*  
  * open_listenfd - Open and return a listening socket on port. This
  *     function is reentrant and protocol-independent.
@@ -999,6 +1439,9 @@ int open_listenfd(char *port)
     struct addrinfo hints, *listp, *p;
     int listenfd, rc, optval=1;
 
+    if (!strncmp(port, "unix:", 5))
+        return open_unix_listenfd(port + 5);
+
     /* Get a list of potential server addresses */
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_socktype = SOCK_STREAM;             /* Accept connections */
@@ -1043,6 +1486,71 @@ int open_listenfd(char *port)
 }
 /* $end open_listenfd */
 
+/*
+ * unix_addr - Fill in a sockaddr_un for path. Returns its length, or -1
+ *     with errno set if the path does not fit.
+ */
+static int unix_addr(char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return offsetof(struct sockaddr_un, sun_path) + strlen(path) + 1;
+}
+
+/*
+ * open_unix_clientfd - Open a connection to the Unix domain socket at
+ *     path, for servers on the same host. Returns -1 with errno set on
+ *     error.
+ */
+/* $begin open_unix_clientfd */
+int open_unix_clientfd(char *path)
+{
+    struct sockaddr_un addr;
+    int clientfd, len;
+
+    if ((len = unix_addr(path, &addr)) < 0)
+        return -1;
+    if ((clientfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (connect(clientfd, (SA *)&addr, len) < 0) {
+        close(clientfd);
+        return -1;
+    }
+    return clientfd;
+}
+/* $end open_unix_clientfd */
+
+/*
+ * open_unix_listenfd - Open a listening Unix domain socket at path. A
+ *     socket file left behind by an earlier run is removed first.
+ *     Returns -1 with errno set on error.
+ */
+/* $begin open_unix_listenfd */
+int open_unix_listenfd(char *path)
+{
+    struct sockaddr_un addr;
+    struct stat sbuf;
+    int listenfd, len;
+
+    if ((len = unix_addr(path, &addr)) < 0)
+        return -1;
+    if (stat(path, &sbuf) == 0 && S_ISSOCK(sbuf.st_mode))
+        unlink(path);
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (bind(listenfd, (SA *)&addr, len) < 0 || listen(listenfd, LISTENQ) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+/* $end open_unix_listenfd */
+
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
  ****************************************************/
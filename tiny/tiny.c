@@ -8,6 +8,8 @@
  */
 #include "csapp.h"
 
+#define FILETYPE_MAX 32   /* Size of get_filetype's result buffer */
+
 void doit(int fd);
 void read_requesthdrs(rio_t *rp);
 int parse_uri(char *uri, char *filename, char *cgiargs);
@@ -20,6 +22,10 @@ void serve_dynamic(int fd, char *filename, char *cgiargs, char *method);
 
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg,
                  char *longmsg);
+void conn_error(char *msg);
+
+/* I/O errors on single connections. Tiny drops that connection and keeps serving. */
+static unsigned long conn_errors;
 
 void doit(int fd)   // fd : 연결 요청 후에 리턴받은 연결 식별자
 {
@@ -34,7 +40,13 @@ void doit(int fd)   // fd : 연결 요청 후에 리턴받은 연결 식별자
   /* Read request line and headers */
   // rio_readlineb : 텍스트 줄을 파일 rp에서부터 읽고 usrbuf로 복사, 읽은 텍스트 라인을 null로 바꾸고 종료. maxlen-1 만큼의 바이트를 읽고 나머지 텍스트는 잘러서 null문자로 종료
   Rio_readinitb(&rio, fd);      // 읽기 버퍼 초기화. rio_t 타입의 읽기 버퍼와 식별자 connfd 연결
-  Rio_readlineb(&rio, buf, MAXLINE);    // 클라이언트가 보낸 요청 라인을 읽고 분석, buf에 복사
+  // 클라이언트가 보낸 요청 라인을 읽고 분석, buf에 복사. 요청 없이 끊었거나 에러면 이 연결만 끝낸다
+  ssize_t n = rio_readlineb(&rio, buf, MAXLINE);
+  if (n <= 0) {
+    if (n < 0)
+      conn_error("read request");
+    return;
+  }
   printf("Request headers:\n");
   printf("%s", buf);    // 최초 요청 라인 : GET / HTTP/1.1    method에 GET, uri에 /, version에 HTTP/1.1
   sscanf(buf, "%s %s %s", method, uri, version);    // 문자열에서 형식화된 데이터 읽어와서 각 변수에 맵핑
@@ -103,29 +115,33 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
   sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
 
   /* Print the HTTP response */
-  // buf에 문자열을 한 줄씩 추가하고 포인터를 당기면서 writen으로 전송
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));     
+  // buf에 헤더를 모아서 writen으로 전송. 클라이언트가 끊었으면 더 보내지 않는다
+  sprintf(buf, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n\r\n",
+          errnum, shortmsg, (int)strlen(body));
+  if (rio_writen(fd, buf, strlen(buf)) < 0) {
+    conn_error("write error response");
+    return;
+  }
 
   // 중첩시킨 html문자열 전송
-  Rio_writen(fd, body, strlen(body));
+  if (rio_writen(fd, body, strlen(body)) < 0)
+    conn_error("write error response");
+}
+
+/* conn_error - count and report an error on one connection; errno is from the failed call */
+void conn_error(char *msg)
+{
+  conn_errors++;
+  fprintf(stderr, "%s: %s (%lu connection errors so far)\n", msg, strerror(errno), conn_errors);
 }
 
 void read_requesthdrs(rio_t *rp)
 {
   char buf[MAXLINE];
 
-  // 처음 읽은 요청 외에 모든 요청은 출력
-  Rio_readlineb(rp, buf, MAXLINE);
-  while (strcmp(buf, "\r\n"))
-  {
-    Rio_readlineb(rp, buf, MAXLINE);
+  // 처음 읽은 요청 외에 모든 요청은 출력. 빈 줄 전에 끊기면(EOF나 에러) 거기서 멈춘다
+  while (rio_readlineb(rp, buf, MAXLINE) > 0 && strcmp(buf, "\r\n"))
     printf("%s", buf);
-  }
   return;
 }
 
@@ -172,33 +188,43 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
 void serve_static(int fd, char *filename, int filesize, char *method)
 {
   int srcfd;
-  char *srcp, filetype[MAXLINE], buf[MAXBUF];
+  char *srcp, filetype[FILETYPE_MAX], buf[MAXBUF];
 
   /* Send response headers to client */
   // 헤더 정보를 바이트로 포맷. 반환값과 기능 중 하나를 포함하는 긴 문자열
   // 버퍼에 HTTP 문법에 맞게 헤더 출력
   get_filetype(filename, filetype);  
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");    // \r : 커서를 현재 줄의 맨 앞으로 이동
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-  sprintf(buf, "%sConnection: close\r\n", buf);     // tiny 서버 구조상 while문 한번 돌면 close하기 때문
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-  Rio_writen(fd, buf, strlen(buf));   // fd : 서버 입장에서 클라이언트와 연결된 소켓. fd에 지금까지 버퍼에 기록한 내용을 write
-  printf("Response headers:\n");
-  printf("%s", buf);
 
-  if (strcasecmp(method, "HEAD") == 0)
-    return;
+  // 헤더를 보내기 전에 파일을 열고 맵핑한다. 그 사이에 지워졌거나 열 수 없으면 200 대신 에러를 보낸다
+  // filename에 해당하는 파일을 읽기 권한으로 열기. O_RDONLY : 모드, 0 : 사용자에게 ~ 권한을 준다
+  srcp = NULL;
+  if (strcasecmp(method, "HEAD") && filesize > 0) {
+    if ((srcfd = open(filename, O_RDONLY, 0)) < 0) {
+      clienterror(fd, filename, "404", "Not found", "Tiny couldn't open this file");
+      return;
+    }
+    // mmap: 파일이나 디바이스를 주소 공간 메모리에 대응.
+    // 공간을 매핑하고자 하는 주소. 0은 디폴트, 주소 공간의 크기, 읽기 모드, 대응된 페이지 복사본 수정을 그 프로세스에만 보이게 할 것인지?, 파일 디스크럽터, 매핑하고자 하는 물리 주소
+    srcp = mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
+    close(srcfd);   // 파일을 메모리에 맵핑한 후에는 식별자가 필요없음.
+    if (srcp == MAP_FAILED) {
+      clienterror(fd, filename, "500", "Internal Server Error", "Tiny couldn't map the file");
+      return;
+    }
+  }
 
-  /* Send response body to client */
-  // filename에 해당하는 파일을 읽기 권한으로 열기
-  srcfd = Open(filename, O_RDONLY, 0);      //O_RDONLY : 모드, 0 : 사용자에게 ~ 권한을 준다
-  // Mmap: 파일이나 디바이스를 주소 공간 메모리에 대응. 
-  // 공간을 매핑하고자 하는 주소. 0은 디폴트, 주소 공간의 크기, 읽기 모드, 대응된 페이지 복사본 수정을 그 프로세스에만 보이게 할 것인지?, 파일 디스크럽터, 매핑하고자 하는 물리 주소
-  srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);   
-  Close(srcfd);   // 파일을 메모리에 맵핑한 후에는 식별자가 필요없음.
-  Rio_writen(fd, srcp, filesize);
-  Munmap(srcp, filesize);   // mmap() 함수로 할당된 메모리 영역 해제
+  // \r : 커서를 현재 줄의 맨 앞으로 이동. Connection: close는 tiny 서버 구조상 while문 한번 돌면 close하기 때문
+  snprintf(buf, MAXBUF, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\nConnection: close\r\n"
+           "Content-length: %d\r\nContent-type: %s\r\n\r\n", filesize, filetype);
+  // fd : 서버 입장에서 클라이언트와 연결된 소켓. fd에 지금까지 버퍼에 기록한 내용을 write
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    conn_error("write response headers");
+  else if (srcp != NULL && rio_writen(fd, srcp, filesize) < 0)   /* Send response body to client */
+    conn_error("write response body");
+  printf("Response headers:\n");
+  printf("%s", buf);
+  if (srcp != NULL)
+    munmap(srcp, filesize);   // mmap() 함수로 할당된 메모리 영역 해제
 
   // /* Send response body to client */
   // // mmap을 malloc으로 구현
@@ -213,7 +239,8 @@ void serve_static(int fd, char *filename, int filesize, char *method)
 }
 
 /*
- * get_filetype - Derive file type from filename
+ * get_filetype - Derive file type from filename. filetype must hold
+ *     FILETYPE_MAX bytes
  */
 // 파일 타입 결정해주기
 void get_filetype(char *filename, char *filetype)
@@ -238,24 +265,31 @@ void get_filetype(char *filename, char *filetype)
 void serve_dynamic(int fd, char *filename, char *cgiargs, char* method)
 {
   char buf[MAXLINE], *emptylist[] = { NULL };
+  pid_t pid;
 
   /* Return first part of HTTP response */
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  Rio_writen(fd, buf, strlen(buf));   // 버퍼의 길이만큼 fd에 write
-  sprintf(buf, "Server: Tiny Web Server\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  sprintf(buf, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n");
+  if (rio_writen(fd, buf, strlen(buf)) < 0) {   // 버퍼의 길이만큼 fd에 write
+    conn_error("write response headers");
+    return;
+  }
 
   if (strcasecmp(method, "HEAD") == 0)
     return;
 
-  if (Fork() == 0)    /* Child */     // serve_dynamin이 부모 프로세스, 아래 코드들이 자식 프로세스가 됨. 부모 프로세스에는 return 자식 프로세스의 pid, 자식 프로세스에는 return 0
+  // fork가 실패하면(프로세스가 너무 많으면) 이 응답만 헤더에서 끝난다
+  if ((pid = fork()) < 0) {
+    conn_error("fork");
+    return;
+  }
+  if (pid == 0)    /* Child */     // serve_dynamin이 부모 프로세스, 아래 코드들이 자식 프로세스가 됨. 부모 프로세스에는 return 자식 프로세스의 pid, 자식 프로세스에는 return 0
   {
     /* Real server would set all CGI vars here */
     setenv("QUERY_STRING", cgiargs, 1);     // "QUERY_STRING" 이라는 환경 변수 추가. 이미 이런 환경변수 룰이 정해져 있다. 1은 강제로 바꿈, 0은 cgiargs가 비어있지 않으면 그대로 둠
     Dup2(fd, STDOUT_FILENO);                /* Redirect stdout to client */     // fd : 클라이언트와 서버의 소켓 커넥션. 표준 출력을 클라이언트와 연관된 연결식별자로 재지정. CGI프로그램의 모든 표준 출력은 클라이언트로 향함.
     Execve(filename, emptylist, environ);   /* Run CGI programs */    // 주소의 adder?15000&213  에서 15000&213 부분 참조
   }
-  Wait(NULL); /* Parent waits for and reaps child */    // 부모 프로세스는 여기서 기다린다.
+  waitpid(pid, NULL, 0); /* Parent waits for and reaps child */    // 부모 프로세스는 여기서 기다린다.
 }
 
 int main(int argc, char **argv)   // ./tiny {포트번호} 로 실행했으니 argv[0] = tiny.exe, argv[1] = 포트번호
@@ -267,23 +301,34 @@ int main(int argc, char **argv)   // ./tiny {포트번호} 로 실행했으니 a
 
   /* Check command line args */
   if (argc != 2) {    // 입력 인자가 2개 아니면 에러
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    fprintf(stderr, "usage: %s <port | unix:path>\n", argv[0]);
     exit(1);
   }
 
   // Open_listenfd 함수를 호출해서 듣기 소켓 오픈. 인자로 포트 번호를 넘겨줌
-  // listenfd에 듣기 식별자 리턴
+  // listenfd에 듣기 식별자 리턴. "unix:/path"면 같은 호스트의 프록시용 Unix domain socket
   listenfd = Open_listenfd(argv[1]);
+  Signal(SIGPIPE, SIG_IGN);   // 클라이언트가 끊은 소켓에 쓰면 SIGPIPE로 죽는 대신 EPIPE를 받는다
 
   // 요청 받는 무한 루프
   while (1) {
     clientlen = sizeof(clientaddr);   // 클라이언트 주소 길이
-    connfd = Accept(listenfd, (SA *)&clientaddr,    // listenfd와 cliendaddr를 합쳐서 connfd를 만들기.
+    connfd = accept(listenfd, (SA *)&clientaddr,    // listenfd와 cliendaddr를 합쳐서 connfd를 만들기.
                     &clientlen);  // line:netp:tiny:accept      // 듣기 식별자, 소켓 주소 구조체의 주소, 주소 길이를 파라미터로 입력. 연결 요청 접수
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
-                0);   // 소켓 구조체를 호스트의 서비스들(문자열)로 변환
+    if (connfd < 0) {   // 대기열에서 끊긴 연결이나 fd 부족은 그 연결만 버린다
+      conn_error("accept");
+      continue;
+    }
+    if (clientaddr.ss_family == AF_UNIX) {  // Unix domain socket에는 호스트/포트가 없다
+      strcpy(hostname, "unix");
+      strcpy(port, argv[1] + 5);
+    } else if (getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
+                           NI_NUMERICHOST | NI_NUMERICSERV) != 0) {   // 소켓 구조체를 숫자 주소/포트 문자열로 변환
+      strcpy(hostname, "?");
+      strcpy(port, "?");
+    }
     printf("Accepted connection from (%s, %s)\n", hostname, port);
     doit(connfd);   // line:netp:tiny:doit      // 트랜잭션 수행
-    Close(connfd);  // line:netp:tiny:close     // 연결 끝. 소켓 닫기.
+    close(connfd);  // line:netp:tiny:close     // 연결 끝. 소켓 닫기.
   }
 }
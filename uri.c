@@ -0,0 +1,224 @@
+/*
+ * uri.c - RFC 3986 URI parser
+ *
+ *   URI       = scheme ":" [ "//" authority ] path [ "?" query ] [ "#" fragment ]
+ *   authority = [ userinfo "@" ] host [ ":" port ]
+ *   host      = "[" IPv6address "]" / IPv4address / reg-name
+ *
+ * 구조(scheme, authority, host, port)와 userinfo/host 문자는 RFC대로 엄격하게 검사한다.
+ * path/query/fragment는 브라우저들이 인코딩 없이 보내는 문자({, |, ^ 등)가 흔해서
+ * 제어 문자와 공백만 거부한다.
+ */
+#include "uri.h"
+
+// 문자 종류. 비트로 조합해서 256칸 표 하나로 한 번에 검사한다
+#define C_ALPHA   0x01
+#define C_DIGIT   0x02
+#define C_UNRES   0x04   // unreserved 중 영숫자가 아닌 것: - . _ ~
+#define C_SUB     0x08   // sub-delims: ! $ & ' ( ) * + , ; =
+#define C_SCHEME  0x10   // scheme에서 첫 글자 뒤에 올 수 있는 + - .
+#define C_HEX     0x20
+#define C_VISIBLE 0x40   // 제어 문자/공백이 아닌 것 (0x80 이상 포함)
+
+static unsigned char cls[256];
+static pthread_once_t cls_once = PTHREAD_ONCE_INIT;
+
+static void cls_init(void) {
+  int c;
+  const char *s;
+
+  for (c = 0; c < 256; c++) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+      cls[c] |= C_ALPHA;
+    if (c >= '0' && c <= '9')
+      cls[c] |= C_DIGIT | C_HEX;
+    if ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+      cls[c] |= C_HEX;
+    if (c > 0x20 && c != 0x7f)
+      cls[c] |= C_VISIBLE;
+  }
+  for (s = "-._~"; *s; s++)
+    cls[(unsigned char)*s] |= C_UNRES;
+  for (s = "!$&'()*+,;="; *s; s++)
+    cls[(unsigned char)*s] |= C_SUB;
+  for (s = "+-."; *s; s++)
+    cls[(unsigned char)*s] |= C_SCHEME;
+}
+
+#define IS(c, mask) (cls[(unsigned char)(c)] & (mask))
+
+static inline http_slice mkslice(const char *p, const char *end) {
+  http_slice s = { (char *)p, (int)(end - p) };
+  return s;
+}
+
+// authority의 끝: 첫 '/' 나 '?'. 없으면 end
+static inline const char *authority_end(const char *p, const char *end) {
+  while (p < end && *p != '/' && *p != '?')
+    p++;
+  return p;
+}
+
+static inline const char *find_char(const char *p, const char *end, int c) {
+  const char *q = memchr(p, c, end - p);
+  return q ? q : end;
+}
+
+/*
+ * valid_chars - [p, end)가 mask에 든 문자와 (pct가 1이면) "%" HEXDIG HEXDIG, extra에 든 문자로만 되어 있으면 1
+ */
+static int valid_chars(const char *p, const char *end, int mask, int pct, const char *extra) {
+  for (; p < end; p++) {
+    if (IS(*p, mask))
+      continue;
+    if (pct && *p == '%') {
+      if (end - p < 3 || !IS(p[1], C_HEX) || !IS(p[2], C_HEX))
+        return 0;
+      p += 2;
+      continue;
+    }
+    if (extra == NULL || *p == '\0' || strchr(extra, *p) == NULL)
+      return 0;
+  }
+  return 1;
+}
+
+// IPv6address (zone id는 받지 않는다). inet_pton이 NUL 문자열을 원하므로 스택에 복사한다.
+// 복사하기 전에 글자를 먼저 본다. 중간에 NUL이 있으면 inet_pton은 그 앞까지만 보기 때문이다
+static int valid_ipv6(const char *p, const char *end) {
+  char buf[INET6_ADDRSTRLEN];
+  struct in6_addr addr;
+
+  if (end - p <= 0 || end - p >= (int)sizeof(buf) || !valid_chars(p, end, C_HEX, 0, ":."))
+    return 0;
+  memcpy(buf, p, end - p);
+  buf[end - p] = '\0';
+  return inet_pton(AF_INET6, buf, &addr) == 1;
+}
+
+/*
+ * uri_default_port - scheme의 기본 포트. 모르는 scheme이면 0
+ */
+int uri_default_port(http_slice scheme) {
+  if (http_slice_eq(scheme, "http"))
+    return 80;
+  if (http_slice_eq(scheme, "https"))
+    return 443;
+  return 0;
+}
+
+/*
+ * uri_parse_authority - "[userinfo@]host[:port]"를 파싱해서 u의 userinfo/hostport/host/port/ipv6/port_num을 채운다.
+ *   port가 없으면 port_num은 0. Host 헤더 값을 파싱할 때도 쓴다. 성공하면 0, 잘못됐으면 -1
+ */
+int uri_parse_authority(const char *s, int len, uri_parts *u) {
+  const char *p = s, *end = s + len, *at, *h, *hend;
+  int port = 0;
+
+  pthread_once(&cls_once, cls_init);
+  u->userinfo = mkslice(p, p);
+  u->port = mkslice(end, end);
+  u->port_num = 0;
+  u->ipv6 = 0;
+
+  // userinfo는 '@'를 가질 수 없으므로 마지막 '@' 앞이 userinfo고, 그 안에 '@'가 또 있으면 잘못된 것
+  for (at = end; at > p && at[-1] != '@'; at--)
+    ;
+  if (at > p) {
+    if (!valid_chars(p, at - 1, C_ALPHA | C_DIGIT | C_UNRES | C_SUB, 1, ":"))
+      return -1;
+    u->userinfo = mkslice(p, at - 1);
+    p = at;
+  }
+  u->hostport = mkslice(p, end);
+
+  if (p < end && *p == '[') {
+    // IP-literal
+    if ((hend = memchr(p, ']', end - p)) == NULL || !valid_ipv6(p + 1, hend))
+      return -1;
+    u->host = mkslice(p + 1, hend);
+    u->ipv6 = 1;
+    h = hend + 1;
+    if (h < end && *h != ':')
+      return -1;
+  } else {
+    // IPv4address 나 reg-name. 둘 다 아래 문자들로만 된다
+    h = find_char(p, end, ':');
+    if (!valid_chars(p, h, C_ALPHA | C_DIGIT | C_UNRES | C_SUB, 1, NULL))
+      return -1;
+    u->host = mkslice(p, h);
+  }
+
+  if (h < end) {   // ':' port
+    for (p = h + 1; p < end; p++) {
+      if (!IS(*p, C_DIGIT))
+        return -1;
+      port = port * 10 + (*p - '0');
+      if (port > 65535)
+        return -1;
+    }
+    u->port = mkslice(h + 1, end);
+    u->port_num = port;
+  }
+  return 0;
+}
+
+/*
+ * uri_parse - s[0..len)을 파싱한다. s는 NUL로 끝날 필요가 없고 수정되지 않는다.
+ *   absolute-form("http://host:port/path?q")과 origin-form("/path?q") 모두 받는다.
+ *   성공하면 0, RFC 3986 문법에 맞지 않으면 -1
+ */
+int uri_parse(const char *s, int len, uri_parts *u) {
+  const char *p = s, *end = s + len, *q, *frag;
+
+  pthread_once(&cls_once, cls_init);
+  memset(u, 0, sizeof(*u));
+  if (len <= 0)
+    return -1;
+
+  // fragment부터 떼어낸다
+  if ((frag = memchr(s, '#', len)) != NULL) {
+    if (!valid_chars(frag + 1, end, C_VISIBLE, 0, NULL))
+      return -1;
+    u->fragment = mkslice(frag + 1, end);
+    end = frag;
+  }
+
+  // scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." ) ":"
+  if (IS(*p, C_ALPHA)) {
+    for (q = p + 1; q < end && IS(*q, C_ALPHA | C_DIGIT | C_SCHEME); q++)
+      ;
+    if (q < end && *q == ':') {
+      u->scheme = mkslice(p, q);
+      p = q + 1;
+    }
+  }
+
+  // "//" authority
+  if (end - p >= 2 && p[0] == '/' && p[1] == '/') {
+    q = authority_end(p + 2, end);
+    if (uri_parse_authority(p + 2, q - (p + 2), u) < 0)
+      return -1;
+    if (u->host.len == 0 && u->scheme.len > 0 && uri_default_port(u->scheme))
+      return -1;   // http/https는 host가 꼭 있어야 한다 (RFC 7230 2.7.1)
+    u->has_authority = 1;
+    p = q;
+  } else if (u->scheme.len == 0 && p < end && *p != '/') {
+    return -1;     // scheme 없는 상대 경로는 request-target이 될 수 없다
+  }
+  if (u->port.len == 0 && u->scheme.len > 0)
+    u->port_num = uri_default_port(u->scheme);
+
+  // path [ "?" query ]
+  q = find_char(p, end, '?');
+  if (!valid_chars(p, q, C_VISIBLE, 0, NULL))
+    return -1;
+  u->path = mkslice(p, q);
+  if (q < end) {
+    if (!valid_chars(q + 1, end, C_VISIBLE, 0, NULL))
+      return -1;
+    u->query = mkslice(q + 1, end);
+  }
+  u->target = mkslice(p, end);
+  return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * uri.h - RFC 3986 URI parser
+ *
+ * 입력을 수정하지 않고, 힙도 쓰지 않고 각 부분을 입력 안의 slice로 돌려준다.
+ * slice는 입력 버퍼가 살아 있는 동안만 유효하다.
+ */
+#ifndef __URI_H__
+#define __URI_H__
+
+#include "http.h"
+
+typedef struct {
+  http_slice scheme;    // "http". 없으면 len 0 (origin-form "/path")
+  http_slice userinfo;  // "user:pw" ('@' 제외)
+  http_slice hostport;  // userinfo를 뺀 authority: "host:port", "[::1]:8080"
+  http_slice host;      // IPv6 literal이면 대괄호 제외
+  http_slice port;      // 숫자만. 없거나 "host:" 처럼 비었으면 len 0
+  http_slice path;      // 비어 있을 수 있다 ("http://h?q")
+  http_slice query;     // '?' 제외. 없으면 p == NULL
+  http_slice fragment;  // '#' 제외. 없으면 p == NULL
+  http_slice target;    // path + ['?' query]. origin 서버에 보낼 request-target (비었으면 "/"를 앞에 붙인다)
+  int has_authority;    // "//"로 시작하는 authority가 있었는지
+  int ipv6;             // host가 IP literal인지
+  int port_num;         // port 값. 없으면 scheme의 기본 포트 (http 80, https 443), 모르면 0
+} uri_parts;
+
+int uri_parse(const char *s, int len, uri_parts *u);
+int uri_parse_authority(const char *s, int len, uri_parts *u);
+int uri_default_port(http_slice scheme);
+
+#endif /* __URI_H__ */